@@ -0,0 +1,478 @@
+//------------------------------------------------------------------------------
+// The MIT License (MIT)
+//
+// Copyright (c) 2015 Lukáš Mandák <lukas.mandak@yandex.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//
+// archive.cpp
+//
+//
+//
+//------------------------------------------------------------------------------
+#include "archive.hpp"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "process.hpp"
+
+
+namespace lm {
+
+
+namespace {
+
+
+inline uint64_t zigzag(const int64_t v)
+{
+	return ((uint64_t) v << 1) ^ (uint64_t) (v >> 63);
+}
+
+inline int64_t unzigzag(const uint64_t v)
+{
+	return (int64_t) (v >> 1) ^ -(int64_t) (v & 1);
+}
+
+inline void put_varint(std::vector<uint8_t> *buf, uint64_t v)
+{
+	while (v >= 0x80) {
+		buf->push_back((uint8_t) (v | 0x80));
+		v >>= 7;
+	}
+	buf->push_back((uint8_t) v);
+}
+
+//!
+//! Returns false when varint runs past end.
+//!
+inline bool get_varint(const uint8_t **p, const uint8_t *end, uint64_t *v)
+{
+	uint64_t result = 0;
+	int shift = 0;
+
+	while (*p < end && shift < 64) {
+		const uint8_t b = *(*p)++;
+		result |= (uint64_t) (b & 0x7f) << shift;
+		if ((b & 0x80) == 0) {
+			*v = result;
+			return true;
+		}
+		shift += 7;
+	}
+
+	return false;
+}
+
+
+int count_fields(const std::string &line)
+{
+	int cnt = 0;
+	bool in_field = false;
+	for (char c : line) {
+		const bool space = (c == ' ' || c == '\t' || c == '\r');
+		if (!space && !in_field)
+			++cnt;
+		in_field = !space;
+	}
+	return cnt;
+}
+
+
+} // namespace
+
+
+int parse_capture_line(const std::string &line, uint64_t *time,
+                       std::vector<int> *axes)
+{
+	const int sensor_cnt = ARCHIVE_CHANNELS / 3;
+
+	if (count_fields(line) != ARCHIVE_CHANNELS + 1)
+		return parse_raw_axes(line, sensor_cnt, axes);
+
+	char *end;
+	*time = strtoull(line.c_str(), &end, 10);
+	if (parse_raw_axes(end, sensor_cnt, axes) != 0)
+		return -1;
+
+	return 1;
+}
+
+
+// ArchiveWriter
+ArchiveWriter::ArchiveWriter() :
+	file_(nullptr),
+	offset_(0),
+	last_time_(0),
+	block_(),
+	index_(),
+	buffer_()
+{
+
+}
+
+ArchiveWriter::~ArchiveWriter()
+{
+	close();
+}
+
+int ArchiveWriter::open(const std::string &path)
+{
+	file_ = fopen(path.c_str(), "wb");
+	if (file_ == nullptr) {
+		fprintf(stderr, "Unable to open %s: %s\n", path.c_str(),
+		        strerror(errno));
+		return -1;
+	}
+
+	ArchiveHeader header;
+	header.magic = ARCHIVE_MAGIC;
+	header.version = ARCHIVE_VERSION;
+	header.channels = ARCHIVE_CHANNELS;
+	if (fwrite(&header, sizeof (header), 1, file_) != 1) {
+		fprintf(stderr, "Unable to write %s\n", path.c_str());
+		return -1;
+	}
+	offset_ = sizeof (header);
+	last_time_ = 0;
+
+	return 0;
+}
+
+int ArchiveWriter::close()
+{
+	if (file_ == nullptr)
+		return 0;
+
+	int status = write_block();
+
+	//
+	// Index is read in place, align it.
+	//
+	const char pad[8] = { 0 };
+	const size_t pad_len = (8 - offset_ % 8) % 8;
+	if (fwrite(pad, 1, pad_len, file_) != pad_len)
+		status = -1;
+	offset_ += pad_len;
+
+	ArchiveFooter footer;
+	footer.index_offset = offset_;
+	footer.block_cnt = index_.size();
+	footer.magic = ARCHIVE_MAGIC;
+	footer.reserved = 0;
+
+	if (!index_.empty() &&
+	    fwrite(index_.data(), sizeof (ArchiveBlockInfo), index_.size(),
+	           file_) != index_.size())
+		status = -1;
+	if (fwrite(&footer, sizeof (footer), 1, file_) != 1)
+		status = -1;
+	offset_ += index_.size() * sizeof (ArchiveBlockInfo) + sizeof (footer);
+
+	if (fclose(file_) != 0)
+		status = -1;
+	file_ = nullptr;
+	index_.clear();
+
+	if (status != 0)
+		fprintf(stderr, "Unable to finish archive.\n");
+	return status;
+}
+
+int ArchiveWriter::append(const uint64_t time,
+                          const int16_t axes[ARCHIVE_CHANNELS])
+{
+	if (file_ == nullptr)
+		return -1;
+
+	//
+	// Block is cleared once written, so the index stays sorted only if
+	// time is checked against the last sample of any block.
+	//
+	if (time < last_time_)
+		return -1;
+
+	last_time_ = time;
+	block_.time.push_back(time);
+	for (int c = 0; c < ARCHIVE_CHANNELS; ++c)
+		block_.axis[c].push_back(axes[c]);
+
+	if (block_.size() == ARCHIVE_BLOCK_LENGTH)
+		return write_block();
+
+	return 0;
+}
+
+int ArchiveWriter::write_block()
+{
+	const size_t n = block_.size();
+	if (n == 0)
+		return 0;
+
+	ArchiveBlockInfo info;
+	memset(&info, 0, sizeof (info));
+	info.offset = offset_;
+	info.count = n;
+	info.t_first = block_.time.front();
+	info.t_last = block_.time.back();
+
+	buffer_.clear();
+
+	//
+	// Delta of deltas, the first delta is relative to zero.
+	//
+	int64_t prev_delta = 0;
+	for (size_t i = 1; i < n; ++i) {
+		const int64_t delta = block_.time[i] - block_.time[i - 1];
+		put_varint(&buffer_, zigzag(delta - prev_delta));
+		prev_delta = delta;
+	}
+
+	for (int c = 0; c < ARCHIVE_CHANNELS; ++c) {
+		const std::vector<int16_t> &col = block_.axis[c];
+		int16_t lo = col[0];
+		int16_t hi = col[0];
+		int prev = 0;
+
+		for (size_t i = 0; i < n; ++i) {
+			put_varint(&buffer_, zigzag(col[i] - prev));
+			prev = col[i];
+			lo = std::min(lo, col[i]);
+			hi = std::max(hi, col[i]);
+		}
+
+		info.min[c] = lo;
+		info.max[c] = hi;
+	}
+
+	info.size = buffer_.size();
+
+	block_.time.clear();
+	for (int c = 0; c < ARCHIVE_CHANNELS; ++c)
+		block_.axis[c].clear();
+
+	if (fwrite(buffer_.data(), 1, buffer_.size(), file_) != buffer_.size()) {
+		fprintf(stderr, "Unable to write block: %s\n", strerror(errno));
+		return -1;
+	}
+
+	offset_ += buffer_.size();
+	index_.push_back(info);
+	return 0;
+}
+
+
+// ArchiveReader
+ArchiveReader::ArchiveReader() :
+	base_(nullptr),
+	size_(0),
+	index_(nullptr),
+	block_cnt_(0)
+{
+
+}
+
+ArchiveReader::~ArchiveReader()
+{
+	close();
+}
+
+int ArchiveReader::open(const std::string &path)
+{
+	close();
+
+	const int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd == -1) {
+		fprintf(stderr, "Unable to open %s: %s\n", path.c_str(),
+		        strerror(errno));
+		return -1;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof (ArchiveHeader)
+	                                               + sizeof (ArchiveFooter)) {
+		fprintf(stderr, "Invalid archive %s\n", path.c_str());
+		::close(fd);
+		return -1;
+	}
+
+	void *base = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (base == MAP_FAILED) {
+		fprintf(stderr, "Unable to map %s: %s\n", path.c_str(),
+		        strerror(errno));
+		return -1;
+	}
+	base_ = (const uint8_t *) base;
+	size_ = st.st_size;
+
+	ArchiveHeader header;
+	ArchiveFooter footer;
+	memcpy(&header, base_, sizeof (header));
+	memcpy(&footer, base_ + size_ - sizeof (footer), sizeof (footer));
+
+	if (header.magic != ARCHIVE_MAGIC || header.version != ARCHIVE_VERSION ||
+	    header.channels != ARCHIVE_CHANNELS ||
+	    footer.magic != ARCHIVE_MAGIC ||
+	    footer.index_offset + footer.block_cnt * sizeof (ArchiveBlockInfo)
+	    != size_ - sizeof (footer) ||
+	    footer.index_offset % alignof (ArchiveBlockInfo) != 0) {
+		fprintf(stderr, "Invalid archive %s\n", path.c_str());
+		close();
+		return -1;
+	}
+
+	index_ = (const ArchiveBlockInfo *) (base_ + footer.index_offset);
+	block_cnt_ = footer.block_cnt;
+
+	for (size_t i = 0; i < block_cnt_; ++i) {
+		if (index_[i].offset + index_[i].size > footer.index_offset ||
+		    index_[i].count > ARCHIVE_BLOCK_LENGTH) {
+			fprintf(stderr, "Invalid block index in %s\n",
+			        path.c_str());
+			close();
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+void ArchiveReader::close()
+{
+	if (base_ != nullptr)
+		munmap((void *) base_, size_);
+
+	base_ = nullptr;
+	size_ = 0;
+	index_ = nullptr;
+	block_cnt_ = 0;
+}
+
+void ArchiveReader::find_blocks(const uint64_t t0, const uint64_t t1,
+                                std::vector<size_t> *blocks) const
+{
+	//
+	// Blocks are sorted by time, skip to the first one ending at t0.
+	//
+	const ArchiveBlockInfo *first = std::lower_bound(index_,
+	        index_ + block_cnt_, t0,
+	        [](const ArchiveBlockInfo &b, const uint64_t t) {
+	                return b.t_last < t;
+	        });
+
+	for (const ArchiveBlockInfo *b = first;
+	     b != index_ + block_cnt_ && b->t_first <= t1; ++b)
+		blocks->push_back(b - index_);
+}
+
+int ArchiveReader::decode_block(const size_t i, ArchiveColumns *out) const
+{
+	if (i >= block_cnt_)
+		return -1;
+
+	const ArchiveBlockInfo &info = index_[i];
+	const uint8_t *p = base_ + info.offset;
+	const uint8_t *end = p + info.size;
+	const size_t n = info.count;
+	uint64_t v;
+
+	out->time.resize(n);
+	if (n == 0)
+		return 0;
+
+	uint64_t t = info.t_first;
+	int64_t delta = 0;
+	out->time[0] = t;
+	for (size_t k = 1; k < n; ++k) {
+		if (!get_varint(&p, end, &v))
+			return -1;
+		delta += unzigzag(v);
+		t += delta;
+		out->time[k] = t;
+	}
+
+	for (int c = 0; c < ARCHIVE_CHANNELS; ++c) {
+		std::vector<int16_t> &col = out->axis[c];
+		col.resize(n);
+
+		int prev = 0;
+		for (size_t k = 0; k < n; ++k) {
+			if (!get_varint(&p, end, &v))
+				return -1;
+			prev += (int) unzigzag(v);
+			col[k] = (int16_t) prev;
+		}
+	}
+
+	return (p == end) ? 0 : -1;
+}
+
+int ArchiveReader::decode_blocks(const std::vector<size_t> &blocks,
+                                 const unsigned thread_cnt,
+                                 std::vector<ArchiveColumns> *out) const
+{
+	out->resize(blocks.size());
+
+	std::atomic<size_t> next(0);
+	std::atomic<int> status(0);
+
+	//
+	// Blocks are independent, workers just take the next undecoded one.
+	//
+	auto worker = [&]() {
+		size_t k;
+		while ((k = next.fetch_add(1)) < blocks.size()) {
+			if (decode_block(blocks[k], &(*out)[k]) != 0)
+				status.store(-1);
+		}
+	};
+
+	const unsigned n = std::max(1u, std::min<unsigned>(thread_cnt,
+	                                                   blocks.size()));
+	std::vector<std::thread> threads;
+	for (unsigned t = 1; t < n; ++t)
+		threads.push_back(std::thread(worker));
+	worker();
+
+	for (auto &t : threads)
+		t.join();
+
+	if (status.load() != 0)
+		fprintf(stderr, "Corrupted archive block.\n");
+	return status.load();
+}
+
+
+} // namespace lm
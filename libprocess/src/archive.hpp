@@ -0,0 +1,183 @@
+//------------------------------------------------------------------------------
+// The MIT License (MIT)
+//
+// Copyright (c) 2015 Lukáš Mandák <lukas.mandak@yandex.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//
+// archive.hpp
+//
+// Compressed columnar archive of raw sensor samples (nine i16 axes and
+// timestamp per sample). File layout:
+//
+//   ArchiveHeader | block | block | ... | ArchiveBlockInfo[] | ArchiveFooter
+//
+// Block holds ARCHIVE_BLOCK_LENGTH samples stored column after column.
+// Timestamps are stored as zigzag varint of delta of deltas, so regularly
+// sampled data costs one byte per sample. Each axis stores its first value
+// followed by zigzag varint deltas. Block index at the end of file keeps
+// time range and per channel min / max of every block, so readers skip
+// blocks without touching them.
+//
+//------------------------------------------------------------------------------
+#ifndef _LIBPROCESS_ARCHIVE_H_
+#define _LIBPROCESS_ARCHIVE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+#include <string>
+#include <vector>
+
+
+namespace lm {
+
+
+#define ARCHIVE_MAGIC           (0x4d474e41u) // "MGNA"
+#define ARCHIVE_VERSION         (1)
+#define ARCHIVE_CHANNELS        (9)
+#define ARCHIVE_BLOCK_LENGTH    (4096)
+
+
+struct ArchiveHeader
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t channels;
+};
+
+struct ArchiveBlockInfo
+{
+	uint64_t offset;
+	uint32_t size;
+	uint32_t count;
+	uint64_t t_first;
+	uint64_t t_last;
+	int16_t min[ARCHIVE_CHANNELS];
+	int16_t max[ARCHIVE_CHANNELS];
+	uint32_t reserved;
+};
+
+static_assert(sizeof (ArchiveBlockInfo) == 72,
+              "ArchiveBlockInfo must not contain padding.");
+
+struct ArchiveFooter
+{
+	uint64_t index_offset;
+	uint64_t block_cnt;
+	uint32_t magic;
+	uint32_t reserved;
+};
+
+
+//!
+//! Decoded block, one vector per column.
+//!
+struct ArchiveColumns
+{
+	std::vector<uint64_t> time;
+	std::vector<int16_t> axis[ARCHIVE_CHANNELS];
+
+	inline size_t size() const { return time.size(); }
+};
+
+
+class ArchiveWriter
+{
+	FILE *file_;
+	uint64_t offset_;
+	uint64_t last_time_;
+	ArchiveColumns block_;
+	std::vector<ArchiveBlockInfo> index_;
+	std::vector<uint8_t> buffer_;
+
+public:
+	ArchiveWriter();
+	~ArchiveWriter();
+
+	ArchiveWriter(const ArchiveWriter &) = delete;
+	ArchiveWriter & operator = (const ArchiveWriter &) = delete;
+
+	int open(const std::string &path);
+
+	/** \brief Writes pending block, block index and footer. */
+	int close();
+
+	/** \brief Time must not decrease, also across blocks. */
+	int append(const uint64_t time, const int16_t axes[ARCHIVE_CHANNELS]);
+
+	inline uint64_t get_size() const { return offset_; }
+
+private:
+	int write_block();
+};
+
+
+class ArchiveReader
+{
+	const uint8_t *base_;
+	size_t size_;
+	const ArchiveBlockInfo *index_;
+	size_t block_cnt_;
+
+public:
+	ArchiveReader();
+	~ArchiveReader();
+
+	ArchiveReader(const ArchiveReader &) = delete;
+	ArchiveReader & operator = (const ArchiveReader &) = delete;
+
+	int open(const std::string &path);
+	void close();
+
+	inline size_t get_block_cnt() const { return block_cnt_; }
+	inline const ArchiveBlockInfo& get_block(const size_t i) const
+	{
+		return index_[i];
+	}
+
+	/** \brief Indices of blocks overlapping [t0, t1]. */
+	void find_blocks(const uint64_t t0, const uint64_t t1,
+	                 std::vector<size_t> *blocks) const;
+
+	int decode_block(const size_t i, ArchiveColumns *out) const;
+
+	/** \brief Decodes given blocks in parallel, out[k] gets blocks[k].
+	 *  \return 0 on success, -1 if any block is corrupted.
+	 */
+	int decode_blocks(const std::vector<size_t> &blocks,
+	                  const unsigned thread_cnt,
+	                  std::vector<ArchiveColumns> *out) const;
+};
+
+
+//!
+//! Parses captured serial line, optionally preceded by time in ns.
+//! Returns 1 if line carried time, 0 if not, -1 on error.
+//!
+int parse_capture_line(const std::string &line, uint64_t *time,
+                       std::vector<int> *axes);
+
+
+} // namespace lm
+
+
+#endif // _LIBPROCESS_ARCHIVE_H_
@@ -0,0 +1,210 @@
+//------------------------------------------------------------------------------
+// The MIT License (MIT)
+//
+// Copyright (c) 2015 Lukáš Mandák <lukas.mandak@yandex.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//
+// calibration.cpp
+//
+//
+//
+//------------------------------------------------------------------------------
+#include "calibration.hpp"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "geometry.hpp"
+#include "latency.hpp"
+#include "shared.hpp"
+
+
+namespace lm {
+
+
+namespace {
+
+
+const int kCalibrationVersion = 2;
+
+
+} // namespace
+
+
+uint64_t layout_hash(const PointVector &sensors)
+{
+	uint64_t h = 0xcbf29ce484222325ull;
+
+	for (auto &p : sensors) {
+		const double v[2] = { p.x, p.y };
+		const unsigned char *b = (const unsigned char *) v;
+		for (size_t i = 0; i < sizeof (v); ++i) {
+			h ^= b[i];
+			h *= 0x100000001b3ull;
+		}
+	}
+
+	return h;
+}
+
+int save_calibration(const std::string &path, const CalibrationState &state)
+{
+	const std::string tmp = path + ".tmp";
+
+	FILE *f = fopen(tmp.c_str(), "w");
+	if (f == nullptr) {
+		fprintf(stderr, "Unable to open %s: %s\n", tmp.c_str(),
+		        strerror(errno));
+		return -1;
+	}
+
+	fprintf(f, "# magneto calibration\n");
+	fprintf(f, "version %d\n", kCalibrationVersion);
+	fprintf(f, "time %llu\n", (unsigned long long) state.time);
+	fprintf(f, "layout %016llx\n", (unsigned long long) state.layout_hash);
+	fprintf(f, "environment");
+	for (auto v : state.environment)
+		fprintf(f, " %.17g", v);
+	fprintf(f, "\n");
+
+	for (size_t i = 0; i < state.iron.size(); ++i) {
+		const IronCorrection &c = state.iron[i];
+		fprintf(f, "iron %zu", i);
+		for (int k = 0; k < MD_AXIS_COUNT; ++k)
+			fprintf(f, " %.17g", c.offset[k]);
+		for (int k = 0; k < MD_AXIS_COUNT * MD_AXIS_COUNT; ++k)
+			fprintf(f, " %.17g", c.matrix[k]);
+		fprintf(f, " %llu %.17g\n", (unsigned long long) c.samples,
+		        c.residual);
+	}
+
+	if (fclose(f) != 0 || rename(tmp.c_str(), path.c_str()) != 0) {
+		fprintf(stderr, "Unable to write %s: %s\n", path.c_str(),
+		        strerror(errno));
+		unlink(tmp.c_str());
+		return -1;
+	}
+
+	return 0;
+}
+
+int load_calibration(const std::string &path, CalibrationState *state)
+{
+	std::ifstream in(path);
+	if (!in)
+		return -1;
+
+	int version = 0;
+	bool has_time = false, has_layout = false;
+	state->environment.clear();
+	state->iron.clear();
+
+	std::string line;
+	while (std::getline(in, line)) {
+		if (line.empty() || line[0] == '#')
+			continue;
+
+		std::istringstream ls(line);
+		std::string key;
+		ls >> key;
+
+		if (key == "version") {
+			ls >> version;
+		} else if (key == "time") {
+			has_time = static_cast<bool>(ls >> state->time);
+		} else if (key == "layout") {
+			has_layout = static_cast<bool>(ls >> std::hex
+			                               >> state->layout_hash);
+		} else if (key == "environment") {
+			double v;
+			while (ls >> v)
+				state->environment.push_back(v);
+		} else if (key == "iron") {
+			size_t i;
+			IronCorrection c;
+			ls >> i;
+			for (int k = 0; k < MD_AXIS_COUNT; ++k)
+				ls >> c.offset[k];
+			for (int k = 0; k < MD_AXIS_COUNT * MD_AXIS_COUNT; ++k)
+				ls >> c.matrix[k];
+			ls >> c.samples >> c.residual;
+			if (!ls || i != state->iron.size()) {
+				fprintf(stderr, "Invalid iron correction in %s\n",
+				        path.c_str());
+				return -1;
+			}
+			state->iron.push_back(c);
+		}
+	}
+
+	if (version != kCalibrationVersion || !has_time || !has_layout ||
+	    state->environment.empty()) {
+		fprintf(stderr, "Invalid calibration file %s\n", path.c_str());
+		return -1;
+	}
+
+	return 0;
+}
+
+int load_fresh_calibration(const std::string &path, const PointVector &sensors,
+                           const double max_age, CalibrationState *state)
+{
+	if (access(path.c_str(), F_OK) != 0)
+		return 1;
+
+	if (load_calibration(path, state) != 0)
+		return 1;
+
+	if (state->layout_hash != layout_hash(sensors) ||
+	    state->environment.size() != 3 * sensors.size()) {
+		fprintf(stderr, "Calibration %s is for different layout.\n",
+		        path.c_str());
+		return 1;
+	}
+
+	const uint64_t now = realtime_ns();
+	const double age = (now > state->time) ? (now - state->time) / 1e9 : 0.0;
+	if (!state->iron.empty() && state->iron.size() != sensors.size()) {
+		fprintf(stderr, "Calibration %s has %zu iron corrections.\n",
+		        path.c_str(), state->iron.size());
+		return 1;
+	}
+
+	if (age > max_age) {
+		fprintf(stderr, "Calibration %s is %.0f s old.\n", path.c_str(),
+		        age);
+		return 2;
+	}
+
+	return 0;
+}
+
+
+} // namespace lm
@@ -0,0 +1,76 @@
+//------------------------------------------------------------------------------
+// The MIT License (MIT)
+//
+// Copyright (c) 2015 Lukáš Mandák <lukas.mandak@yandex.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//
+// calibration.hpp
+//
+// Calibration state persisted between runs of process, so a restart does
+// not need to wait for calibration loops. State is valid only for the sensor
+// layout it was measured with.
+//
+//------------------------------------------------------------------------------
+#ifndef _LIBPROCESS_CALIBRATION_H_
+#define _LIBPROCESS_CALIBRATION_H_
+
+#include <cstdint>
+
+#include <string>
+#include <vector>
+
+#include "geometry.hpp"
+#include "shared.hpp"
+
+
+namespace lm {
+
+
+struct CalibrationState
+{
+	std::vector<double> environment;   // x, y, z of every sensor
+	std::vector<IronCorrection> iron;  // empty or one per sensor
+	uint64_t layout_hash;
+	uint64_t time;                  // wall clock [ns since epoch]
+};
+
+
+/** \brief FNV-1a hash of sensor positions. */
+uint64_t layout_hash(const PointVector &sensors);
+
+/** \brief Writes state to temporary file and renames it over path. */
+int save_calibration(const std::string &path, const CalibrationState &state);
+
+int load_calibration(const std::string &path, CalibrationState *state);
+
+//!
+//! Loads state if it exists and matches the layout. Returns 0 if it is not
+//! older than max_age seconds, 2 if it is (iron corrections describe the
+//! sensors and stay usable) and 1 if there is no usable state.
+//!
+int load_fresh_calibration(const std::string &path, const PointVector &sensors,
+                           const double max_age, CalibrationState *state);
+
+
+} // namespace lm
+
+
+#endif // _LIBPROCESS_CALIBRATION_H_
@@ -0,0 +1,515 @@
+//------------------------------------------------------------------------------
+// The MIT License (MIT)
+//
+// Copyright (c) 2015 Lukáš Mandák <lukas.mandak@yandex.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//
+// dipole.cpp
+//
+//
+//
+//------------------------------------------------------------------------------
+#include "dipole.hpp"
+
+#include <cmath>
+#include <cstdint>
+
+#include <algorithm>
+#include <vector>
+
+#include "geometry.hpp"
+#include "latency.hpp"
+#include "trace.hpp"
+
+
+namespace lm {
+
+
+namespace {
+
+
+//!
+//! Sources nearer than this to a sensor are fitted as if they were
+//! this far. [cm^2]
+//!
+const double kMinDistance2 = 0.01;
+
+//!
+//! Forward difference of the numeric jacobian, backward one when the
+//! shifted fit is not finite. [cm]
+//!
+const double kStep = 1e-4;
+
+/** \brief Fit has converged when a step is shorter. [cm] */
+const double kTolerance = 1e-3;
+
+//!
+//! Marquardt damping of the diagonal, divided by kDampingFactor after
+//! every accepted step and multiplied by it after every rejected one.
+//! Position is at minimum when even kMaxDamping does not lower the cost.
+//!
+const double kInitialDamping = 1e-3;
+const double kMinDamping = 1e-9;
+const double kMaxDamping = 1e9;
+const double kDampingFactor = 10.0;
+
+//!
+//! Damped diagonal is scaled by at least this fraction of the largest
+//! one, so a zero column of the jacobian does not leave it singular.
+//!
+const double kMinScale = 1e-6;
+
+//!
+//! Pivot of Cholesky factor smaller than this fraction of its diagonal
+//! means dependent columns, e.g. two sources at one place.
+//!
+const double kMinPivot = 1e-10;
+
+//!
+//! Solves symmetric positive definite n x n system a x = b given lower
+//! triangle of a, which is overwritten by its Cholesky factor. Returns
+//! -1 if a is singular.
+//!
+int solve_cholesky(const size_t n, double *a, const double *b, double *x)
+{
+	for (size_t j = 0; j < n; ++j) {
+		double d = a[j * n + j];
+		for (size_t k = 0; k < j; ++k)
+			d -= a[j * n + k] * a[j * n + k];
+		if (!(d > kMinPivot * a[j * n + j]))
+			return -1;
+
+		d = std::sqrt(d);
+		a[j * n + j] = d;
+		for (size_t i = j + 1; i < n; ++i) {
+			double v = a[i * n + j];
+			for (size_t k = 0; k < j; ++k)
+				v -= a[i * n + k] * a[j * n + k];
+			a[i * n + j] = v / d;
+		}
+	}
+
+	for (size_t i = 0; i < n; ++i) {
+		double v = b[i];
+		for (size_t k = 0; k < i; ++k)
+			v -= a[i * n + k] * x[k];
+		x[i] = v / a[i * n + i];
+	}
+	for (size_t i = n; i-- > 0;) {
+		double v = x[i];
+		for (size_t k = i + 1; k < n; ++k)
+			v -= a[k * n + i] * x[k];
+		x[i] = v / a[i * n + i];
+	}
+
+	return 0;
+}
+
+//!
+//! Kernel g maps moment of dipole at p to its field at sensor,
+//! it is symmetric.
+//!
+void dipole_kernel(const Point &sensor, const double p[3], double g[9])
+{
+	const double d[3] = { sensor.x - p[0], sensor.y - p[1], -p[2] };
+	const double r2 = std::max(d[0] * d[0] + d[1] * d[1] + d[2] * d[2],
+	                           kMinDistance2);
+	const double inv = 1.0 / (r2 * std::sqrt(r2));
+	for (int j = 0; j < 3; ++j) {
+		for (int i = 0; i < 3; ++i) {
+			g[3 * j + i] = (3.0 * d[j] * d[i] / r2
+			                - ((j == i) ? 1.0 : 0.0)) * inv;
+		}
+	}
+}
+
+/** \brief out += scale * g v for 3x3 g. */
+void multiply_add(const double g[9], const double v[3], const double scale,
+                  double out[3])
+{
+	for (int j = 0; j < 3; ++j) {
+		out[j] += scale * (g[3 * j] * v[0] + g[3 * j + 1] * v[1]
+		                   + g[3 * j + 2] * v[2]);
+	}
+}
+
+/** \brief Adds gk gl to 3x3 block of matrix with n columns. */
+void add_block(const double gk[9], const double gl[9], double *block,
+               const size_t n)
+{
+	for (int j = 0; j < 3; ++j) {
+		for (int i = 0; i < 3; ++i) {
+			block[j * n + i] += gk[3 * j] * gl[i]
+			                    + gk[3 * j + 1] * gl[3 + i]
+			                    + gk[3 * j + 2] * gl[6 + i];
+		}
+	}
+}
+
+} // namespace
+
+
+// MultiDipoleSolver
+MultiDipoleSolver::MultiDipoleSolver(const size_t max_sources,
+                                     const unsigned max_iterations) :
+	sensors_(),
+	max_sources_(max_sources),
+	max_iterations_(max_iterations),
+	iterations_(0),
+	kernel_(),
+	residual_(),
+	trial_(),
+	jacobian_(),
+	normal_(),
+	hessian_(),
+	work_()
+{
+
+}
+
+int MultiDipoleSolver::initialize(const PointVector &sensors)
+{
+	if (sensors.size() < 2 || sensors.size() > 32 || max_sources_ == 0)
+		return -1;
+
+	const size_t n = 3 * max_sources_;
+	sensors_ = sensors;
+	kernel_.assign(9 * max_sources_ * sensors.size(), 0.0);
+	residual_.assign(3 * sensors.size(), 0.0);
+	trial_.assign(3 * sensors.size(), 0.0);
+	jacobian_.assign(n * 3 * sensors.size(), 0.0);
+	normal_.assign(n * n, 0.0);
+	hessian_.assign(2 * n * n, 0.0);
+	work_.assign(6 * n, 0.0);
+
+	return 0;
+}
+
+int MultiDipoleSolver::solve(const std::vector<double> &field,
+                             const uint32_t excluded, const size_t count,
+                             const uint64_t deadline, double *position,
+                             double *moment, double *cost)
+{
+	LM_TRACE("MultiDipoleSolver::solve");
+
+	const size_t rows = 3 * sensors_.size();
+	if (field.size() != rows || count == 0 || count > max_sources_)
+		return -1;
+
+	size_t active = 0;
+	for (size_t s = 0; s < sensors_.size(); ++s)
+		if ((excluded & (1u << s)) == 0)
+			++active;
+	if (3 * active <= 6 * count)
+		return -1;
+
+	//
+	// First vector of work_ belongs to evaluate().
+	//
+	const size_t n = 3 * count;
+	double *p = &work_[n];
+	double *q = &work_[2 * n];
+	double *m = &work_[3 * n];
+	double *g = &work_[4 * n];
+	double *step = &work_[5 * n];
+	double *a = &hessian_[0];
+	double *damped = &hessian_[n * n];
+
+	std::copy(position, position + n, p);
+	double c = evaluate(count, p, field, excluded, residual_.data(),
+	                    moment);
+	if (!std::isfinite(c))
+		return -1;
+
+	int ret = 1;
+	double damping = kInitialDamping;
+	unsigned it = 0;
+	while (ret != 0 && it < max_iterations_ && monotonic_ns() < deadline) {
+		++it;
+
+		//
+		// Jacobian of residuals, column per coordinate. Moments are
+		// solved again at every shifted position.
+		//
+		for (size_t k = 0; k < n; ++k) {
+			double *column = &jacobian_[k * rows];
+			double h = kStep;
+			std::copy(p, p + n, q);
+			q[k] += h;
+			bool finite = std::isfinite(evaluate(count, q,
+			        field, excluded, column, m));
+			if (!finite) {
+				h = -kStep;
+				q[k] = p[k] + h;
+				finite = std::isfinite(evaluate(count, q,
+				        field, excluded, column, m));
+			}
+			if (!finite) {
+				std::fill(column, column + rows, 0.0);
+				continue;
+			}
+			for (size_t i = 0; i < rows; ++i)
+				column[i] = (column[i] - residual_[i]) / h;
+		}
+
+		for (size_t j = 0; j < n; ++j) {
+			const double *cj = &jacobian_[j * rows];
+			g[j] = 0.0;
+			for (size_t i = 0; i < rows; ++i)
+				g[j] -= cj[i] * residual_[i];
+			for (size_t k = 0; k <= j; ++k) {
+				const double *ck = &jacobian_[k * rows];
+				double sum = 0.0;
+				for (size_t i = 0; i < rows; ++i)
+					sum += cj[i] * ck[i];
+				a[j * n + k] = a[k * n + j] = sum;
+			}
+		}
+
+		//
+		// Damping grows until the step lowers the cost.
+		//
+		double max_diag = 0.0;
+		for (size_t j = 0; j < n; ++j)
+			max_diag = std::max(max_diag, a[j * n + j]);
+
+		bool accepted = false;
+		double last_len2 = HUGE_VAL;
+		while (damping < kMaxDamping) {
+			std::copy(a, a + n * n, damped);
+			for (size_t j = 0; j < n; ++j)
+				damped[j * n + j] += damping * std::max(
+				        a[j * n + j], kMinScale * max_diag);
+			if (solve_cholesky(n, damped, g, step) != 0) {
+				damping *= kDampingFactor;
+				continue;
+			}
+
+			//
+			// Sources are kept above the sensor plane.
+			//
+			double len2 = 0.0;
+			for (size_t j = 0; j < n; ++j) {
+				q[j] = p[j] + step[j];
+				len2 += step[j] * step[j];
+			}
+			for (size_t k = 0; k < count; ++k)
+				q[3 * k + 2] = std::fabs(q[3 * k + 2]);
+
+			last_len2 = len2;
+			const double t = evaluate(count, q, field, excluded,
+			                          trial_.data(), m);
+			if (!(t < c)) {
+				damping *= kDampingFactor;
+				continue;
+			}
+
+			std::copy(q, q + n, p);
+			std::copy(m, m + n, moment);
+			residual_.swap(trial_);
+			c = t;
+			damping = std::max(damping / kDampingFactor,
+			                   kMinDamping);
+			accepted = true;
+			if (len2 < kTolerance * kTolerance)
+				ret = 0;
+			break;
+		}
+		if (!accepted) {
+			//
+			// At minimum when even the shortest step does not
+			// lower the cost, not converged when none was found.
+			//
+			if (last_len2 < kTolerance * kTolerance)
+				ret = 0;
+			break;
+		}
+	}
+
+	std::copy(p, p + n, position);
+	*cost = c;
+	iterations_ = it;
+
+	return ret;
+}
+
+double MultiDipoleSolver::fit_moments(const std::vector<double> &field,
+                                      const uint32_t excluded,
+                                      const size_t count,
+                                      const double *position,
+                                      double *moment)
+{
+	if (field.size() != 3 * sensors_.size() || count == 0 ||
+	    count > max_sources_)
+		return HUGE_VAL;
+
+	return evaluate(count, position, field, excluded, residual_.data(),
+	                moment);
+}
+
+double MultiDipoleSolver::evaluate(const size_t count,
+                                   const double *position,
+                                   const std::vector<double> &field,
+                                   const uint32_t excluded,
+                                   double *residual, double *moment)
+{
+	//
+	// Kernel G_sk maps moment of source k to field of sensor s and is
+	// symmetric. Moments minimizing residuals solve the normal
+	// equations sum_s G_sk G_sl m_l = sum_s G_sk B_s, only their lower
+	// triangle is needed.
+	//
+	const size_t n = 3 * count;
+	double *a = normal_.data();
+	double *b = work_.data();
+	std::fill(a, a + n * n, 0.0);
+	std::fill(b, b + n, 0.0);
+	for (size_t s = 0; s < sensors_.size(); ++s) {
+		if ((excluded & (1u << s)) != 0)
+			continue;
+
+		double *gs = &kernel_[9 * max_sources_ * s];
+		for (size_t k = 0; k < count; ++k) {
+			dipole_kernel(sensors_[s], &position[3 * k],
+			              &gs[9 * k]);
+		}
+
+		const double *f = &field[3 * s];
+		for (size_t k = 0; k < count; ++k) {
+			multiply_add(&gs[9 * k], f, 1.0, &b[3 * k]);
+			for (size_t l = 0; l <= k; ++l) {
+				add_block(&gs[9 * k], &gs[9 * l],
+				          &a[3 * k * n + 3 * l], n);
+			}
+		}
+	}
+	if (solve_cholesky(n, a, b, moment) != 0)
+		return HUGE_VAL;
+
+	double cost = 0.0;
+	for (size_t s = 0; s < sensors_.size(); ++s) {
+		double *r = &residual[3 * s];
+		if ((excluded & (1u << s)) != 0) {
+			r[0] = r[1] = r[2] = 0.0;
+			continue;
+		}
+
+		const double *gs = &kernel_[9 * max_sources_ * s];
+		const double *f = &field[3 * s];
+		std::copy(f, f + 3, r);
+		for (size_t k = 0; k < count; ++k)
+			multiply_add(&gs[9 * k], &moment[3 * k], -1.0, r);
+		cost += r[0] * r[0] + r[1] * r[1] + r[2] * r[2];
+	}
+
+	return cost;
+}
+
+
+// DipoleSolver
+DipoleSolver::DipoleSolver(const double height, const double range,
+                           const unsigned max_iterations) :
+	solver_(1, max_iterations),
+	sensor_count_(0),
+	center_(),
+	height_(height),
+	range_(range),
+	warm_(false),
+	position_()
+{
+
+}
+
+int DipoleSolver::initialize(const PointVector &sensors)
+{
+	if (solver_.initialize(sensors) != 0)
+		return -1;
+
+	sensor_count_ = sensors.size();
+	center_ = Point();
+	for (const auto &s : sensors)
+		center_ += s;
+	center_ = (1.0 / sensors.size()) * center_;
+	warm_ = false;
+
+	return 0;
+}
+
+void DipoleSolver::reset()
+{
+	warm_ = false;
+}
+
+int DipoleSolver::solve(const std::vector<double> &field,
+                        const uint32_t excluded, const Point &guess,
+                        const uint64_t deadline, DipoleFit *fit)
+{
+	LM_TRACE("DipoleSolver::solve");
+
+	size_t active = 0;
+	for (size_t s = 0; s < sensor_count_; ++s)
+		if ((excluded & (1u << s)) == 0)
+			++active;
+
+	//
+	// Last fit is the better start unless the source has jumped
+	// to where guess explains the field better.
+	//
+	double p[3] = { guess.x, guess.y, height_ };
+	double moment[3];
+	if (warm_) {
+		const double cost = solver_.fit_moments(field, excluded, 1, p,
+		                                        moment);
+		if (solver_.fit_moments(field, excluded, 1, position_,
+		                        moment) < cost)
+			std::copy(position_, position_ + 3, p);
+	}
+
+	double cost;
+	const int ret = solver_.solve(field, excluded, 1, deadline, p, moment,
+	                              &cost);
+	if (ret < 0) {
+		warm_ = false;
+		return -1;
+	}
+
+	std::copy(p, p + 3, fit->position);
+	std::copy(moment, moment + 3, fit->moment);
+	fit->residual = std::sqrt(cost / (3 * active));
+	fit->iterations = solver_.get_iterations();
+
+	//
+	// Far from sensors the field is too weak to fit anything but noise.
+	//
+	const double dx = p[0] - center_.x;
+	const double dy = p[1] - center_.y;
+	if (dx * dx + dy * dy + p[2] * p[2] > range_ * range_) {
+		warm_ = false;
+		return -1;
+	}
+
+	std::copy(p, p + 3, position_);
+	warm_ = (ret == 0);
+
+	return ret;
+}
+
+} // namespace lm
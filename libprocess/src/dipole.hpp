@@ -0,0 +1,164 @@
+//------------------------------------------------------------------------------
+// The MIT License (MIT)
+//
+// Copyright (c) 2015 Lukáš Mandák <lukas.mandak@yandex.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//
+// dipole.hpp
+//
+// Source localization in 3D. Source is a point dipole at height z above the
+// sensor plane, the field it makes at sensor s is (3 (m.u) u - m) / r^3 where
+// u is unit vector from the source to the sensor. Given position the moment
+// m is linear in the field and is solved in closed form, Levenberg-Marquardt
+// then only searches the position (variable projection).
+//
+// MultiDipoleSolver fits K sources this way, their moments are solved
+// together and the search is over 3K coordinates. Each source has six
+// unknowns, so K dipoles need more than 2K sensors. DipoleSolver fits one
+// source with it, every fit starts from the previous one, so a moving source
+// needs few iterations.
+//
+//------------------------------------------------------------------------------
+#ifndef _LIBPROCESS_DIPOLE_H_
+#define _LIBPROCESS_DIPOLE_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include <vector>
+
+#include "geometry.hpp"
+#include "shared.hpp"
+
+
+namespace lm {
+
+
+struct DipoleFit
+{
+	double position[3];             // x, y [cm], z above sensor plane
+	double moment[3];               // field units * cm^3
+	double residual;                // rms of field residuals
+	unsigned iterations;
+};
+
+
+class MultiDipoleSolver
+{
+	PointVector sensors_;
+	size_t max_sources_;
+	unsigned max_iterations_;
+	unsigned iterations_;
+
+	// scratch
+	std::vector<double> kernel_;    // 3x3 per sensor and source
+	std::vector<double> residual_;  // 3 per sensor
+	std::vector<double> trial_;
+	std::vector<double> jacobian_;  // column per coordinate
+	std::vector<double> normal_;    // of moments
+	std::vector<double> hessian_;   // of coordinates, and its damped copy
+	std::vector<double> work_;      // vectors of moments or coordinates
+
+public:
+	MultiDipoleSolver(const size_t max_sources = MD_SOURCE_COUNT,
+	                  const unsigned max_iterations = 20);
+
+	int initialize(const PointVector &sensors);
+
+	//!
+	//! Fits count sources to field, 3 axes per sensor, sensors in excluded
+	//! mask are left out. Position holds x, y, z of every source, it is
+	//! the start of the fit and receives the result, moment receives 3 per
+	//! source and cost the sum of squared residuals. Returns 0 on
+	//! convergence, 1 when monotonic deadline [ns] or iterations ran out
+	//! with the best fit so far and -1 if the sensors left do not
+	//! determine count sources.
+	//!
+	int solve(const std::vector<double> &field, const uint32_t excluded,
+	          const size_t count, const uint64_t deadline,
+	          double *position, double *moment, double *cost);
+
+	//!
+	//! Solves only moments of count sources at given positions. Returns
+	//! the cost, HUGE_VAL if the moments are not determined.
+	//!
+	double fit_moments(const std::vector<double> &field,
+	                   const uint32_t excluded, const size_t count,
+	                   const double *position, double *moment);
+
+	/** \brief Residuals of the last solve or fit, 3 per sensor. */
+	inline const std::vector<double>& get_residual() const
+	{
+		return residual_;
+	}
+
+	/** \brief Iterations of the last solve. */
+	inline unsigned get_iterations() const { return iterations_; }
+
+private:
+	double evaluate(const size_t count, const double *position,
+	                const std::vector<double> &field,
+	                const uint32_t excluded, double *residual,
+	                double *moment);
+};
+
+
+class DipoleSolver
+{
+	MultiDipoleSolver solver_;
+	size_t sensor_count_;
+	Point center_;                  // of sensors
+	double height_;
+	double range_;
+
+	bool warm_;
+	double position_[3];            // last fit, start of the next one
+
+public:
+	//!
+	//! First fit starts height above the guess, fits farther than range
+	//! from center of sensors are refused. [cm]
+	//!
+	DipoleSolver(const double height = 2.0, const double range = 40.0,
+	             const unsigned max_iterations = 20);
+
+	int initialize(const PointVector &sensors);
+
+	/** \brief Next fit starts from guess again, e.g. when source enters. */
+	void reset();
+
+	//!
+	//! Fits source field, 3 axes per sensor, sensors in excluded mask are
+	//! left out. Fit starts at the last converged one, or above guess
+	//! when that explains the field better. Iterations stop at monotonic
+	//! deadline [ns]. Returns 0 on convergence, 1 when deadline or
+	//! iterations ran out with best fit so far and -1 if less than three
+	//! sensors are left or the fit is out of range.
+	//!
+	int solve(const std::vector<double> &field, const uint32_t excluded,
+	          const Point &guess, const uint64_t deadline, DipoleFit *fit);
+};
+
+
+} // namespace lm
+
+
+#endif // _LIBPROCESS_DIPOLE_H_
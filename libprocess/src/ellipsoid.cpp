@@ -0,0 +1,426 @@
+//------------------------------------------------------------------------------
+// The MIT License (MIT)
+//
+// Copyright (c) 2015 Lukáš Mandák <lukas.mandak@yandex.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//
+// ellipsoid.cpp
+//
+//
+//
+//------------------------------------------------------------------------------
+#include "ellipsoid.hpp"
+
+#include <cmath>
+#include <cstdint>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "shared.hpp"
+#include "trace.hpp"
+
+
+namespace lm {
+
+
+namespace {
+
+
+//!
+//! Raw axis values are in thousands, fitting them unscaled squares
+//! the condition number of normal equations.
+//!
+const double kFitScale = 1.0 / 1024.0;
+
+//!
+//! Pivots smaller than this fraction of the largest diagonal element
+//! mean samples do not span all orientations.
+//!
+const double kFitMinPivot = 1e-10;
+
+//!
+//! Forgetting factor per sample, about 10^4 samples of memory.
+//!
+const double kIronForget = 0.9999;
+
+//!
+//! Scale errors of the sensors are a few percent, anything above this
+//! ratio of ellipsoid axes is a bad fit.
+//!
+const double kIronMaxAxisRatio = 1.5;
+
+//!
+//! Worker checks the queue at least this often.
+//!
+const std::chrono::milliseconds kIronIdleWait(100);
+
+
+//!
+//! Solves n x n system in place by Gaussian elimination with partial
+//! pivoting, solution is left in b.
+//!
+int gauss_solve(double *a, double *b, const int n, const double min_pivot)
+{
+	for (int c = 0; c < n; ++c) {
+		int p = c;
+		for (int r = c + 1; r < n; ++r)
+			if (std::abs(a[r * n + c]) > std::abs(a[p * n + c]))
+				p = r;
+
+		if (std::abs(a[p * n + c]) <= min_pivot)
+			return -1;
+
+		if (p != c) {
+			for (int k = 0; k < n; ++k)
+				std::swap(a[c * n + k], a[p * n + k]);
+			std::swap(b[c], b[p]);
+		}
+
+		for (int r = c + 1; r < n; ++r) {
+			const double f = a[r * n + c] / a[c * n + c];
+			for (int k = c; k < n; ++k)
+				a[r * n + k] -= f * a[c * n + k];
+			b[r] -= f * b[c];
+		}
+	}
+
+	for (int r = n - 1; r >= 0; --r) {
+		double sum = b[r];
+		for (int k = r + 1; k < n; ++k)
+			sum -= a[r * n + k] * b[k];
+		b[r] = sum / a[r * n + r];
+	}
+
+	return 0;
+}
+
+//!
+//! Cyclic Jacobi eigen decomposition of symmetric 3x3 matrix.
+//! Eigenvalues end up on diagonal of a, eigenvectors in columns of v.
+//!
+void jacobi_eigen(double a[9], double v[9])
+{
+	for (int i = 0; i < 9; ++i)
+		v[i] = (i % 4 == 0) ? 1.0 : 0.0;
+
+	for (int sweep = 0; sweep < 50; ++sweep) {
+		const double off = a[1] * a[1] + a[2] * a[2] + a[5] * a[5];
+		if (off < 1e-30)
+			return;
+
+		for (int p = 0; p < 2; ++p) {
+			for (int q = p + 1; q < 3; ++q) {
+				const double apq = a[p * 3 + q];
+				if (std::abs(apq) < 1e-300)
+					continue;
+
+				const double theta = (a[q * 3 + q] - a[p * 3 + p])
+				                     / (2.0 * apq);
+				const double t = ((theta >= 0.0) ? 1.0 : -1.0)
+				        / (std::abs(theta)
+				           + std::sqrt(theta * theta + 1.0));
+				const double c = 1.0 / std::sqrt(t * t + 1.0);
+				const double s = t * c;
+
+				for (int k = 0; k < 3; ++k) {
+					const double akp = a[k * 3 + p];
+					const double akq = a[k * 3 + q];
+					a[k * 3 + p] = c * akp - s * akq;
+					a[k * 3 + q] = s * akp + c * akq;
+				}
+				for (int k = 0; k < 3; ++k) {
+					const double apk = a[p * 3 + k];
+					const double aqk = a[q * 3 + k];
+					a[p * 3 + k] = c * apk - s * aqk;
+					a[q * 3 + k] = s * apk + c * aqk;
+				}
+				for (int k = 0; k < 3; ++k) {
+					const double vkp = v[k * 3 + p];
+					const double vkq = v[k * 3 + q];
+					v[k * 3 + p] = c * vkp - s * vkq;
+					v[k * 3 + q] = s * vkp + c * vkq;
+				}
+			}
+		}
+	}
+}
+
+
+} // namespace
+
+
+// EllipsoidFit
+EllipsoidFit::EllipsoidFit(const double forget) :
+	weight_(0.0),
+	count_(0),
+	forget_(forget)
+{
+	reset();
+}
+
+void EllipsoidFit::reset()
+{
+	std::fill(ata_, ata_ + N * N, 0.0);
+	std::fill(atb_, atb_ + N, 0.0);
+	weight_ = 0.0;
+	count_ = 0;
+}
+
+void EllipsoidFit::add(const double x, const double y, const double z)
+{
+	const double sx = x * kFitScale;
+	const double sy = y * kFitScale;
+	const double sz = z * kFitScale;
+	const double row[N] = {
+		sx * sx, sy * sy, sz * sz,
+		2.0 * sx * sy, 2.0 * sx * sz, 2.0 * sy * sz,
+		2.0 * sx, 2.0 * sy, 2.0 * sz
+	};
+
+	if (forget_ < 1.0) {
+		for (int i = 0; i < N * N; ++i)
+			ata_[i] *= forget_;
+		for (int i = 0; i < N; ++i)
+			atb_[i] *= forget_;
+		weight_ *= forget_;
+	}
+
+	for (int i = 0; i < N; ++i) {
+		for (int j = 0; j < N; ++j)
+			ata_[i * N + j] += row[i] * row[j];
+		atb_[i] += row[i];
+	}
+	weight_ += 1.0;
+	++count_;
+}
+
+int EllipsoidFit::solve(const double max_axis_ratio, IronCorrection *out) const
+{
+	if (count_ < (uint64_t) N || out == nullptr)
+		return -1;
+
+	//
+	// Quadric coefficients.
+	//
+	double a[N * N];
+	double p[N];
+	std::copy(ata_, ata_ + N * N, a);
+	std::copy(atb_, atb_ + N, p);
+
+	double max_diag = 0.0;
+	for (int i = 0; i < N; ++i)
+		max_diag = std::max(max_diag, ata_[i * N + i]);
+
+	if (gauss_solve(a, p, N, kFitMinPivot * max_diag) != 0)
+		return -1;
+
+	//
+	// Center of the quadric solves q * c = -v.
+	//
+	double q[9] = {
+		p[0], p[3], p[4],
+		p[3], p[1], p[5],
+		p[4], p[5], p[2]
+	};
+	double center[3] = { -p[6], -p[7], -p[8] };
+	double tmp[9];
+	std::copy(q, q + 9, tmp);
+	if (gauss_solve(tmp, center, 3, 1e-300) != 0)
+		return -1;
+
+	double k = 1.0;
+	for (int i = 0; i < 3; ++i)
+		for (int j = 0; j < 3; ++j)
+			k += center[i] * q[i * 3 + j] * center[j];
+	if (k <= 0.0)
+		return -1;
+
+	//
+	// Shape of the ellipsoid (x - c)' (q / k) (x - c) = 1.
+	//
+	double v[9];
+	for (int i = 0; i < 9; ++i)
+		q[i] /= k;
+	jacobi_eigen(q, v);
+
+	const double l[3] = { q[0], q[4], q[8] };
+	if (l[0] <= 0.0 || l[1] <= 0.0 || l[2] <= 0.0)
+		return -1;
+
+	const double l_min = std::min(l[0], std::min(l[1], l[2]));
+	const double l_max = std::max(l[0], std::max(l[1], l[2]));
+	if (std::sqrt(l_max / l_min) > max_axis_ratio)
+		return -1;
+
+	//
+	// Matrix maps ellipsoid to sphere of radius equal to geometric mean
+	// of semi-axes, so corrected magnitudes stay in sensor units.
+	//
+	const double radius = 1.0 / std::cbrt(std::sqrt(l[0] * l[1] * l[2]));
+	for (int i = 0; i < 3; ++i) {
+		for (int j = 0; j < 3; ++j) {
+			double m = 0.0;
+			for (int e = 0; e < 3; ++e)
+				m += v[i * 3 + e] * std::sqrt(l[e]) * v[j * 3 + e];
+			out->matrix[i * 3 + j] = radius * m;
+		}
+		out->offset[i] = center[i] / kFitScale;
+	}
+
+	//
+	// Residual of the linear system, sum (row * p - 1)^2.
+	//
+	double res = weight_;
+	for (int i = 0; i < N; ++i) {
+		res -= 2.0 * p[i] * atb_[i];
+		for (int j = 0; j < N; ++j)
+			res += p[i] * ata_[i * N + j] * p[j];
+	}
+	out->residual = std::sqrt(std::max(res, 0.0) / weight_);
+	out->samples = count_;
+
+	return 0;
+}
+
+
+// IronCalibrator
+IronCalibrator::IronCalibrator(const size_t queue_length,
+                               const uint64_t min_samples,
+                               const uint64_t solve_interval) :
+	queue_(queue_length),
+	fits_(MD_SENSOR_COUNT, EllipsoidFit(kIronForget)),
+	min_samples_(min_samples),
+	solve_interval_(solve_interval),
+	mutex_(),
+	generation_(0),
+	thread_(),
+	wakeup_mutex_(),
+	wakeup_(),
+	running_(false),
+	dropped_(0)
+{
+
+}
+
+IronCalibrator::~IronCalibrator()
+{
+	stop();
+}
+
+int IronCalibrator::start()
+{
+	if (running_.exchange(true))
+		return 0;
+
+	thread_ = std::thread(&IronCalibrator::run, this);
+	return 0;
+}
+
+void IronCalibrator::stop()
+{
+	if (!running_.exchange(false))
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(wakeup_mutex_);
+	}
+	wakeup_.notify_one();
+	thread_.join();
+}
+
+void IronCalibrator::push(const std::vector<double> &field)
+{
+	if (field.size() < MD_SENSOR_COUNT * MD_AXIS_COUNT)
+		return;
+
+	Sample s;
+	std::copy(field.begin(), field.begin() + MD_SENSOR_COUNT * MD_AXIS_COUNT,
+	          s.field);
+
+	if (!queue_.push(s))
+		dropped_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void IronCalibrator::set(const IronCorrection iron[MD_SENSOR_COUNT])
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	std::copy(iron, iron + MD_SENSOR_COUNT, current_);
+	generation_.fetch_add(1, std::memory_order_release);
+}
+
+uint64_t IronCalibrator::get(IronCorrection iron[MD_SENSOR_COUNT]) const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	std::copy(current_, current_ + MD_SENSOR_COUNT, iron);
+	return generation_.load(std::memory_order_relaxed);
+}
+
+void IronCalibrator::run()
+{
+	uint64_t pending = 0;
+
+	while (running_.load()) {
+		Sample s;
+		while (queue_.pop(&s)) {
+			for (int i = 0; i < MD_SENSOR_COUNT; ++i) {
+				const double *f = &s.field[i * MD_AXIS_COUNT];
+				fits_[i].add(f[0], f[1], f[2]);
+			}
+
+			if (++pending >= solve_interval_) {
+				refit();
+				pending = 0;
+			}
+		}
+
+		std::unique_lock<std::mutex> lock(wakeup_mutex_);
+		if (running_.load())
+			wakeup_.wait_for(lock, kIronIdleWait);
+	}
+}
+
+void IronCalibrator::refit()
+{
+	LM_TRACE("IronCalibrator::refit");
+
+	IronCorrection next[MD_SENSOR_COUNT];
+	get(next);
+
+	bool changed = false;
+	for (int i = 0; i < MD_SENSOR_COUNT; ++i) {
+		if (fits_[i].get_count() < min_samples_)
+			continue;
+
+		if (fits_[i].solve(kIronMaxAxisRatio, &next[i]) == 0)
+			changed = true;
+	}
+
+	if (changed)
+		set(next);
+}
+
+
+} // namespace lm
@@ -0,0 +1,150 @@
+//------------------------------------------------------------------------------
+// The MIT License (MIT)
+//
+// Copyright (c) 2015 Lukáš Mandák <lukas.mandak@yandex.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//
+// ellipsoid.hpp
+//
+// Online hard and soft iron calibration. Away from magnets every sensor
+// should measure a field of constant magnitude, so its samples lie on an
+// ellipsoid whose center is the hard iron offset and whose shape is the soft
+// iron distortion. EllipsoidFit accumulates normal equations of the general
+// quadric, IronCalibrator feeds them from a background thread and publishes
+// corrections mapping the ellipsoid back to a sphere.
+//
+// Fit needs samples spanning many orientations, i.e. the device has to be
+// rotated; until then corrections stay as they were.
+//
+//------------------------------------------------------------------------------
+#ifndef _LIBPROCESS_ELLIPSOID_H_
+#define _LIBPROCESS_ELLIPSOID_H_
+
+#include <cstdint>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "queue.hpp"
+#include "shared.hpp"
+
+
+namespace lm {
+
+
+//!
+//! Incremental least squares fit of
+//! a x^2 + b y^2 + c z^2 + 2d xy + 2e xz + 2f yz + 2g x + 2h y + 2i z = 1.
+//! Older samples are exponentially forgotten.
+//!
+class EllipsoidFit
+{
+	static const int N = 9;
+
+	double ata_[N * N];
+	double atb_[N];
+	double weight_;
+	uint64_t count_;
+	const double forget_;
+
+public:
+	EllipsoidFit(const double forget = 1.0);
+
+	void add(const double x, const double y, const double z);
+	void reset();
+
+	//!
+	//! Computes correction from accumulated samples. Returns -1 when
+	//! samples do not determine an ellipsoid or its axes differ by more
+	//! than max_axis_ratio.
+	//!
+	int solve(const double max_axis_ratio, IronCorrection *out) const;
+
+	inline uint64_t get_count() const { return count_; }
+};
+
+
+//!
+//! Runs one EllipsoidFit per sensor on a background thread.
+//! Frames are handed over through a bounded queue and dropped when it is
+//! full, corrections are refitted every solve_interval samples.
+//!
+class IronCalibrator
+{
+	struct Sample {
+		double field[MD_SENSOR_COUNT * MD_AXIS_COUNT];
+	};
+
+	BoundedQueue<Sample> queue_;
+	std::vector<EllipsoidFit> fits_;
+	const uint64_t min_samples_;
+	const uint64_t solve_interval_;
+
+	mutable std::mutex mutex_;
+	IronCorrection current_[MD_SENSOR_COUNT];
+	std::atomic<uint64_t> generation_;
+
+	std::thread thread_;
+	std::mutex wakeup_mutex_;
+	std::condition_variable wakeup_;
+	std::atomic<bool> running_;
+	std::atomic<uint64_t> dropped_;
+
+public:
+	IronCalibrator(const size_t queue_length = 1024,
+	               const uint64_t min_samples = 500,
+	               const uint64_t solve_interval = 100);
+	~IronCalibrator();
+
+	IronCalibrator(const IronCalibrator &) = delete;
+	IronCalibrator & operator = (const IronCalibrator &) = delete;
+
+	int start();
+	void stop();
+
+	/** \brief Queues x, y, z of MD_SENSOR_COUNT sensors, never blocks. */
+	void push(const std::vector<double> &field);
+
+	/** \brief Replaces current corrections, e.g. with persisted ones. */
+	void set(const IronCorrection iron[MD_SENSOR_COUNT]);
+
+	/** \brief Copies current corrections, returns their generation. */
+	uint64_t get(IronCorrection iron[MD_SENSOR_COUNT]) const;
+
+	inline uint64_t get_generation() const
+	{
+		return generation_.load(std::memory_order_acquire);
+	}
+	inline uint64_t get_dropped() const { return dropped_.load(); }
+
+private:
+	void run();
+	void refit();
+};
+
+
+} // namespace lm
+
+
+#endif // _LIBPROCESS_ELLIPSOID_H_
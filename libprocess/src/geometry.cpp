@@ -29,6 +29,7 @@
 //------------------------------------------------------------------------------
 #include "geometry.hpp"
 
+#include <algorithm>
 #include <cmath>
 
 #include <iostream>
@@ -227,6 +228,130 @@ PointVector Circle::intersection(const Circle& other,
 	};
 }
 
+// GeneralizedCircle
+GeneralizedCircle::GeneralizedCircle() :
+	a_(0.0),
+	b_(),
+	c_(0.0)
+{
+
+}
+
+GeneralizedCircle::GeneralizedCircle(const double a, const Point &b,
+                                     const double c) :
+	a_(a),
+	b_(b),
+	c_(c)
+{
+	//
+	// Scale does not matter, keep coefficients comparable.
+	//
+	const double n = std::sqrt(a * a + b.x * b.x + b.y * b.y);
+	if (n > 0.0) {
+		a_ /= n;
+		b_ = b_ / n;
+		c_ /= n;
+	}
+}
+
+GeneralizedCircle GeneralizedCircle::apollonius(const Point &p, const Point &q,
+                                                const double ratio)
+{
+	const CircleCoefficients k = apollonius_coefficients(p.x, p.y, q.x, q.y,
+	                                                     ratio * ratio);
+	return GeneralizedCircle(k.a, Point(k.bx, k.by), k.c);
+}
+
+Circle GeneralizedCircle::to_circle(const Point &near,
+                                    const double max_radius) const
+{
+	Point foot, inward;
+
+	if (a_ != 0.0) {
+		const Point c = -1.0 / (2.0 * a_) * b_;
+		const double r2 = c.x * c.x + c.y * c.y - c_ / a_;
+		const double r = std::sqrt(std::max(r2, 0.0));
+		if (r <= max_radius)
+			return Circle(c, r);
+
+		const double d = dist(near, c);
+		if (d == 0.0)
+			return Circle(c, max_radius);
+		foot = c + (r / d) * (near - c);
+		inward = (1.0 / d) * (c - near);
+	} else {
+		const double n2 = b_.x * b_.x + b_.y * b_.y;
+		if (n2 == 0.0)
+			return Circle(near, 0.0);
+		const double t = (b_.x * near.x + b_.y * near.y + c_) / n2;
+		foot = near - t * b_;
+		inward = (t >= 0.0 ? -1.0 : 1.0) / std::sqrt(n2) * b_;
+	}
+
+	return Circle(foot + max_radius * inward, max_radius);
+}
+
+PointVector GeneralizedCircle::intersection(const GeneralizedCircle &other,
+                                            const double max_dist) const
+{
+	const GeneralizedCircle &s = *this;
+	const GeneralizedCircle &o = other;
+
+	PointVector points;
+
+	if (s.a_ == 0.0 && o.a_ == 0.0) {
+		//
+		// Two lines.
+		//
+		const double det = s.b_.x * o.b_.y - s.b_.y * o.b_.x;
+		if (det == 0.0)
+			return points;
+		const Point p((s.b_.y * o.c_ - o.b_.y * s.c_) / det,
+		              (o.b_.x * s.c_ - s.b_.x * o.c_) / det);
+		if (p.x * p.x + p.y * p.y <= max_dist * max_dist)
+			points.push_back(p);
+		return points;
+	}
+
+	const CircleCoefficients cs = { s.a_, s.b_.x, s.b_.y, s.c_ };
+	const CircleCoefficients co = { o.a_, o.b_.x, o.b_.y, o.c_ };
+	for (int root = -1; root <= 1; root += 2) {
+		double x, y;
+		if (intersection_root(cs, co, root, max_dist, &x, &y))
+			points.push_back(Point(x, y));
+	}
+
+	return points;
+}
+
+Point GeneralizedCircle::normal(const Point &x) const
+{
+	return 2.0 * a_ * x + b_;
+}
+
+int GeneralizedCircle::nearest(const Point &p, Point *out) const
+{
+	if (a_ == 0.0) {
+		const double bb = b_.x * b_.x + b_.y * b_.y;
+		if (bb == 0.0)
+			return -1;
+
+		*out = p - ((b_.x * p.x + b_.y * p.y + c_) / bb) * b_;
+		return 0;
+	}
+
+	const Point center = (-0.5 / a_) * b_;
+	const double r2 = center.x * center.x + center.y * center.y - c_ / a_;
+	const Point d = p - center;
+	const double len = std::sqrt(d.x * d.x + d.y * d.y);
+	if (r2 < 0.0 || len == 0.0)
+		return -1;       // imaginary circle, or p at its center
+
+	*out = center + (std::sqrt(r2) / len) * d;
+	return 0;
+}
+
+
 Triangle::Triangle(const PointVector &points) :
 	points_(),
 	area_(0.0)
@@ -287,6 +412,40 @@ Point midpoint(const Point& p1, const Point& p2)
 	return p1.midpoint(p2);
 }
 
+Point geometric_median(const PointVector &points, const int max_iterations,
+                       const double tolerance)
+{
+	if (points.empty())
+		return Point();
+
+	Point m;
+	for (auto &p : points)
+		m += p;
+	m = m / (double) points.size();
+
+	for (int it = 0; it < max_iterations; ++it) {
+		Point num;
+		double den = 0.0;
+		for (auto &p : points) {
+			const double d = dist(p, m);
+			if (d < 1e-12)
+				continue;       // Weiszfeld step is undefined there
+			num += (1.0 / d) * p;
+			den += 1.0 / d;
+		}
+		if (den == 0.0)
+			break;
+
+		const Point next = num / den;
+		const double step = dist(next, m);
+		m = next;
+		if (step < tolerance)
+			break;
+	}
+
+	return m;
+}
+
 std::ostream& operator << (std::ostream& os, const Point& p)
 {
 	os << '(' << p.x << ',' << p.y << ')';
@@ -30,7 +30,9 @@
 #ifndef _LIBPROCESS_GEOMETRY_H_
 #define _LIBPROCESS_GEOMETRY_H_
 
+#include <algorithm>
 #include <array>
+#include <cmath>
 #include <iostream>
 #include <vector>
 
@@ -107,6 +109,133 @@ public:
 
 typedef std::vector<lm::Circle> CircleVector;
 
+
+//!
+//! Circle or line a (x^2 + y^2) + b.x x + b.y y + c = 0, a line when a == 0.
+//! Apollonius circles of ratios close to one degrade smoothly to
+//! the bisector in this form, unlike center and radius.
+//!
+class GeneralizedCircle
+{
+	double a_;
+	Point b_;
+	double c_;
+
+public:
+	GeneralizedCircle();
+	GeneralizedCircle(const double a, const Point &b, const double c);
+
+	/** \brief Locus of points X with |X - p| = ratio * |X - q|. */
+	static GeneralizedCircle apollonius(const Point &p, const Point &q,
+	                                    const double ratio);
+
+	bool is_line() const { return a_ == 0.0; }
+
+	//!
+	//! Circle for display. Lines and circles larger than max_radius are
+	//! replaced by circle of max_radius touching them at point nearest
+	//! to near.
+	//!
+	Circle to_circle(const Point &near, const double max_radius) const;
+
+	//!
+	//! Intersects through radical line of both, which exists even when
+	//! either is a line. Points farther from origin than max_dist are
+	//! dropped, so nearly parallel lines give a single point.
+	//!
+	PointVector intersection(const GeneralizedCircle &other,
+	                         const double max_dist) const;
+
+	/** \brief Gradient at x, perpendicular to the locus through x. */
+	Point normal(const Point &x) const;
+
+	/** \brief Point of the locus nearest to p, -1 if there is none. */
+	int nearest(const Point &p, Point *out) const;
+};
+
+//!
+//! Normalized coefficients of GeneralizedCircle as plain values. The
+//! kernels below work on them without branches or calls, so loops over
+//! many circles vectorize (see magneto-layout).
+//!
+struct CircleCoefficients {
+	double a;
+	double bx, by;
+	double c;
+};
+
+/** \brief Coefficients of GeneralizedCircle::apollonius, kk = ratio^2. */
+inline CircleCoefficients apollonius_coefficients(const double px,
+                                                  const double py,
+                                                  const double qx,
+                                                  const double qy,
+                                                  const double kk)
+{
+	//
+	// |X - p|^2 - kk |X - q|^2 = 0
+	//
+	const double a = 1.0 - kk;
+	const double bx = -2.0 * (px - kk * qx);
+	const double by = -2.0 * (py - kk * qy);
+	const double c = px * px + py * py - kk * (qx * qx + qy * qy);
+	const double n = std::sqrt(a * a + bx * bx + by * by);
+	const double inv = (n > 0.0) ? 1.0 / n : 1.0;
+
+	return CircleCoefficients{ a * inv, bx * inv, by * inv, c * inv };
+}
+
+//!
+//! One of the two intersections of s and o, root -1 or 1, through their
+//! radical line as GeneralizedCircle::intersection.
+//! \return false if there is no such point, it is not finite or it is
+//! farther from origin than max_dist. Two lines have none here.
+//!
+inline bool intersection_root(const CircleCoefficients &s,
+                              const CircleCoefficients &o, const int root,
+                              const double max_dist, double *x, double *y)
+{
+	//
+	// Radical line n.X + m = 0, eliminates x^2 + y^2 without dividing
+	// by a of either.
+	//
+	const double nx = o.a * s.bx - s.a * o.bx;
+	const double ny = o.a * s.by - s.a * o.by;
+	const double m = o.a * s.c - s.a * o.c;
+	const double nn = nx * nx + ny * ny;
+
+	//
+	// Intersect it with the more circle-like of the two,
+	// X = x0 + t * d.
+	//
+	const bool first = std::fabs(s.a) >= std::fabs(o.a);
+	const CircleCoefficients &g = first ? s : o;
+	const double len = std::sqrt(nn);
+	const double x0 = -m * nx / nn;
+	const double y0 = -m * ny / nn;
+	const double dx = -ny / len;
+	const double dy = nx / len;
+
+	const double qa = g.a;
+	const double qb = 2.0 * g.a * (x0 * dx + y0 * dy) + g.bx * dx
+	                  + g.by * dy;
+	const double qc = g.a * (x0 * x0 + y0 * y0) + g.bx * x0 + g.by * y0
+	                  + g.c;
+	const double disc = qb * qb - 4.0 * qa * qc;
+
+	//
+	// Roots as q / a and c / q, neither cancels when a is close to zero,
+	// one of them just moves far away.
+	//
+	const double q = -0.5 * (qb + std::copysign(
+	        std::sqrt(std::max(disc, 0.0)), qb));
+	const double t = (root < 0) ? q / qa : qc / q;
+
+	*x = x0 + t * dx;
+	*y = y0 + t * dy;
+	return nn > 0.0 && disc >= 0.0 && std::isfinite(*x) &&
+	       std::isfinite(*y) && *x * *x + *y * *y <= max_dist * max_dist;
+}
+
 //!
 //! Body musia byť usporiadane v proticmere hodinovych ruciciek
 //!
@@ -142,6 +271,10 @@ double dist(const Point& p1, const Point& p2);
 
 Point midpoint(const Point& p1, const Point& p2);
 
+/** \brief Point minimizing sum of distances to all points (Weiszfeld). */
+Point geometric_median(const PointVector &points, const int max_iterations,
+                       const double tolerance);
+
 std::ostream& operator << (std::ostream& os, const Point& p);
 
 std::ostream& operator << (std::ostream& os, const Circle& c);
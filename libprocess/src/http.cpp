@@ -0,0 +1,549 @@
+//------------------------------------------------------------------------------
+// The MIT License (MIT)
+//
+// Copyright (c) 2015 Lukáš Mandák <lukas.mandak@yandex.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//
+// http.cpp
+//
+//
+//
+//------------------------------------------------------------------------------
+#include "http.hpp"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "latency.hpp"
+
+
+namespace lm {
+
+
+namespace {
+
+
+const int kMaxClients = 64;
+const int kMaxEvents = 16;
+const int kListenBacklog = 16;
+
+//!
+//! Requests longer than this are refused.
+//!
+const size_t kMaxRequestLength = 4096;
+
+//!
+//! Client with more unsent bytes than this skips events.
+//!
+const size_t kMaxClientBacklog = 64 * 1024;
+
+//!
+//! Loop wakes up at least this often to notice close() [ms].
+//!
+const int kEpollTimeout = 500;
+
+
+const char kPage[] =
+	"<!DOCTYPE html>\n"
+	"<html><head><meta charset=\"utf-8\"><title>magneto</title></head>\n"
+	"<body style=\"margin:0;background:#111;color:#ccc;font:14px monospace\">\n"
+	"<div id=\"info\">connecting</div>\n"
+	"<canvas id=\"view\" width=\"600\" height=\"600\"></canvas>\n"
+	"<script>\n"
+	"var c = document.getElementById('view').getContext('2d');\n"
+	"var info = document.getElementById('info');\n"
+	"var s = 15.0, ox = 300, oy = 450;\n"
+	"function pt(p) { return [ox + p[0] * s, oy - p[1] * s]; }\n"
+	"var es = new EventSource('stream' + location.search);\n"
+	"es.onmessage = function(e) {\n"
+	"  var d = JSON.parse(e.data);\n"
+	"  c.clearRect(0, 0, 600, 600);\n"
+	"  c.strokeStyle = '#357';\n"
+	"  d.circles.forEach(function(k) {\n"
+	"    var p = pt(k); c.beginPath();\n"
+	"    c.arc(p[0], p[1], k[2] * s, 0, 2 * Math.PI); c.stroke();\n"
+	"  });\n"
+	"  var r = pt(d.result); c.fillStyle = '#e44';\n"
+	"  c.beginPath(); c.arc(r[0], r[1], 5, 0, 2 * Math.PI); c.fill();\n"
+	"  info.textContent = d.sequence + '  ' + d.result[0].toFixed(2)\n"
+	"    + ', ' + d.result[1].toFixed(2) + '  |B| ' + d.magnitude.join(' ');\n"
+	"};\n"
+	"es.onerror = function() { info.textContent = 'disconnected'; };\n"
+	"</script></body></html>\n";
+
+
+std::string response(const char *status, const char *type,
+                     const std::string &body)
+{
+	std::string r = "HTTP/1.1 ";
+	r += status;
+	r += "\r\nContent-Type: ";
+	r += type;
+	r += "\r\nContent-Length: ";
+	r += std::to_string(body.size());
+	r += "\r\nConnection: close\r\n\r\n";
+	r += body;
+	return r;
+}
+
+//!
+//! Returns value of numeric query parameter or 0 if not present.
+//!
+double query_param(const std::string &target, const std::string &name)
+{
+	const auto q = target.find('?');
+	if (q == std::string::npos)
+		return 0.0;
+
+	size_t pos = q + 1;
+	while (pos < target.size()) {
+		size_t end = target.find('&', pos);
+		if (end == std::string::npos)
+			end = target.size();
+
+		if (target.compare(pos, name.size() + 1, name + "=") == 0)
+			return atof(target.substr(pos + name.size() + 1,
+			                          end - pos - name.size() - 1).c_str());
+		pos = end + 1;
+	}
+
+	return 0.0;
+}
+
+
+} // namespace
+
+
+int parse_http_spec(const std::string &spec, std::string *addr, int *port)
+{
+	const auto colon = spec.rfind(':');
+	if (colon == std::string::npos) {
+		*addr = "127.0.0.1";
+		*port = atoi(spec.c_str());
+	} else {
+		*addr = spec.substr(0, colon);
+		*port = atoi(spec.substr(colon + 1).c_str());
+	}
+
+	if (*port <= 0 || *port > 65535) {
+		fprintf(stderr, "Invalid port: %s\n", spec.c_str());
+		return -1;
+	}
+
+	return 0;
+}
+
+
+// HttpServer
+HttpServer::Client::Client() :
+	in(),
+	out(),
+	out_offset(0),
+	streaming(false),
+	closing(false),
+	interval_ns(0),
+	last_sent(0),
+	last_event(0),
+	pending(false)
+{
+
+}
+
+HttpServer::HttpServer() :
+	listen_fd_(-1),
+	epoll_fd_(-1),
+	event_fd_(-1),
+	thread_(),
+	running_(false),
+	mutex_(),
+	event_(),
+	event_cnt_(0),
+	clients_(),
+	client_cnt_(0),
+	skipped_(0)
+{
+
+}
+
+HttpServer::~HttpServer()
+{
+	close();
+}
+
+int HttpServer::open(const std::string &addr, const int port)
+{
+	struct sockaddr_in sa;
+	memset(&sa, 0, sizeof (sa));
+	sa.sin_family = AF_INET;
+	sa.sin_port = htons(port);
+	if (inet_pton(AF_INET, addr.c_str(), &sa.sin_addr) != 1) {
+		fprintf(stderr, "Invalid address: %s\n", addr.c_str());
+		return -1;
+	}
+
+	listen_fd_ = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+	                    0);
+	epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+	event_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (listen_fd_ == -1 || epoll_fd_ == -1 || event_fd_ == -1) {
+		fprintf(stderr, "Unable to create http server: %s\n",
+		        strerror(errno));
+		close();
+		return -1;
+	}
+
+	const int reuse = 1;
+	setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof (reuse));
+
+	if (bind(listen_fd_, (struct sockaddr *) &sa, sizeof (sa)) != 0 ||
+	    listen(listen_fd_, kListenBacklog) != 0) {
+		fprintf(stderr, "Unable to listen on %s:%d: %s\n", addr.c_str(),
+		        port, strerror(errno));
+		close();
+		return -1;
+	}
+
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.fd = listen_fd_;
+	epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd_, &ev);
+	ev.data.fd = event_fd_;
+	epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, event_fd_, &ev);
+
+	running_.store(true);
+	thread_ = std::thread(&HttpServer::run, this);
+
+	fprintf(stderr, "Streaming on http://%s:%d/\n", addr.c_str(), port);
+	return 0;
+}
+
+void HttpServer::close()
+{
+	if (running_.exchange(false)) {
+		const uint64_t one = 1;
+		if (write(event_fd_, &one, sizeof (one)) == -1) {
+			// loop notices within kEpollTimeout anyway
+		}
+		thread_.join();
+	}
+
+	for (auto &c : clients_)
+		::close(c.first);
+	clients_.clear();
+	client_cnt_.store(0);
+
+	for (int *fd : { &listen_fd_, &epoll_fd_, &event_fd_ }) {
+		if (*fd != -1) {
+			::close(*fd);
+			*fd = -1;
+		}
+	}
+}
+
+void HttpServer::publish(const std::string &data)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		event_ = data;
+		++event_cnt_;
+	}
+
+	const uint64_t one = 1;
+	if (write(event_fd_, &one, sizeof (one)) == -1) {
+		// counter overflow only, loop is already woken up
+	}
+}
+
+void HttpServer::run()
+{
+	struct epoll_event events[kMaxEvents];
+	std::string event;
+	uint64_t event_cnt = 0;
+
+	while (running_.load()) {
+		const int n = epoll_wait(epoll_fd_, events, kMaxEvents,
+		                         pending_timeout(monotonic_ns()));
+		if (n == -1 && errno != EINTR) {
+			fprintf(stderr, "epoll_wait: %s\n", strerror(errno));
+			break;
+		}
+
+		for (int i = 0; i < n; ++i) {
+			const int fd = events[i].data.fd;
+
+			if (fd == listen_fd_) {
+				accept_clients();
+				continue;
+			}
+
+			if (fd == event_fd_) {
+				uint64_t cnt;
+				if (read(event_fd_, &cnt, sizeof (cnt)) == -1)
+					continue;
+
+				{
+					std::lock_guard<std::mutex> lock(mutex_);
+					event = event_;
+					event_cnt = event_cnt_;
+				}
+
+				const uint64_t now = monotonic_ns();
+				for (auto it = clients_.begin(); it != clients_.end(); ) {
+					const int cfd = it->first;
+					Client &c = (it++)->second;
+					if (c.streaming && c.last_event != event_cnt) {
+						c.last_event = event_cnt;
+						send_event(cfd, c, event, now);
+					}
+				}
+				continue;
+			}
+
+			auto it = clients_.find(fd);
+			if (it == clients_.end())
+				continue;
+
+			if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+				remove_client(fd);
+				continue;
+			}
+			if (events[i].events & EPOLLIN) {
+				handle_input(fd, it->second);
+				if (clients_.find(fd) == clients_.end())
+					continue;
+			}
+			if (events[i].events & EPOLLOUT)
+				flush_output(fd, it->second);
+		}
+
+		send_pending(event, monotonic_ns());
+	}
+}
+
+void HttpServer::accept_clients()
+{
+	int fd;
+	while ((fd = accept4(listen_fd_, nullptr, nullptr,
+	                     SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+		if (clients_.size() >= (size_t) kMaxClients) {
+			::close(fd);
+			continue;
+		}
+
+		//
+		// Edge triggered, so EPOLLOUT fires only when socket
+		// becomes writable again and needs no re-arming.
+		//
+		struct epoll_event ev;
+		ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+		ev.data.fd = fd;
+		if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) != 0) {
+			::close(fd);
+			continue;
+		}
+
+		clients_[fd] = Client();
+		client_cnt_.store(clients_.size());
+	}
+}
+
+void HttpServer::handle_input(const int fd, Client &c)
+{
+	char buf[1024];
+
+	for (;;) {
+		const ssize_t n = recv(fd, buf, sizeof (buf), 0);
+		if (n == 0) {
+			remove_client(fd);
+			return;
+		}
+		if (n == -1) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			if (errno == EINTR)
+				continue;
+			remove_client(fd);
+			return;
+		}
+
+		//
+		// Anything sent after the request is ignored.
+		//
+		if (c.streaming || c.closing)
+			continue;
+
+		c.in.append(buf, n);
+		if (c.in.size() > kMaxRequestLength) {
+			c.in.clear();
+			c.closing = true;
+			c.out = response("431 Request Header Fields Too Large",
+			                 "text/plain", "");
+			flush_output(fd, c);
+			return;
+		}
+	}
+
+	if (!c.streaming && !c.closing &&
+	    c.in.find("\r\n\r\n") != std::string::npos)
+		handle_request(fd, c);
+}
+
+void HttpServer::handle_request(const int fd, Client &c)
+{
+	const auto sp1 = c.in.find(' ');
+	const auto sp2 = c.in.find(' ', sp1 + 1);
+	const std::string method = c.in.substr(0, sp1);
+	const std::string target = (sp1 == std::string::npos) ? ""
+	                           : c.in.substr(sp1 + 1, sp2 - sp1 - 1);
+	const std::string path = target.substr(0, target.find('?'));
+	c.in.clear();
+
+	if (method != "GET") {
+		c.closing = true;
+		c.out = response("405 Method Not Allowed", "text/plain", "");
+	} else if (path == "/") {
+		c.closing = true;
+		c.out = response("200 OK", "text/html; charset=utf-8", kPage);
+	} else if (path == "/stream") {
+		const double rate = query_param(target, "rate");
+		c.streaming = true;
+		c.interval_ns = (rate > 0.0) ? (uint64_t) (1e9 / rate) : 0;
+		c.out = "HTTP/1.1 200 OK\r\n"
+		        "Content-Type: text/event-stream\r\n"
+		        "Cache-Control: no-cache\r\n"
+		        "Connection: keep-alive\r\n"
+		        "Access-Control-Allow-Origin: *\r\n"
+		        "\r\n"
+		        "retry: 1000\n\n";
+	} else {
+		c.closing = true;
+		c.out = response("404 Not Found", "text/plain", "not found\n");
+	}
+
+	flush_output(fd, c);
+}
+
+void HttpServer::send_event(const int fd, Client &c, const std::string &event,
+                            const uint64_t now)
+{
+	//
+	// Decimate to rate requested by client, the latest event is sent
+	// when the interval expires.
+	//
+	if (c.interval_ns != 0 && c.last_sent != 0 &&
+	    now - c.last_sent < c.interval_ns) {
+		c.pending = true;
+		return;
+	}
+	c.pending = false;
+
+	if (c.out.size() - c.out_offset > kMaxClientBacklog) {
+		skipped_.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	c.out += "data: ";
+	c.out += event;
+	c.out += "\n\n";
+	c.last_sent = now;
+
+	flush_output(fd, c);
+}
+
+void HttpServer::send_pending(const std::string &event, const uint64_t now)
+{
+	for (auto it = clients_.begin(); it != clients_.end(); ) {
+		const int fd = it->first;
+		Client &c = (it++)->second;
+		if (c.pending && now - c.last_sent >= c.interval_ns)
+			send_event(fd, c, event, now);
+	}
+}
+
+int HttpServer::pending_timeout(const uint64_t now) const
+{
+	//
+	// Wake up when the first decimated event is due, rounded up
+	// to whole milliseconds.
+	//
+	uint64_t timeout = kEpollTimeout * 1000000ull;
+	for (const auto &it : clients_) {
+		const Client &c = it.second;
+		if (!c.pending)
+			continue;
+		const uint64_t due = c.last_sent + c.interval_ns;
+		timeout = std::min(timeout, (due > now) ? due - now : 0);
+	}
+
+	return (int) ((timeout + 999999) / 1000000);
+}
+
+void HttpServer::flush_output(const int fd, Client &c)
+{
+	while (c.out_offset < c.out.size()) {
+		const ssize_t n = send(fd, c.out.data() + c.out_offset,
+		                       c.out.size() - c.out_offset,
+		                       MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (n == -1) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return; // continues on EPOLLOUT
+			if (errno == EINTR)
+				continue;
+			remove_client(fd);
+			return;
+		}
+		c.out_offset += n;
+	}
+
+	c.out.clear();
+	c.out_offset = 0;
+
+	if (c.closing)
+		remove_client(fd);
+}
+
+void HttpServer::remove_client(const int fd)
+{
+	epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+	::close(fd);
+	clients_.erase(fd);
+	client_cnt_.store(clients_.size());
+}
+
+
+} // namespace lm
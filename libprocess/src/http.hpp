@@ -0,0 +1,124 @@
+//------------------------------------------------------------------------------
+// The MIT License (MIT)
+//
+// Copyright (c) 2015 Lukáš Mandák <lukas.mandak@yandex.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//
+// http.hpp
+//
+// Minimal HTTP server streaming frames to browsers as Server-Sent Events.
+//
+//   GET /                  live view page
+//   GET /stream[?rate=N]   text/event-stream, at most N events per second
+//
+// Server runs single epoll loop in its own thread. Publishing only replaces
+// the latest event and wakes the loop, clients that can not keep up skip
+// events instead of slowing the publisher down. Client whose rate skipped
+// an event gets the latest one once its interval expires, so it is never
+// left with a stale frame when publishing stops.
+//
+//------------------------------------------------------------------------------
+#ifndef _LIBPROCESS_HTTP_H_
+#define _LIBPROCESS_HTTP_H_
+
+#include <cstdint>
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+
+namespace lm {
+
+
+class HttpServer
+{
+	struct Client {
+		std::string in;
+		std::string out;
+		size_t out_offset;
+		bool streaming;
+		bool closing;
+		uint64_t interval_ns;
+		uint64_t last_sent;
+		uint64_t last_event;
+		bool pending;           // event decimated, sent once due
+
+		Client();
+	};
+
+	int listen_fd_;
+	int epoll_fd_;
+	int event_fd_;
+
+	std::thread thread_;
+	std::atomic<bool> running_;
+
+	std::mutex mutex_;
+	std::string event_;
+	uint64_t event_cnt_;
+
+	std::map<int, Client> clients_;
+	std::atomic<size_t> client_cnt_;
+	std::atomic<uint64_t> skipped_;
+
+public:
+	HttpServer();
+	~HttpServer();
+
+	HttpServer(const HttpServer &) = delete;
+	HttpServer & operator = (const HttpServer &) = delete;
+
+	/** \brief Listens on addr:port and starts the server thread. */
+	int open(const std::string &addr, const int port);
+	void close();
+
+	/** \brief Replaces the latest event, never blocks on clients. */
+	void publish(const std::string &data);
+
+	inline size_t get_client_cnt() const { return client_cnt_.load(); }
+	inline uint64_t get_skipped() const { return skipped_.load(); }
+
+private:
+	void run();
+
+	void accept_clients();
+	void handle_input(const int fd, Client &c);
+	void handle_request(const int fd, Client &c);
+	void send_event(const int fd, Client &c, const std::string &event,
+	                const uint64_t now);
+	void send_pending(const std::string &event, const uint64_t now);
+	int pending_timeout(const uint64_t now) const;
+	void flush_output(const int fd, Client &c);
+	void remove_client(const int fd);
+};
+
+
+/** \brief Splits "[<addr>:]<port>", address defaults to loopback. */
+int parse_http_spec(const std::string &spec, std::string *addr, int *port);
+
+
+} // namespace lm
+
+
+#endif // _LIBPROCESS_HTTP_H_
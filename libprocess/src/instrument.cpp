@@ -0,0 +1,237 @@
+//------------------------------------------------------------------------------
+// The MIT License (MIT)
+//
+// Copyright (c) 2015 Lukáš Mandák <lukas.mandak@yandex.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//
+// instrument.cpp
+//
+//
+//
+//------------------------------------------------------------------------------
+#include "instrument.hpp"
+
+#ifdef LM_INSTRUMENT
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+#include <atomic>
+
+#include <signal.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define LM_HAVE_TSC 1
+#endif
+
+#include "latency.hpp"
+
+
+namespace lm {
+
+
+namespace {
+
+
+const char* kTimerNames[TIMER_COUNT] = {
+	"parse_raw_data",
+	"process_common",
+	"select_cluster",
+	"set_data"
+};
+
+Histogram g_histograms[TIMER_COUNT];
+
+std::atomic<int> g_dump_request(0);
+
+//
+// Reference points for converting ticks to nanoseconds.
+//
+uint64_t g_ref_ticks = instrument_ticks();
+uint64_t g_ref_ns = monotonic_ns();
+
+
+void usr1_handler(int signum)
+{
+	g_dump_request.store(signum);
+}
+
+void dump_at_exit()
+{
+	instrument_dump(stderr);
+}
+
+
+} // namespace
+
+
+// Histogram
+Histogram::Histogram() :
+	count_(0),
+	sum_(0),
+	max_(0)
+{
+	for (int i = 0; i < kBucketCount; ++i)
+		bucket_[i].store(0);
+}
+
+void Histogram::update(const uint64_t val)
+{
+	bucket_[bucket_index(val)].fetch_add(1, std::memory_order_relaxed);
+	count_.fetch_add(1, std::memory_order_relaxed);
+	sum_.fetch_add(val, std::memory_order_relaxed);
+
+	uint64_t max = max_.load(std::memory_order_relaxed);
+	while (val > max && !max_.compare_exchange_weak(max, val,
+	                                         std::memory_order_relaxed))
+		;
+}
+
+uint64_t Histogram::get_count() const
+{
+	return count_.load(std::memory_order_relaxed);
+}
+
+uint64_t Histogram::get_sum() const
+{
+	return sum_.load(std::memory_order_relaxed);
+}
+
+uint64_t Histogram::get_max() const
+{
+	return max_.load(std::memory_order_relaxed);
+}
+
+uint64_t Histogram::percentile(const double p) const
+{
+	const uint64_t count = get_count();
+	if (count == 0)
+		return 0;
+
+	const uint64_t rank = (uint64_t) (p * (count - 1)) + 1;
+	uint64_t seen = 0;
+	for (int i = 0; i < kBucketCount; ++i) {
+		seen += bucket_[i].load(std::memory_order_relaxed);
+		if (seen >= rank)
+			return bucket_value(i);
+	}
+
+	return get_max();
+}
+
+int Histogram::bucket_index(const uint64_t val)
+{
+	if (val < (uint64_t) kSubCount)
+		return (int) val;
+
+	const int msb = 63 - __builtin_clzll(val);
+	const int shift = msb - kSubBits;
+	const int sub = (int) ((val >> shift) & (kSubCount - 1));
+
+	return (shift + 1) * kSubCount + sub;
+}
+
+uint64_t Histogram::bucket_value(const int index)
+{
+	if (index < kSubCount)
+		return index;
+
+	//
+	// Middle of the bucket.
+	//
+	const int shift = index / kSubCount - 1;
+	const uint64_t sub = index % kSubCount;
+	const uint64_t low = (kSubCount + sub) << shift;
+
+	return low + ((1ull << shift) >> 1);
+}
+
+
+uint64_t instrument_ticks()
+{
+#ifdef LM_HAVE_TSC
+	return __rdtsc();
+#else
+	return monotonic_ns();
+#endif
+}
+
+void instrument_record(const TimerId id, const uint64_t ticks)
+{
+	g_histograms[id].update(ticks);
+}
+
+void instrument_install()
+{
+	struct sigaction usr1_action;
+	usr1_action.sa_handler = usr1_handler;
+	sigemptyset(&usr1_action.sa_mask);
+	usr1_action.sa_flags = SA_RESTART;
+	sigaction(SIGUSR1, &usr1_action, nullptr);
+
+	atexit(dump_at_exit);
+}
+
+void instrument_poll()
+{
+	if (g_dump_request.exchange(0, std::memory_order_relaxed) != 0)
+		instrument_dump(stderr);
+}
+
+void instrument_dump(FILE *out)
+{
+	//
+	// TSC frequency is derived from the time elapsed since start-up.
+	//
+	double ns_per_tick = 1.0;
+#ifdef LM_HAVE_TSC
+	const uint64_t ticks = instrument_ticks() - g_ref_ticks;
+	const uint64_t ns = monotonic_ns() - g_ref_ns;
+	if (ticks > 0 && ns > 0)
+		ns_per_tick = (double) ns / ticks;
+#endif
+
+	fprintf(out, "%-20s %10s %10s %10s %10s %10s %10s %10s\n",
+	        "timer [ns]", "count", "mean", "p50", "p90", "p99", "p999",
+	        "max");
+	for (int i = 0; i < TIMER_COUNT; ++i) {
+		const Histogram &h = g_histograms[i];
+		const uint64_t count = h.get_count();
+		const double mean = count ? (double) h.get_sum() / count : 0.0;
+
+		fprintf(out, "%-20s %10llu %10.0f %10.0f %10.0f %10.0f %10.0f %10.0f\n",
+		        kTimerNames[i], (unsigned long long) count,
+		        mean * ns_per_tick,
+		        h.percentile(0.50) * ns_per_tick,
+		        h.percentile(0.90) * ns_per_tick,
+		        h.percentile(0.99) * ns_per_tick,
+		        h.percentile(0.999) * ns_per_tick,
+		        h.get_max() * ns_per_tick);
+	}
+	fflush(out);
+}
+
+
+} // namespace lm
+
+#endif // LM_INSTRUMENT
@@ -0,0 +1,139 @@
+//------------------------------------------------------------------------------
+// The MIT License (MIT)
+//
+// Copyright (c) 2015 Lukáš Mandák <lukas.mandak@yandex.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//
+// instrument.hpp
+//
+// Scoped hot-path timers recording into log-bucketed histograms.
+// Everything here is compiled out unless LM_INSTRUMENT is defined
+// (cmake -DLIBPROCESS_INSTRUMENT=ON).
+//
+//------------------------------------------------------------------------------
+#ifndef _LIBPROCESS_INSTRUMENT_H_
+#define _LIBPROCESS_INSTRUMENT_H_
+
+#include <cstdint>
+#include <cstdio>
+
+#include <atomic>
+
+
+namespace lm {
+
+
+enum TimerId {
+	TIMER_PARSE = 0,
+	TIMER_PROCESS,
+	TIMER_CLUSTER,
+	TIMER_SET_DATA,
+
+	TIMER_COUNT
+};
+
+
+#ifdef LM_INSTRUMENT
+
+//!
+//! HDR style histogram. Values are bucketed by their most significant bit
+//! and the kSubBits bits following it, giving relative error below 12.5%
+//! over the whole 64-bit range. Recording is wait-free.
+//!
+class Histogram
+{
+	static const int kSubBits = 3;
+	static const int kSubCount = 1 << kSubBits;
+	static const int kBucketCount = 64 * kSubCount;
+
+	std::atomic<uint64_t> bucket_[kBucketCount];
+	std::atomic<uint64_t> count_;
+	std::atomic<uint64_t> sum_;
+	std::atomic<uint64_t> max_;
+
+public:
+	Histogram();
+
+	void update(const uint64_t val);
+
+	uint64_t get_count() const;
+	uint64_t get_sum() const;
+	uint64_t get_max() const;
+	uint64_t percentile(const double p) const;
+
+private:
+	static int bucket_index(const uint64_t val);
+	static uint64_t bucket_value(const int index);
+};
+
+
+/** \brief Raw timestamp, TSC where available, nanoseconds otherwise. */
+uint64_t instrument_ticks();
+
+void instrument_record(const TimerId id, const uint64_t ticks);
+
+
+class ScopedTimer
+{
+	const TimerId id_;
+	const uint64_t start_;
+
+public:
+	ScopedTimer(const TimerId id) :
+		id_(id),
+		start_(instrument_ticks())
+	{
+
+	}
+
+	~ScopedTimer()
+	{
+		instrument_record(id_, instrument_ticks() - start_);
+	}
+};
+
+
+/** \brief Installs SIGUSR1 handler and dump at exit. */
+void instrument_install();
+
+/** \brief Dumps histograms if SIGUSR1 was received since last call. */
+void instrument_poll();
+
+void instrument_dump(FILE *out);
+
+
+#define LM_TIMER(id)    lm::ScopedTimer lm_scoped_timer_(id)
+
+#else // LM_INSTRUMENT
+
+inline void instrument_install() {}
+inline void instrument_poll() {}
+inline void instrument_dump(FILE *) {}
+
+#define LM_TIMER(id)    do {} while (0)
+
+#endif // LM_INSTRUMENT
+
+
+} // namespace lm
+
+
+#endif // _LIBPROCESS_INSTRUMENT_H_
@@ -0,0 +1,153 @@
+//------------------------------------------------------------------------------
+// The MIT License (MIT)
+//
+// Copyright (c) 2015 Lukáš Mandák <lukas.mandak@yandex.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//
+// latency.cpp
+//
+//
+//
+//------------------------------------------------------------------------------
+#include "latency.hpp"
+
+#include <cstdint>
+
+#include <algorithm>
+#include <iomanip>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <time.h>
+
+
+namespace lm {
+
+
+uint64_t monotonic_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+uint64_t realtime_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+
+// LatencyWindow
+LatencyWindow::LatencyWindow(const size_t length) :
+	array_(std::max<size_t>(length, 1), 0),
+	index_(0),
+	count_(0)
+{
+
+}
+
+void LatencyWindow::update(const uint64_t val)
+{
+	array_[index_] = val;
+	index_ = (index_ + 1) % array_.size();
+	if (count_ < array_.size())
+		++count_;
+}
+
+uint64_t LatencyWindow::percentile(const double p) const
+{
+	if (count_ == 0)
+		return 0;
+
+	std::vector<uint64_t> tmp(array_.begin(), array_.begin() + count_);
+	size_t k = (size_t) (p * (count_ - 1) + 0.5);
+	if (k >= count_)
+		k = count_ - 1;
+
+	std::nth_element(tmp.begin(), tmp.begin() + k, tmp.end());
+	return tmp[k];
+}
+
+
+// LatencyReport
+LatencyReport::Segment::Segment(const LatencyPoint from, const LatencyPoint to,
+                                const std::string &name, const size_t length) :
+	from(from),
+	to(to),
+	name(name),
+	window(length)
+{
+
+}
+
+LatencyReport::LatencyReport(const size_t length, const double interval) :
+	segments_(),
+	length_(length),
+	interval_ns_((uint64_t) (interval * 1e9)),
+	last_report_(monotonic_ns())
+{
+
+}
+
+void LatencyReport::add_segment(const LatencyPoint from, const LatencyPoint to,
+                                const std::string &name)
+{
+	segments_.push_back(Segment(from, to, name, length_));
+}
+
+void LatencyReport::update(const uint64_t stamp[LP_COUNT])
+{
+	for (auto &s : segments_) {
+		if (stamp[s.from] == 0 || stamp[s.to] < stamp[s.from])
+			continue;
+		s.window.update(stamp[s.to] - stamp[s.from]);
+	}
+}
+
+bool LatencyReport::is_due()
+{
+	const uint64_t now = monotonic_ns();
+	if (now - last_report_ < interval_ns_)
+		return false;
+
+	last_report_ = now;
+	return true;
+}
+
+void LatencyReport::print(std::ostream &os) const
+{
+	os << "Latency [us]       p50      p99     p999    samples\n";
+	for (auto &s : segments_) {
+		os << std::left << std::setw(16) << s.name << std::right
+		   << std::fixed << std::setprecision(1)
+		   << std::setw(9) << s.window.percentile(0.50) / 1e3
+		   << std::setw(9) << s.window.percentile(0.99) / 1e3
+		   << std::setw(9) << s.window.percentile(0.999) / 1e3
+		   << std::setw(11) << s.window.get_count() << '\n';
+	}
+	os.flush();
+}
+
+
+} // namespace lm
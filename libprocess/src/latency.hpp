@@ -0,0 +1,125 @@
+//------------------------------------------------------------------------------
+// The MIT License (MIT)
+//
+// Copyright (c) 2015 Lukáš Mandák <lukas.mandak@yandex.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//
+// latency.hpp
+//
+// End-to-end latency bookkeeping. Every frame carries monotonic timestamps
+// of the pipeline points it went through, reports compute rolling
+// percentiles of the time spent between them.
+//
+//------------------------------------------------------------------------------
+#ifndef _LIBPROCESS_LATENCY_H_
+#define _LIBPROCESS_LATENCY_H_
+
+#include <cstdint>
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+
+namespace lm {
+
+
+//!
+//! Points of the pipeline at which a frame gets timestamped.
+//! Timestamps use CLOCK_MONOTONIC so they are comparable between processes.
+//!
+enum LatencyPoint {
+	LP_LINE = 0,    // serial line complete
+	LP_PARSE,       // parse done
+	LP_SOLVE,       // solve done
+	LP_PUBLISH,     // shm publish
+	LP_READ,        // visualize read
+	LP_PRESENT,     // SDL_RenderPresent returned
+
+	LP_COUNT
+};
+
+
+/** \brief Current CLOCK_MONOTONIC time in nanoseconds. */
+uint64_t monotonic_ns();
+
+/** \brief Current CLOCK_REALTIME time in nanoseconds since epoch. */
+uint64_t realtime_ns();
+
+
+//!
+//! Rolling window of the last `length` samples, at least one.
+//! Updating is O(1), percentiles are computed on demand.
+//!
+class LatencyWindow
+{
+	std::vector<uint64_t> array_;
+	size_t index_;
+	size_t count_;
+
+public:
+	LatencyWindow(const size_t length);
+
+	void update(const uint64_t val);
+	uint64_t percentile(const double p) const;
+
+	inline size_t get_count() const { return count_; }
+};
+
+
+//!
+//! Set of segments between two latency points.
+//! Frames missing either timestamp of a segment are ignored by it.
+//!
+class LatencyReport
+{
+	struct Segment {
+		LatencyPoint from;
+		LatencyPoint to;
+		std::string name;
+		LatencyWindow window;
+
+		Segment(const LatencyPoint from, const LatencyPoint to,
+		        const std::string &name, const size_t length);
+	};
+
+	std::vector<Segment> segments_;
+	const size_t length_;
+	const uint64_t interval_ns_;
+	uint64_t last_report_;
+
+public:
+	LatencyReport(const size_t length, const double interval);
+
+	void add_segment(const LatencyPoint from, const LatencyPoint to,
+	                 const std::string &name);
+
+	void update(const uint64_t stamp[LP_COUNT]);
+
+	bool is_due();
+	void print(std::ostream &os) const;
+};
+
+
+} // namespace lm
+
+
+#endif // _LIBPROCESS_LATENCY_H_
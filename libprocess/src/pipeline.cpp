@@ -0,0 +1,498 @@
+//------------------------------------------------------------------------------
+// The MIT License (MIT)
+//
+// Copyright (c) 2015 Lukáš Mandák <lukas.mandak@yandex.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//
+// pipeline.cpp
+//
+//
+//
+//------------------------------------------------------------------------------
+#include "pipeline.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "geometry.hpp"
+#include "latency.hpp"
+#include "probes.hpp"
+#include "process.hpp"
+#include "shared.hpp"
+
+
+namespace lm {
+
+
+namespace {
+
+
+const char *kFrameStatusNames[FRAME_STATUS_COUNT] = {
+	"ok",
+	"parse error",
+	"saturated",
+	"source absent",
+	"process error",
+	"missing solutions",
+	"triangle failed"
+};
+
+
+} // namespace
+
+
+const char* frame_status_name(const FrameStatus status)
+{
+	if (status < 0 || status >= FRAME_STATUS_COUNT)
+		return "unknown";
+
+	return kFrameStatusNames[status];
+}
+
+
+// PipelineConfig
+PipelineConfig::PipelineConfig() :
+	sensors({
+		Point(-3, 0),
+		Point(3, 0),
+		Point(0, std::sqrt(6 * 6 - 3 * 3))
+	}),
+	poi(0.0, 1.7320508076),         // circumcenter of sensors
+	calibration_loops(25),
+	calibration_speed_initial(0.95),
+	calibration_speed_factor(0.01),
+	detection_treshold(30.0),
+	presence_enter_sigma(6.0),
+	presence_exit_sigma(3.0),
+	presence_floor(3.0),
+	cluster_gate(3.0),
+	magnitude_noise(2.0),
+	reuse_band(0.0),
+	tracker_particles(0),
+	tracker_threads(1),
+	tracker_range(40.0),
+	tracker_motion(1.0),
+	dipole_budget(0.0),
+	dipole_height(2.0),
+	sources_budget(0.0),
+	sources_max(MD_SOURCE_COUNT),
+	refine_speed(0.01),
+	iron_gate(0.2)
+{
+
+}
+
+
+// Pipeline
+Pipeline::Pipeline(const PipelineConfig &config) :
+	config_(config),
+	proc_(),
+	triangle_(config.sensors),
+	presence_(config.detection_treshold, config.presence_enter_sigma,
+	          config.presence_exit_sigma, config.presence_floor),
+	event_(PRESENCE_NONE),
+	tracker_((config.tracker_particles > 0)
+	         ? new ParticleTracker(config.tracker_particles,
+	                               config.tracker_threads)
+	         : nullptr),
+	dipole_(config.dipole_height),
+	sources_((config.sources_budget > 0.0)
+	         ? new SourceTracker(config.sources_max, config.dipole_height,
+	                             config.tracker_range, config.cluster_gate,
+	                             config.presence_enter_sigma
+	                             * config.magnitude_noise,
+	                             config.presence_exit_sigma
+	                             * config.magnitude_noise)
+	         : nullptr),
+	last_(),
+	last_magnitudes_(),
+	last_saturated_(0),
+	calibration_cnt_(0),
+	speed_(config.calibration_speed_initial),
+	iron_(nullptr),
+	iron_generation_(0)
+{
+
+}
+
+int Pipeline::initialize()
+{
+	calibration_cnt_ = 0;
+	speed_ = config_.calibration_speed_initial;
+	presence_.initialize(config_.sensors.size());
+	event_ = PRESENCE_NONE;
+	last_magnitudes_.clear();
+
+	if (tracker_ != nullptr &&
+	    tracker_->initialize(config_.sensors, config_.poi,
+	                         config_.tracker_range, config_.tracker_motion,
+	                         config_.magnitude_noise,
+	                         config_.cluster_gate) != 0)
+		return -1;
+
+	if (config_.dipole_budget > 0.0 &&
+	    dipole_.initialize(config_.sensors) != 0)
+		return -1;
+
+	if (sources_ != nullptr && sources_->initialize(config_.sensors) != 0)
+		return -1;
+
+	return proc_.initialize(config_.sensors);
+}
+
+int Pipeline::calibrate(const std::vector<double> &field,
+                        const uint32_t saturated)
+{
+	if (saturated != 0)
+		return -1;
+
+	if (proc_.calibrate(field, speed_) != 0)
+		return -1;
+
+	speed_ -= config_.calibration_speed_factor;
+	++calibration_cnt_;
+	return 0;
+}
+
+int Pipeline::warm_start(const std::vector<double> &environment)
+{
+	if (proc_.set_environment(environment) != 0)
+		return -1;
+
+	calibration_cnt_ = config_.calibration_loops;
+	return 0;
+}
+
+int Pipeline::attach_iron(IronCalibrator *iron)
+{
+	if (iron != nullptr && config_.sensors.size() > MD_SENSOR_COUNT) {
+		iron_ = nullptr;
+		return -1;
+	}
+
+	iron_ = iron;
+	iron_generation_ = 0;
+	return 0;
+}
+
+int Pipeline::set_iron(const IronCorrection iron[MD_SENSOR_COUNT])
+{
+	for (size_t i = 0; i < proc_.get_sensor_cnt() && i < MD_SENSOR_COUNT; ++i)
+		if (proc_.set_correction(i, iron[i].matrix) != 0)
+			return -1;
+
+	return 0;
+}
+
+bool Pipeline::is_reusable(const std::vector<double> &magnitudes,
+                           const uint32_t saturated) const
+{
+	if (config_.reuse_band <= 0.0 || saturated != last_saturated_ ||
+	    magnitudes.size() != last_magnitudes_.size())
+		return false;
+
+	for (size_t i = 0; i < magnitudes.size(); ++i)
+		if (std::abs(magnitudes[i] - last_magnitudes_[i])
+		    > config_.reuse_band)
+			return false;
+
+	return true;
+}
+
+void Pipeline::reuse(const uint64_t sequence, MagnetoData *data) const
+{
+	//
+	// Latency stamps belong to the current frame.
+	//
+	uint64_t stamp[LP_COUNT];
+	std::copy(data->stamp, data->stamp + LP_COUNT, stamp);
+
+	*data = last_;
+	std::copy(stamp, stamp + LP_COUNT, data->stamp);
+	data->set_sequence(sequence);
+	data->set_reused();
+	data->set_stamp(LP_SOLVE);
+}
+
+bool Pipeline::is_iron_sample(const std::vector<double> &field) const
+{
+	//
+	// Magnitudes do not change when the device is rotated,
+	// unlike field vectors compared by is_source_present().
+	//
+	const std::vector<double> env = proc_.get_environment();
+	for (size_t i = 0; i + 2 < env.size(); i += 3) {
+		const double m = std::sqrt(field[i] * field[i]
+		                           + field[i + 1] * field[i + 1]
+		                           + field[i + 2] * field[i + 2]);
+		const double e = std::sqrt(env[i] * env[i]
+		                           + env[i + 1] * env[i + 1]
+		                           + env[i + 2] * env[i + 2]);
+		if (e <= 0.0 || std::abs(m - e) > config_.iron_gate * e)
+			return false;
+	}
+
+	return true;
+}
+
+void Pipeline::update_iron(const std::vector<double> &field)
+{
+	if (iron_->get_generation() != iron_generation_) {
+		IronCorrection iron[MD_SENSOR_COUNT];
+		iron_generation_ = iron_->get(iron);
+		set_iron(iron);
+	}
+
+	if (is_iron_sample(field))
+		iron_->push(field);
+}
+
+int Pipeline::calibrate(const std::string &raw_data)
+{
+	std::vector<double> field;
+	uint32_t saturated;
+	if (parse(raw_data, &field, &saturated) != FRAME_OK)
+		return -1;
+
+	return calibrate(field, saturated);
+}
+
+FrameStatus Pipeline::parse(const std::string &raw_data,
+                            std::vector<double> *field, uint32_t *saturated)
+{
+	if (parse_raw_field(raw_data, proc_.get_sensor_cnt(), field,
+	                    saturated) < 0)
+		return FRAME_PARSE_ERROR;
+
+	return FRAME_OK;
+}
+
+FrameStatus Pipeline::solve(const std::vector<double> &field,
+                            const uint64_t sequence, MagnetoData *data,
+                            const uint32_t saturated)
+{
+	proc_.clear();
+	event_ = PRESENCE_NONE;
+
+	if (iron_ != nullptr)
+		update_iron(field);
+
+	//
+	// Decide whether a magnet is present or not.
+	//
+	std::vector<double> magnitudes(proc_.get_sensor_cnt());
+	for (size_t i = 0; i < magnitudes.size(); ++i)
+		magnitudes[i] = proc_.source_magnitude(field, i);
+	event_ = presence_.update(magnitudes);
+	const bool present = presence_.is_present();
+	if (event_ == PRESENCE_ENTER) {
+		if (tracker_ != nullptr)
+			tracker_->reset();
+		dipole_.reset();
+	}
+	LM_PROBE(source, sequence, present,
+	         LM_PROBE_FIXED(magnitudes[0]), LM_PROBE_FIXED(magnitudes[1]),
+	         LM_PROBE_FIXED(magnitudes[2]));
+
+	//
+	// Dipole fits take source field vectors. Several sources are
+	// tracked regardless of presence, which expects a single one.
+	//
+	std::vector<double> source;
+	if (config_.dipole_budget > 0.0 || sources_ != nullptr) {
+		source.resize(3 * proc_.get_sensor_cnt());
+		for (size_t i = 0; i < proc_.get_sensor_cnt(); ++i)
+			proc_.source_field(field, i, &source[3 * i]);
+	}
+	if (sources_ != nullptr) {
+		sources_->update(source, saturated, sequence, monotonic_ns()
+		                 + (uint64_t) (1000.0 * config_.sources_budget));
+	}
+
+	if (!present) {
+		last_magnitudes_.clear();
+
+		//
+		// Weak source between the tresholds must not leak into
+		// environment, it would mask the source when it comes back.
+		//
+		if (config_.refine_speed > 0.0 && presence_.is_quiet())
+			proc_.calibrate(field, config_.refine_speed);
+		return FRAME_SOURCE_ABSENT;
+	}
+
+	//
+	// Magnitudes within noise of the last solved frame would give
+	// the same result, publish it again instead of solving.
+	//
+	if (is_reusable(magnitudes, saturated)) {
+		reuse(sequence, data);
+		return FRAME_OK;
+	}
+
+	//
+	// Create possible solutions for current input data.
+	//
+	if (proc_.process(field) != 0)
+		return FRAME_PROCESS_ERROR;
+
+	//
+	// Tracker follows the source on every solved frame. It stands in
+	// when circles alone give no fix, and when the picked cluster is
+	// away from the track, which is mirrored or otherwise ambiguous set
+	// of intersections.
+	//
+	Point track;
+	double track_spread = 0.0;
+	const bool tracked = tracker_ != nullptr &&
+	        tracker_->update(magnitudes, saturated, &track,
+	                         &track_spread) == 0;
+
+	Point result;
+	double spread = 0.0;
+	FrameStatus status = FRAME_OK;
+	if (saturated != 0) {
+		//
+		// Source is close to saturated sensors, circles of the others
+		// give degraded fix. Less than two of them leave nothing to
+		// solve.
+		//
+		if (proc_.degraded_fix(saturated, &triangle_,
+		                       config_.cluster_gate, &result,
+		                       &spread) != 0)
+			status = FRAME_SATURATED;
+	} else {
+		//
+		// Pick the tightest cluster of intersections outside of sensor
+		// triangle, any two consistent circle pairs are enough.
+		//
+		LM_PROBE(solutions, sequence, proc_.get_points().size());
+		switch (proc_.select_cluster(&triangle_, config_.cluster_gate,
+		                             &result, &spread)) {
+		case 0:
+			break;
+		case 1:
+			status = FRAME_TRIANGLE_FAILED;
+			break;
+		default:
+			status = FRAME_MISSING_SOLUTIONS;
+			break;
+		}
+	}
+	const bool use_track = tracked && (status != FRAME_OK ||
+	        dist(result, track) > config_.cluster_gate);
+	if (use_track) {
+		result = track;
+		spread = track_spread;
+	} else if (status != FRAME_OK) {
+		return status;
+	}
+
+	//
+	// Planar result ignores height of the source. Dipole fit replaces
+	// it when it converges in time, it starts from the last fit or from
+	// the planar result when source has just entered.
+	//
+	DipoleFit fit;
+	bool located = false;
+	if (config_.dipole_budget > 0.0) {
+		const uint64_t deadline = monotonic_ns()
+		        + (uint64_t) (1000.0 * config_.dipole_budget);
+		located = dipole_.solve(source, saturated, result, deadline,
+		                        &fit) == 0;
+		if (located)
+			result = Point(fit.position[0], fit.position[1]);
+	}
+	data->set_solutions(proc_.get_points());
+	data->set_stamp(LP_SOLVE);
+
+	//
+	// Quality of the fix, consumers weight or gate results by it.
+	// Degraded fix from two sensors lies anywhere along one circle, so
+	// it has no conditioning. Saturated magnitudes are only bounds,
+	// covariance of degraded fix is left out.
+	//
+	const std::vector<double> input = proc_.get_input();
+	double margin = -1.0;
+	for (size_t i = 0; i < input.size(); ++i) {
+		if ((saturated & (1u << i)) != 0)
+			continue;
+		const double m = input[i] / presence_.get_treshold(i, false);
+		margin = (margin < 0.0) ? m : std::min(margin, m);
+	}
+	double cov[3] = { 0.0, 0.0, 0.0 };
+	if (saturated != 0 ||
+	    proc_.covariance(result, config_.magnitude_noise, cov) != 0)
+		cov[0] = cov[1] = cov[2] = 0.0;
+	data->set_quality(spread, proc_.conditioning(result),
+	                  std::max(margin, 0.0), cov);
+
+	data->set_sensors(config_.sensors);
+	data->set_magnitudes(input);
+	data->set_source_present(true);
+	data->set_saturated(saturated);
+	data->set_tracked(use_track);
+	data->set_circles(proc_.get_circles());
+	data->set_poi(config_.poi);
+	data->set_result(result);
+	if (located)
+		data->set_dipole(fit.position[2], fit.moment);
+	data->set_sequence(sequence);
+	data->set_valid();
+
+	if (config_.reuse_band > 0.0) {
+		last_ = *data;
+		last_magnitudes_ = magnitudes;
+		last_saturated_ = saturated;
+	}
+
+	return FRAME_OK;
+}
+
+SourceList Pipeline::get_sources() const
+{
+	return (sources_ != nullptr) ? sources_->get_list() : SourceList();
+}
+
+FrameStatus Pipeline::process(const std::string &raw_data,
+                              const uint64_t sequence, MagnetoData *data)
+{
+	std::vector<double> field;
+	uint32_t saturated;
+
+	event_ = PRESENCE_NONE;
+	const FrameStatus status = parse(raw_data, &field, &saturated);
+	LM_PROBE(parse_result, sequence, (status != FRAME_OK) ? -1 :
+	         (saturated != 0) ? 1 : 0);
+	if (status != FRAME_OK)
+		return status;
+	data->set_stamp(LP_PARSE);
+
+	return solve(field, sequence, data, saturated);
+}
+
+
+} // namespace lm
@@ -0,0 +1,254 @@
+//------------------------------------------------------------------------------
+// The MIT License (MIT)
+//
+// Copyright (c) 2015 Lukáš Mandák <lukas.mandak@yandex.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//
+// pipeline.hpp
+//
+// Processing of one frame from serial line to result, shared by process and
+// offline tools. Frames failing some stage are reported by FrameStatus.
+//
+//------------------------------------------------------------------------------
+#ifndef _LIBPROCESS_PIPELINE_H_
+#define _LIBPROCESS_PIPELINE_H_
+
+#include <cstdint>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "dipole.hpp"
+#include "ellipsoid.hpp"
+#include "geometry.hpp"
+#include "presence.hpp"
+#include "process.hpp"
+#include "shared.hpp"
+#include "sources.hpp"
+#include "tracker.hpp"
+
+
+namespace lm {
+
+
+enum FrameStatus {
+	FRAME_OK = 0,
+	FRAME_PARSE_ERROR,
+	FRAME_SATURATED,
+	FRAME_SOURCE_ABSENT,
+	FRAME_PROCESS_ERROR,
+	FRAME_MISSING_SOLUTIONS,
+	FRAME_TRIANGLE_FAILED,
+
+	FRAME_STATUS_COUNT
+};
+
+const char* frame_status_name(const FrameStatus status);
+
+
+//!
+//! Sensor layout and tuning constants. Defaults describe the real device.
+//!
+struct PipelineConfig
+{
+	PointVector sensors;            // [cm]
+	Point poi;                      // results are reported relative to it
+
+	int calibration_loops;
+	double calibration_speed_initial;
+	double calibration_speed_factor;
+
+	//!
+	//! Norm of difference between measured field and enviroment vector
+	//! of all sensors must reach this value to detect a source, until
+	//! noise of the sensors is known.
+	//!
+	double detection_treshold;
+
+	//!
+	//! Source enters when all sensors are presence_enter_sigma standard
+	//! deviations above their noise and leaves when any of them falls
+	//! below presence_exit_sigma, see PresenceDetector. Tresholds never
+	//! go below presence_floor.
+	//!
+	double presence_enter_sigma;
+	double presence_exit_sigma;
+	double presence_floor;
+
+	//!
+	//! Intersections farther than this from the median of their cluster
+	//! are left out of it. [cm]
+	//!
+	double cluster_gate;
+
+	//!
+	//! Standard deviation of source magnitudes, covariance published
+	//! with every result is derived from it.
+	//!
+	double magnitude_noise;
+
+	//!
+	//! Frames whose source magnitudes all differ from the last solved
+	//! frame by less than this reuse its result instead of solving again.
+	//! Zero disables reuse.
+	//!
+	double reuse_band;
+
+	//!
+	//! Particles of tracker standing in for frames whose circles give
+	//! no fix, zero disables it. They start within tracker_range of poi
+	//! and move by tracker_motion per frame. [cm]
+	//!
+	size_t tracker_particles;
+	unsigned tracker_threads;
+	double tracker_range;
+	double tracker_motion;
+
+	//!
+	//! Time for 3D dipole fit of every solved frame [us], zero disables
+	//! it. Fit of a source that has just entered starts dipole_height
+	//! above the planar result. [cm]
+	//!
+	double dipole_budget;
+	double dipole_height;
+
+	//!
+	//! Time for tracking of up to sources_max magnets at once [us], zero
+	//! disables it. Sources are tracked on every frame, whether result
+	//! is solved or not. New ones start dipole_height above the sensors,
+	//! are born when field left unexplained is presence_enter_sigma
+	//! magnitude noises strong and fit within tracker_range. Fits follow
+	//! their tracks within cluster_gate, see SourceTracker.
+	//!
+	double sources_budget;
+	size_t sources_max;
+
+	//!
+	//! Calibration speed used to follow slow changes of environment
+	//! on frames without source. Zero disables refinement.
+	//!
+	double refine_speed;
+
+	//!
+	//! Frames whose field magnitudes are all within this fraction of
+	//! environment magnitudes are free of source and feed iron calibration.
+	//!
+	double iron_gate;
+
+	PipelineConfig();
+};
+
+
+class Pipeline
+{
+	PipelineConfig config_;
+	FilteredProcess proc_;
+	Triangle triangle_;
+	PresenceDetector presence_;
+	PresenceEvent event_;
+	std::unique_ptr<ParticleTracker> tracker_;
+	DipoleSolver dipole_;
+	std::unique_ptr<SourceTracker> sources_;
+
+	MagnetoData last_;              // last solved frame, see reuse_band
+	std::vector<double> last_magnitudes_;
+	uint32_t last_saturated_;
+
+	int calibration_cnt_;
+	double speed_;
+
+	IronCalibrator *iron_;
+	uint64_t iron_generation_;
+
+public:
+	Pipeline(const PipelineConfig &config = PipelineConfig());
+
+	int initialize();
+
+	//!
+	//! One calibration step, call until is_calibrated().
+	//! Frames with saturated sensors are refused.
+	//!
+	int calibrate(const std::vector<double> &field,
+	              const uint32_t saturated = 0);
+	int calibrate(const std::string &raw_data);
+
+	inline bool is_calibrated() const
+	{
+		return calibration_cnt_ >= config_.calibration_loops;
+	}
+
+	/** \brief Skips calibration, starts from known environment. */
+	int warm_start(const std::vector<double> &environment);
+
+	//!
+	//! Feeds source free frames to calibrator and applies its corrections
+	//! whenever they change. Calibrator is not owned, nullptr detaches it.
+	//! Returns -1 when there are more sensors than MD_SENSOR_COUNT
+	//! corrections, calibrator stays detached then.
+	//!
+	int attach_iron(IronCalibrator *iron);
+	int set_iron(const IronCorrection iron[MD_SENSOR_COUNT]);
+
+	/** \brief Parses serial line into field vectors, see axes_to_field(). */
+	FrameStatus parse(const std::string &raw_data,
+	                  std::vector<double> *field, uint32_t *saturated);
+
+	//!
+	//! Solves frame, fills data and stamps LP_SOLVE when solved.
+	//! With one sensor saturated the result is degraded fix flagged
+	//! in data, FRAME_SATURATED is returned when there is none.
+	//!
+	FrameStatus solve(const std::vector<double> &field,
+	                  const uint64_t sequence, MagnetoData *data,
+	                  const uint32_t saturated = 0);
+
+	/** \brief Parse and solve, stamps LP_PARSE in between. */
+	FrameStatus process(const std::string &raw_data, const uint64_t sequence,
+	                    MagnetoData *data);
+
+	/** \brief Presence transition of the last frame. */
+	inline PresenceEvent get_event() const { return event_; }
+	inline bool is_source_present() const { return presence_.is_present(); }
+
+	/** \brief Sources of the last frame, empty unless tracked. */
+	SourceList get_sources() const;
+
+	inline const PipelineConfig& get_config() const { return config_; }
+	inline std::vector<double> get_environment() const
+	{
+		return proc_.get_environment();
+	}
+
+private:
+	bool is_reusable(const std::vector<double> &magnitudes,
+	                 const uint32_t saturated) const;
+	void reuse(const uint64_t sequence, MagnetoData *data) const;
+	bool is_iron_sample(const std::vector<double> &field) const;
+	void update_iron(const std::vector<double> &field);
+};
+
+
+} // namespace lm
+
+
+#endif // _LIBPROCESS_PIPELINE_H_
@@ -0,0 +1,152 @@
+//------------------------------------------------------------------------------
+// The MIT License (MIT)
+//
+// Copyright (c) 2015 Lukáš Mandák <lukas.mandak@yandex.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//
+// presence.cpp
+//
+//
+//
+//------------------------------------------------------------------------------
+#include "presence.hpp"
+
+#include <cmath>
+#include <cstdint>
+
+#include <algorithm>
+#include <vector>
+
+
+namespace lm {
+
+
+PresenceDetector::PresenceDetector(const double treshold,
+                                   const double enter_sigma,
+                                   const double exit_sigma,
+                                   const double floor,
+                                   const uint64_t min_samples,
+                                   const uint64_t window) :
+	noise_(),
+	present_(false),
+	quiet_(false),
+	treshold_(treshold),
+	enter_sigma_(enter_sigma),
+	exit_sigma_(exit_sigma),
+	floor_(floor),
+	min_samples_(std::max<uint64_t>(min_samples, 2)),
+	window_(std::max<uint64_t>(window, 2))
+{
+
+}
+
+void PresenceDetector::initialize(const size_t sensor_cnt)
+{
+	noise_.assign(sensor_cnt, Noise{ 0, 0.0, 0.0 });
+	present_ = false;
+	quiet_ = false;
+}
+
+PresenceEvent PresenceDetector::update(const std::vector<double> &magnitudes)
+{
+	const size_t cnt = std::min(magnitudes.size(), noise_.size());
+
+	quiet_ = false;
+	if (!present_) {
+		bool enter = cnt > 0;
+		for (size_t i = 0; i < cnt; ++i)
+			if (magnitudes[i] < get_treshold(i, true))
+				enter = false;
+
+		if (enter) {
+			present_ = true;
+			return PRESENCE_ENTER;
+		}
+
+		quiet_ = add_noise(magnitudes);
+		return PRESENCE_NONE;
+	}
+
+	for (size_t i = 0; i < cnt; ++i) {
+		if (magnitudes[i] < get_treshold(i, false)) {
+			present_ = false;
+			return PRESENCE_EXIT;
+		}
+	}
+
+	return PRESENCE_NONE;
+}
+
+double PresenceDetector::get_treshold(const size_t sensor,
+                                      const bool enter) const
+{
+	const Noise &n = noise_[sensor];
+	if (n.count < min_samples_)
+		return treshold_;
+
+	const double sigma = enter ? enter_sigma_ : exit_sigma_;
+	return std::max(floor_, n.mean + sigma * get_deviation(sensor));
+}
+
+double PresenceDetector::get_mean(const size_t sensor) const
+{
+	return noise_[sensor].mean;
+}
+
+double PresenceDetector::get_deviation(const size_t sensor) const
+{
+	const Noise &n = noise_[sensor];
+	return (n.count > 1) ? std::sqrt(n.m2 / (n.count - 1)) : 0.0;
+}
+
+bool PresenceDetector::add_noise(const std::vector<double> &magnitudes)
+{
+	//
+	// Only frames below every exit treshold are noise, the tail of
+	// a leaving source is not.
+	//
+	const size_t cnt = std::min(magnitudes.size(), noise_.size());
+	for (size_t i = 0; i < cnt; ++i)
+		if (magnitudes[i] >= get_treshold(i, false))
+			return false;
+
+	for (size_t i = 0; i < cnt; ++i) {
+		Noise &n = noise_[i];
+
+		//
+		// Capped count turns the mean into exponential average,
+		// m2 is scaled down to keep the variance unbiased.
+		//
+		if (n.count >= window_)
+			n.m2 *= (double) (window_ - 1) / window_;
+		else
+			++n.count;
+
+		const double delta = magnitudes[i] - n.mean;
+		n.mean += delta / n.count;
+		n.m2 += delta * (magnitudes[i] - n.mean);
+	}
+
+	return true;
+}
+
+
+} // namespace lm
@@ -0,0 +1,112 @@
+//------------------------------------------------------------------------------
+// The MIT License (MIT)
+//
+// Copyright (c) 2015 Lukáš Mandák <lukas.mandak@yandex.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//
+// presence.hpp
+//
+// Source presence detection with hysteresis. Source magnitudes of frames
+// without source are noise of the sensors, their running mean and variance
+// (Welford) give per sensor tresholds in standard deviations. Source enters
+// when every sensor exceeds its enter treshold and leaves when any sensor
+// falls below its lower exit treshold, so magnitudes near a single treshold
+// do not flap.
+//
+//------------------------------------------------------------------------------
+#ifndef _LIBPROCESS_PRESENCE_H_
+#define _LIBPROCESS_PRESENCE_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include <vector>
+
+
+namespace lm {
+
+
+enum PresenceEvent {
+	PRESENCE_NONE = 0,
+	PRESENCE_ENTER,
+	PRESENCE_EXIT
+};
+
+
+//!
+//! Until min_samples frames without source were seen by a sensor, fixed
+//! treshold is used for both transitions. Statistics follow slow changes,
+//! the count is capped at window so older frames are forgotten.
+//!
+class PresenceDetector
+{
+	struct Noise {
+		uint64_t count;
+		double mean;
+		double m2;
+	};
+
+	std::vector<Noise> noise_;
+	bool present_;
+	bool quiet_;
+
+	double treshold_;
+	double enter_sigma_;
+	double exit_sigma_;
+	double floor_;
+	uint64_t min_samples_;
+	uint64_t window_;
+
+public:
+	PresenceDetector(const double treshold = 30.0,
+	                 const double enter_sigma = 6.0,
+	                 const double exit_sigma = 3.0,
+	                 const double floor = 3.0,
+	                 const uint64_t min_samples = 100,
+	                 const uint64_t window = 10000);
+
+	void initialize(const size_t sensor_cnt);
+
+	//!
+	//! Advances state machine by source magnitudes of one frame, which
+	//! also update noise statistics while the source is absent.
+	//!
+	PresenceEvent update(const std::vector<double> &magnitudes);
+
+	inline bool is_present() const { return present_; }
+
+	/** \brief Last frame was below every exit treshold, i.e. noise. */
+	inline bool is_quiet() const { return quiet_; }
+
+	/** \brief Current treshold of sensor, never below floor. */
+	double get_treshold(const size_t sensor, const bool enter) const;
+	double get_mean(const size_t sensor) const;
+	double get_deviation(const size_t sensor) const;
+
+private:
+	bool add_noise(const std::vector<double> &magnitudes);
+};
+
+
+} // namespace lm
+
+
+#endif // _LIBPROCESS_PRESENCE_H_
@@ -0,0 +1,68 @@
+//------------------------------------------------------------------------------
+// The MIT License (MIT)
+//
+// Copyright (c) 2015 Lukáš Mandák <lukas.mandak@yandex.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//
+// probes.hpp
+//
+// USDT static tracepoints of provider 'magneto'. A probe is a single nop
+// until a tracer attaches, e.g.
+//
+//   bpftrace -e 'usdt:./process:magneto:published { printf("%d %d %d\n",
+//                arg0, arg1, arg2); }'
+//
+// Arguments are integers. Floating point values are passed as fixed point
+// multiplied by LM_PROBE_SCALE. Without <sys/sdt.h> probes compile out.
+//
+// Probe                 Arguments
+// frame_received        loop, line length
+// parse_result          loop, status (0 ok, 1 saturated, -1 error)
+// source                loop, present, magnitude[0..2]
+// solutions             loop, count
+// published             loop, result x, result y
+// shm_read              sequence, result x, result y, publish->read [ns]
+//
+//------------------------------------------------------------------------------
+#ifndef _LIBPROCESS_PROBES_H_
+#define _LIBPROCESS_PROBES_H_
+
+#include <cstdint>
+
+
+#define LM_PROBE_SCALE          (1000.0)
+#define LM_PROBE_FIXED(val)     ((int64_t) ((val) * LM_PROBE_SCALE))
+
+
+#ifdef LM_HAVE_SDT
+
+#include <sys/sdt.h>
+
+#define LM_PROBE(name, ...)     STAP_PROBEV(magneto, name, __VA_ARGS__)
+
+#else // LM_HAVE_SDT
+
+#define LM_PROBE(name, ...)     ((void) 0)
+
+#endif // LM_HAVE_SDT
+
+
+#endif // _LIBPROCESS_PROBES_H_
@@ -32,21 +32,60 @@
 #include <cmath>
 #include <cstdio>
 
+#include <algorithm>
 #include <string>
 #include <stdexcept>
 #include <vector>
 
 #include "geometry.hpp"
+#include "instrument.hpp"
+#include "trace.hpp"
 
 
 namespace lm {
 
 
+namespace {
+
+
+//!
+//! Circles published for display are at most this large,
+//! lines and larger circles are approximated by one of this radius.
+//! [cm]
+//!
+const double kMaxCircleRadius = 1000.0;
+
+//!
+//! Intersections farther than this from the origin are dropped,
+//! e.g. the second intersection of a line with a nearly straight circle.
+//! [cm]
+//!
+const double kMaxPointDistance = 1e4;
+
+//!
+//! Weiszfeld iterations of geometric median, tolerance in [cm].
+//!
+const int kMedianIterations = 50;
+const double kMedianTolerance = 1e-4;
+
+
+double dist2(const Point &a, const Point &b)
+{
+	return (a.x - b.x) * (a.x - b.x) + (a.y - b.y) * (a.y - b.y);
+}
+
+
+} // namespace
+
+
 Process::Process() :
 	initialized_(false),
 	sensors_(),
+	loci_(),
 	circles_(),
 	points_(),
+	point_pairs_(),
+	cluster_(),
 	input_()
 {
 
@@ -97,8 +136,14 @@ int Process::process(const std::vector<double> &data)
 
 int Process::process_common()
 {
+	LM_TIMER(TIMER_PROCESS);
+	LM_TRACE("process_common");
+
+	loci_.clear();
 	circles_.clear();
 	points_.clear();
+	point_pairs_.clear();
+	cluster_.clear();
 
 	make_circles();
 	make_points();
@@ -106,70 +151,281 @@ int Process::process_common()
 	return 0;
 }
 
-Point Process::average_points() const
+int Process::select_cluster(const Triangle *triangle, const double gate,
+                            Point *result, double *spread)
+{
+	LM_TIMER(TIMER_CLUSTER);
+	LM_TRACE("select_cluster");
+
+	bool found = false;
+	bool best_inside = true;
+	double best_spread = 0.0;
+	Point best_center;
+
+	cluster_.clear();
+
+	for (size_t s = 0; s < points_.size(); ++s) {
+		//
+		// Nearest point of every other pair joins the seed.
+		//
+		PointVector members = { points_[s] };
+		for (size_t k = 0; k < points_.size(); ) {
+			const size_t pair = point_pairs_[k];
+			size_t nearest = k;
+			for (; k < points_.size() && point_pairs_[k] == pair; ++k)
+				if (dist(points_[k], points_[s])
+				    < dist(points_[nearest], points_[s]))
+					nearest = k;
+
+			if (pair != point_pairs_[s] &&
+			    dist(points_[nearest], points_[s]) <= 2.0 * gate)
+				members.push_back(points_[nearest]);
+		}
+
+		Point center = geometric_median(members, kMedianIterations,
+		                                kMedianTolerance);
+		PointVector kept;
+		for (auto &p : members)
+			if (dist(p, center) <= gate)
+				kept.push_back(p);
+		if (kept.size() < 2)
+			continue;
+		if (kept.size() != members.size())
+			center = geometric_median(kept, kMedianIterations,
+			                          kMedianTolerance);
+
+		double sum = 0.0;
+		for (auto &p : kept)
+			sum += dist2(p, center);
+		const double rms = std::sqrt(sum / kept.size());
+		const bool inside = triangle != nullptr &&
+		                    triangle->is_inside(center);
+
+		bool better = !found;
+		if (found && inside != best_inside)
+			better = !inside;
+		else if (found && kept.size() != cluster_.size())
+			better = kept.size() > cluster_.size();
+		else if (found)
+			better = rms < best_spread;
+
+		if (better) {
+			found = true;
+			best_inside = inside;
+			best_spread = rms;
+			best_center = center;
+			cluster_ = kept;
+		}
+	}
+
+	if (!found) {
+		cluster_.clear();
+		return -1;
+	}
+
+	*result = best_center;
+	*spread = best_spread;
+	return best_inside ? 1 : 0;
+}
+
+double Process::conditioning(const Point &x) const
+{
+	//
+	// Eigenvalues of sum of n * n^T over unit normals n are squares of
+	// singular values.
+	//
+	double sxx = 0.0, sxy = 0.0, syy = 0.0;
+	for (auto &l : loci_) {
+		const Point n = l.normal(x);
+		const double len2 = n.x * n.x + n.y * n.y;
+		if (len2 == 0.0)
+			continue;
+		sxx += n.x * n.x / len2;
+		sxy += n.x * n.y / len2;
+		syy += n.y * n.y / len2;
+	}
+
+	const double mean = 0.5 * (sxx + syy);
+	const double diff = std::sqrt(0.25 * (sxx - syy) * (sxx - syy)
+	                              + sxy * sxy);
+	if (mean + diff <= 0.0)
+		return 0.0;
+
+	return std::sqrt(std::max(mean - diff, 0.0) / (mean + diff));
+}
+
+int Process::covariance(const Point &x, const double noise,
+                        double cov[3]) const
+{
+	//
+	// ln B_i = ln m - 3 ln r_i, noise of ln B_i is noise / B_i.
+	// Unknowns are x, y and ln m, information matrix is J^T W J.
+	//
+	double a[3][3] = { { 0.0 } };
+	for (size_t i = 0; i < sensors_.size() && i < input_.size(); ++i) {
+		const Point d = x - sensors_[i];
+		const double r2 = d.x * d.x + d.y * d.y;
+		if (r2 <= 0.0 || input_[i] <= 0.0)
+			return -1;
+
+		const double j[3] = { -3.0 * d.x / r2, -3.0 * d.y / r2, 1.0 };
+		const double w = (input_[i] * input_[i]) / (noise * noise);
+		for (int r = 0; r < 3; ++r)
+			for (int c = 0; c < 3; ++c)
+				a[r][c] += w * j[r] * j[c];
+	}
+
+	const double c00 = a[1][1] * a[2][2] - a[1][2] * a[2][1];
+	const double c01 = a[1][2] * a[2][0] - a[1][0] * a[2][2];
+	const double c02 = a[1][0] * a[2][1] - a[1][1] * a[2][0];
+	const double det = a[0][0] * c00 + a[0][1] * c01 + a[0][2] * c02;
+	if (!std::isfinite(det) || std::abs(det) < 1e-12)
+		return -1;
+
+	cov[0] = c00 / det;
+	cov[1] = (a[0][2] * a[2][1] - a[0][1] * a[2][2]) / det;
+	cov[2] = (a[0][0] * a[2][2] - a[0][2] * a[2][0]) / det;
+	return 0;
+}
+
+int Process::degraded_fix(const uint32_t saturated, const Triangle *triangle,
+                          const double gate, Point *result, double *spread)
 {
-	if (points_.size() == 0)
-		return Point(0.0, 0.0);
+	LM_TRACE("degraded_fix");
+
+	if (input_.size() != sensors_.size())
+		return -1;
+
+	size_t lost = sensors_.size();
+	std::vector<size_t> kept;
+	for (size_t s = 0; s < sensors_.size(); ++s) {
+		if ((saturated & (1u << s)) == 0)
+			kept.push_back(s);
+		else if (lost == sensors_.size())
+			lost = s;
+	}
+	if (lost == sensors_.size())
+		return -1;
+
+	//
+	// Circles of saturated sensors come from clipped magnitudes.
+	//
+	loci_.clear();
+	circles_.clear();
+	points_.clear();
+	point_pairs_.clear();
+	cluster_.clear();
+	make_circles(saturated);
+	if (kept.size() < 2)
+		return -1;
 
-	Point avg = points_[0];
-	for (auto it = points_.begin() + 1; it != points_.end(); ++it)
-		avg = avg.midpoint(*it);
+	if (kept.size() > 2) {
+		make_points();
+		return select_cluster(triangle, gate, result, spread);
+	}
 
-	return avg;
+	if (input_[lost] <= 0.0)
+		return -1;
+
+	const size_t i = kept[0];
+	const GeneralizedCircle &locus = loci_.front();
+
+	//
+	// Field predicted at saturated sensor k from sensor i must reach what
+	// it read, B_i * (r_i / r_k)^3 >= B_k. Point of the circle nearest
+	// to k is the deepest inside this bound.
+	//
+	const Point &k = sensors_[lost];
+	const double bound = std::cbrt(input_[i] / input_[lost]);
+
+	Point x;
+	if (locus.nearest(k, &x) != 0 ||
+	    dist(x, k) > bound * dist(x, sensors_[i]))
+		return -1;
+
+	//
+	// Source mostly saturates the sensor just past the bound, so ends of
+	// the arc inside it are better guess than its middle.
+	//
+	const GeneralizedCircle edge = GeneralizedCircle::apollonius(k,
+	        sensors_[i], bound);
+	double best = -1.0;
+	for (auto &p : locus.intersection(edge, kMaxPointDistance)) {
+		if (triangle != nullptr && triangle->is_inside(p))
+			continue;
+		if (best < 0.0 || dist(p, k) < best) {
+			best = dist(p, k);
+			x = p;
+		}
+	}
+
+	cluster_ = { x };
+	*result = x;
+	*spread = 0.0;
+	return 0;
 }
 
 void Process::clear()
 {
 	input_ = std::vector<double>();
+	loci_.clear();
 	circles_ = CircleVector();
 	points_ = PointVector();
+	point_pairs_.clear();
+	cluster_.clear();
 }
 
-Circle Process::make_circle(const size_t i, const size_t j)
+GeneralizedCircle Process::make_circle(const size_t i, const size_t j)
 {
-	using std::pow;
-	using std::sqrt;
-
-	const Point &p = sensors_[i];
-	const Point &q = sensors_[j];
-	const double kk = pow(get_ratio(i, j), 2);
-	const double men = kk-1.0;
-
-	const double cx = (kk*q.x - p.x) / men;
-	const double cy = (kk*q.y - p.y) / men;
-	const double r2 = pow(cx, 2) + pow(cy, 2)
-	                  - ( kk * (pow(q.x, 2) + pow(q.y, 2))
-	                  - pow(p.x, 2) - pow(p.y, 2) ) / men;
-
-	return Circle(cx, cy, sqrt(r2));
+	//
+	// With equal magnitudes the circle becomes the bisector,
+	// generalized form stays well defined all the way there.
+	//
+	return GeneralizedCircle::apollonius(sensors_[i], sensors_[j],
+	                                     get_ratio(i, j));
 }
 
 double Process::get_ratio(const size_t i, const size_t j)
 {
-	//return std::cbrt(input_[j]) / std::cbrt(input_[i]);
-	return std::cbrt(input_[i]) / std::cbrt(input_[j]);
+	//
+	// Ratio of distances to sensors i and j, field falls off as 1/r^3.
+	//
+	return std::cbrt(input_[j]) / std::cbrt(input_[i]);
 }
 
-void Process::make_circles()
+void Process::make_circles(const uint32_t skipped)
 {
-	for (size_t i = 0; i < get_sensor_cnt()-1; ++i)
-		for (size_t j = i+1; j < get_sensor_cnt(); ++j)
-			circles_.push_back(make_circle(i, j));
+	for (size_t i = 0; i < get_sensor_cnt()-1; ++i) {
+		if ((skipped & (1u << i)) != 0)
+			continue;
+		for (size_t j = i+1; j < get_sensor_cnt(); ++j) {
+			if ((skipped & (1u << j)) != 0)
+				continue;
+			const GeneralizedCircle locus = make_circle(i, j);
+			loci_.push_back(locus);
+			circles_.push_back(locus.to_circle(
+			        sensors_[i].midpoint(sensors_[j]),
+			        kMaxCircleRadius));
+		}
+	}
 }
 
 void Process::make_points()
 {
-	const auto circle_cnt = circles_.size();
+	const auto circle_cnt = loci_.size();
 
 	if (circle_cnt < 2)
 		return;
 
+	size_t pair = 0;
 	for (size_t i = 0; i < circle_cnt - 1; ++i) {
-		for (size_t j = i + 1; j < circle_cnt; ++j) {
-			auto intersec = circles_[i].intersection(circles_[j],
-			                                         nullptr);
-			for (auto p : intersec)
+		for (size_t j = i + 1; j < circle_cnt; ++j, ++pair) {
+			auto intersec = loci_[i].intersection(loci_[j],
+			                                      kMaxPointDistance);
+			for (auto p : intersec) {
 				points_.push_back(p);
+				point_pairs_.push_back(pair);
+			}
 		}
 	}
 }
@@ -177,7 +433,8 @@ void Process::make_points()
 // FilteredProcess
 FilteredProcess::FilteredProcess() :
 	Process(),
-	environment_()
+	environment_(),
+	correction_()
 {
 
 }
@@ -192,30 +449,34 @@ int FilteredProcess::initialize(const PointVector &sensors)
 	if (Process::initialize(sensors) != 0)
 		return -1;
 
-	environment_ = std::vector<double>(get_sensor_cnt(), 0.0);
+	environment_ = std::vector<double>(3 * get_sensor_cnt(), 0.0);
+
+	correction_ = std::vector<double>(9 * get_sensor_cnt(), 0.0);
+	for (size_t i = 0; i < correction_.size(); i += 9)
+		correction_[i] = correction_[i + 4] = correction_[i + 8] = 1.0;
 
 	return 0;
 }
 
 int FilteredProcess::calibrate(const std::string &raw_data, const double speed)
 {
-	std::vector<double> data;
-	if (parse_raw_data(raw_data, get_sensor_cnt(), &data) != 0)
+	std::vector<double> field;
+	if (parse_raw_field(raw_data, get_sensor_cnt(), &field) != 0)
 		return -1;
 
-	return calibrate_common(data, speed);
+	return calibrate_common(field, speed);
 }
 
-int FilteredProcess::calibrate(const std::vector<double> &data,
+int FilteredProcess::calibrate(const std::vector<double> &field,
                                const double speed)
 {
-	if (data.size() != get_sensor_cnt())
+	if (field.size() != 3 * get_sensor_cnt())
 		return -1;
 
-	return calibrate_common(data, speed);
+	return calibrate_common(field, speed);
 }
 
-int FilteredProcess::calibrate_common(const std::vector<double> &data,
+int FilteredProcess::calibrate_common(const std::vector<double> &field,
                                       const double speed)
 {
 	if (!is_initialized())
@@ -226,118 +487,165 @@ int FilteredProcess::calibrate_common(const std::vector<double> &data,
 		return -1;
 	}
 
-	using std::vector;
-	for (vector<double>::size_type i = 0; i < get_sensor_cnt(); ++i) {
+	for (size_t i = 0; i < environment_.size(); ++i) {
 		environment_[i] = environment_[i] * (1.0 - speed)
-		                  + data[i] * speed;
+		                  + field[i] * speed;
 	}
 
 	return 0;
 }
 
-int FilteredProcess::process(const std::string &raw_data)
+int FilteredProcess::set_environment(const std::vector<double> &environment)
 {
 	if (!is_initialized())
 		return -1;
 
-	std::vector<double> parsed_input;
-	if (parse_raw_data(raw_data, get_sensor_cnt(), &parsed_input) != 0)
+	if (environment.size() != 3 * get_sensor_cnt())
 		return -1;
 
-	for (size_t i = 0; i < get_sensor_cnt(); ++i)
-		input_[i] = std::abs(parsed_input[i] -environment_[i]);
+	environment_ = environment;
 
-	return process_common();
+	return 0;
 }
 
-int FilteredProcess::process(const std::vector<double> &data)
+int FilteredProcess::set_correction(const size_t sensor, const double matrix[9])
 {
-	if (!is_initialized())
+	if (!is_initialized() || sensor >= get_sensor_cnt())
 		return -1;
 
-	if (data.size() != get_sensor_cnt())
-		return -1;
+	for (size_t i = 0; i < 9; ++i)
+		correction_[9 * sensor + i] = matrix[i];
 
-	input_ = std::vector<double>(get_sensor_cnt());
-	for (size_t i = 0; i < get_sensor_cnt(); ++i)
-		input_[i] = std::abs(data[i] - environment_[i]);
+	return 0;
+}
 
-	return process_common();
+void FilteredProcess::source_field(const std::vector<double> &field,
+                                   const size_t sensor, double out[3]) const
+{
+	double diff[3];
+	for (size_t j = 0; j < 3; ++j)
+		diff[j] = field[3 * sensor + j] - environment_[3 * sensor + j];
+
+	const double *m = &correction_[9 * sensor];
+	for (size_t j = 0; j < 3; ++j) {
+		out[j] = m[3 * j] * diff[0] + m[3 * j + 1] * diff[1]
+		         + m[3 * j + 2] * diff[2];
+	}
+}
+
+double FilteredProcess::source_magnitude(const std::vector<double> &field,
+                                         const size_t sensor) const
+{
+	double c[3];
+	source_field(field, sensor, c);
+
+	return std::sqrt(c[0] * c[0] + c[1] * c[1] + c[2] * c[2]);
 }
 
-int FilteredProcess::eliminate_triangle(const Triangle &triangle)
+int FilteredProcess::process(const std::string &raw_data)
 {
-	if (points_.size() != 2 * get_sensor_cnt())
+	if (!is_initialized())
 		return -1;
 
-	PointVector valid;
-	for (auto p : points_)
-		if (!triangle.is_inside(p))
-			valid.push_back(p);
+	std::vector<double> field;
+	if (parse_raw_field(raw_data, get_sensor_cnt(), &field) != 0)
+		return -1;
+
+	return process(field);
+}
 
-	if (valid.size() != get_sensor_cnt())
+int FilteredProcess::process(const std::vector<double> &field)
+{
+	if (!is_initialized())
 		return -1;
 
-	points_ = valid;
+	if (field.size() != 3 * get_sensor_cnt())
+		return -1;
 
-	return 0;
+	input_ = std::vector<double>(get_sensor_cnt());
+	for (size_t i = 0; i < get_sensor_cnt(); ++i)
+		input_[i] = source_magnitude(field, i);
+
+	return process_common();
 }
 
-bool FilteredProcess::is_source_present(const std::vector<double> &input,
+bool FilteredProcess::is_source_present(const std::vector<double> &field,
                                         const double treshold)
 {
-	if (input.size() != get_sensor_cnt())
+	if (field.size() != 3 * get_sensor_cnt())
 		return false;
 
 	for (size_t i=0; i < get_sensor_cnt(); ++i) {
-		double diff = input[i] - environment_[i];
-		if (std::abs(diff) < treshold)
+		if (source_magnitude(field, i) < treshold)
 			return false;
 	}
 	return true;
 }
 
 
-int parse_raw_data(const std::string &raw_data, const int sensor_cnt,
-                   std::vector<double> *out_data)
+int parse_raw_axes(const std::string &raw_data, const int sensor_cnt,
+                   std::vector<int> *out_axes)
 {
 	if (sensor_cnt <= 0)
 		return -1;
 
+	if (out_axes == nullptr)
+		return -1;
+
+	out_axes->resize(3 * sensor_cnt);
+
+	std::string data = raw_data;
+	for (int i = 0; i < 3 * sensor_cnt; ++i) {
+		std::string::size_type pos = 0;
+
+		try {
+			(*out_axes)[i] = std::stoi(data, &pos);
+		} catch (const std::invalid_argument &) {
+			return -1;
+		} catch (const std::out_of_range &) {
+			return -1;
+		}
+
+		data = data.substr(pos);
+	}
+
+	return 0;
+}
+
+int parse_raw_data(const std::string &raw_data, const int sensor_cnt,
+                   std::vector<double> *out_data)
+{
+	LM_TIMER(TIMER_PARSE);
+	LM_TRACE("parse_raw_data");
+
 	if (out_data == nullptr)
 		return -1;
 
+	std::vector<int> axes;
+	if (parse_raw_axes(raw_data, sensor_cnt, &axes) != 0)
+		return -1;
+
+	return axes_to_magnitudes(axes, sensor_cnt, out_data);
+}
+
+int axes_to_magnitudes(const std::vector<int> &axes, const int sensor_cnt,
+                       std::vector<double> *out_data)
+{
+	if (sensor_cnt <= 0 || axes.size() < 3 * (size_t) sensor_cnt)
+		return -1;
+
 	*out_data = std::vector<double>(sensor_cnt);
 
-	std::string data = raw_data;
 	for (int i = 0; i < sensor_cnt; ++i) {
 		double magnitude = 0.0;
 		for (int j = 0; j < 3; ++j) {
-			std::string::size_type pos = 0;
-			int axis_value = 0.0;
-
-			try {
-				axis_value = std::stoi(data, &pos);
-			} catch (const std::invalid_argument &ia) {
-				fprintf(stderr, "Parsing error: %s\n",
-				        ia.what());
-				return -1;
-			} catch (const std::out_of_range &oor) {
-				fprintf(stderr, "Parsing error: %s\n",
-				        oor.what());
-				return -1;
-			}
+			const int axis_value = axes[3 * i + j];
 
 			// check for sensor saturation
-			if(std::abs(axis_value) > 4090) {
-				fprintf(stderr,
-				        "Sensor %d axis %d is saturated.\n",
-				        i, j);
+			if(std::abs(axis_value) > 4090)
 				return 1;
-			}
 
 			magnitude += axis_value*axis_value;
-			data = data.substr(pos);
 		}
 		(*out_data)[i] = std::sqrt(magnitude);
 	}
@@ -345,5 +653,43 @@ int parse_raw_data(const std::string &raw_data, const int sensor_cnt,
 	return 0;
 }
 
+int axes_to_field(const std::vector<int> &axes, const int sensor_cnt,
+                  std::vector<double> *out_field, uint32_t *saturated)
+{
+	if (sensor_cnt <= 0 || axes.size() < 3 * (size_t) sensor_cnt)
+		return -1;
+
+	*out_field = std::vector<double>(3 * sensor_cnt);
+
+	uint32_t mask = 0;
+	for (int i = 0; i < 3 * sensor_cnt; ++i) {
+		// check for sensor saturation
+		if (std::abs(axes[i]) > 4090)
+			mask |= 1u << (i / 3);
+
+		(*out_field)[i] = axes[i];
+	}
+
+	if (saturated != nullptr)
+		*saturated = mask;
+
+	return (mask != 0) ? 1 : 0;
+}
+
+int parse_raw_field(const std::string &raw_data, const int sensor_cnt,
+                    std::vector<double> *out_field, uint32_t *saturated)
+{
+	LM_TIMER(TIMER_PARSE);
+	LM_TRACE("parse_raw_data");
+
+	if (out_field == nullptr)
+		return -1;
+
+	std::vector<int> axes;
+	if (parse_raw_axes(raw_data, sensor_cnt, &axes) != 0)
+		return -1;
+
+	return axes_to_field(axes, sensor_cnt, out_field, saturated);
+}
 
 } // namespace lm
@@ -30,6 +30,8 @@
 #ifndef _LIBPROCESS_PROCESS_H_
 #define _LIBPROCESS_PROCESS_H_
 
+#include <cstdint>
+
 #include <string>
 #include <vector>
 
@@ -39,17 +41,43 @@
 namespace lm {
 
 
+/** \brief Parses x, y, z axis values of all sensors from serial line. */
+int parse_raw_axes(const std::string &raw_data, const int sensor_cnt,
+                   std::vector<int> *out_axes);
+
+/** \brief Parses serial line into magnitudes, returns 1 on saturation. */
 int parse_raw_data(const std::string &raw_data, const int sensor_cnt,
                    std::vector<double> *out_data);
 
+/** \brief Magnitudes of parsed axes, returns 1 on saturation. */
+int axes_to_magnitudes(const std::vector<int> &axes, const int sensor_cnt,
+                       std::vector<double> *out_data);
+
+//!
+//! Field vectors of parsed axes, x, y, z of every sensor in a row.
+//! Returns 1 on saturation of any sensor, bit i of saturated is set when
+//! sensor i saturated. Axes of saturated sensors are kept as read.
+//!
+int axes_to_field(const std::vector<int> &axes, const int sensor_cnt,
+                  std::vector<double> *out_field,
+                  uint32_t *saturated = nullptr);
+
+/** \brief Parses serial line into field vectors, see axes_to_field(). */
+int parse_raw_field(const std::string &raw_data, const int sensor_cnt,
+                    std::vector<double> *out_field,
+                    uint32_t *saturated = nullptr);
+
 
 class Process
 {
 protected:
 	bool initialized_;
 	PointVector sensors_;
+	std::vector<GeneralizedCircle> loci_;
 	CircleVector circles_;
 	PointVector points_;
+	std::vector<size_t> point_pairs_;       // pair of circles of each point
+	PointVector cluster_;
 	std::vector<double> input_;
 
 public:
@@ -61,13 +89,50 @@ public:
 	int process(const std::string &raw_data);
 	int process(const std::vector<double> &data);
 
-	Point average_points() const;
+	//!
+	//! Picks the tightest cluster holding at most one intersection of
+	//! every pair of circles, members farther than gate from its geometric
+	//! median are left out. Clusters outside triangle are preferred, then
+	//! those with more members, then smaller spread (rms distance of
+	//! members from the median). Returns 0 on success, 1 if every
+	//! cluster is inside triangle and -1 if none has two members.
+	//!
+	int select_cluster(const Triangle *triangle, const double gate,
+	                   Point *result, double *spread);
+
+	//!
+	//! How well circles cross at x, ratio of smaller to larger singular
+	//! value of their unit normals. 1 for perpendicular, 0 for tangent.
+	//!
+	double conditioning(const Point &x) const;
+
+	//!
+	//! Position covariance xx, xy, yy [cm^2] at x when every magnitude
+	//! has gaussian noise, linearized 1/r^3 model with unknown moment.
+	//! Returns -1 if it is singular.
+	//!
+	int covariance(const Point &x, const double noise,
+	               double cov[3]) const;
+
+	//!
+	//! Fix when sensors flagged in saturated are, from circles of the
+	//! others only. Three and more of them are clustered as by
+	//! select_cluster(), whose return values apply. With two of them the
+	//! magnitude read by the first saturated sensor is its lower bound, so
+	//! the source is nearer to it than the other magnitudes allow. Result
+	//! is the end of the arc of their circle within the bound which is
+	//! outside triangle and nearest to the sensor, -1 if no point is
+	//! within it. Circles and points are left without saturated sensors.
+	//!
+	int degraded_fix(const uint32_t saturated, const Triangle *triangle,
+	                 const double gate, Point *result, double *spread);
 
 	bool is_initialized() const { return initialized_; }
 	size_t get_sensor_cnt() const {return sensors_.size(); }
 	std::vector<double> get_input() const { return input_; }
 	CircleVector get_circles() const { return circles_; }
 	PointVector get_points() const { return points_; }
+	PointVector get_cluster() const { return cluster_; }
 
 	void clear();
 
@@ -75,16 +140,25 @@ protected:
 	int process_common();
 
 private:
-	Circle make_circle(const size_t i, const size_t j);
+	GeneralizedCircle make_circle(const size_t i, const size_t j);
 	double get_ratio(const size_t i, const size_t j);
-	void make_circles();
+	void make_circles(const uint32_t skipped = 0);
 	void make_points();
 };
 
 
+//!
+//! Subtracts environment (mostly Earth's) field from measured field before
+//! magnitudes are taken, so source field need not be parallel to it.
+//! Input and environment hold 3 axes per sensor.
+//!
+//! Soft iron correction matrix of every sensor is applied to the difference,
+//! hard iron offsets cancel out in it.
+//!
 class FilteredProcess : public Process
 {
 	std::vector<double> environment_;
+	std::vector<double> correction_;
 
 public:
 	FilteredProcess();
@@ -93,21 +167,34 @@ public:
 	int initialize(const PointVector &sensors);
 
 	int calibrate(const std::string &raw_data, const double speed);
-	int calibrate(const std::vector<double> &data, const double speed);
+	int calibrate(const std::vector<double> &field, const double speed);
 
 	int process(const std::string &raw_data);
-	int process(const std::vector<double> &data);
+	int process(const std::vector<double> &field);
 
-	int eliminate_triangle(const Triangle &triangle);
-
-	bool is_source_present(const std::vector<double> &input,
+	/** \brief Every sensor must differ from environment by treshold. */
+	bool is_source_present(const std::vector<double> &field,
 	                       const double treshold);
 
+	/** \brief Field with environment subtracted and corrected, 3 axes. */
+	void source_field(const std::vector<double> &field, const size_t sensor,
+	                  double out[3]) const;
+
+	/** \brief Magnitude of field with environment subtracted. */
+	double source_magnitude(const std::vector<double> &field,
+	                        const size_t sensor) const;
+
+	/** \brief Replaces environment values, e.g. with persisted ones. */
+	int set_environment(const std::vector<double> &environment);
+
+	/** \brief Sets row major 3x3 soft iron matrix of sensor. */
+	int set_correction(const size_t sensor, const double matrix[9]);
 	inline std::vector<double> get_environment() const { return environment_; }
 
 private:
-	int calibrate_common(const std::vector<double> &data,
+	int calibrate_common(const std::vector<double> &field,
 	                     const double speed);
+
 };
 
 
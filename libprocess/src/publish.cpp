@@ -0,0 +1,450 @@
+//------------------------------------------------------------------------------
+// The MIT License (MIT)
+//
+// Copyright (c) 2015 Lukáš Mandák <lukas.mandak@yandex.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//
+// publish.cpp
+//
+//
+//
+//------------------------------------------------------------------------------
+#include "publish.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "record.hpp"
+
+
+namespace lm {
+
+
+namespace {
+
+
+const size_t kMaxPacketSize = sizeof (PacketHeader)
+                              + PACKET_MAX_RECORDS * sizeof (Record);
+
+//!
+//! Backlog of not yet accepted subscribers.
+//!
+const int kListenBacklog = 8;
+
+
+int make_unix_address(const std::string &path, struct sockaddr_un *addr)
+{
+	memset(addr, 0, sizeof (*addr));
+	addr->sun_family = AF_UNIX;
+
+	if (path.size() >= sizeof (addr->sun_path)) {
+		fprintf(stderr, "Socket path too long: %s\n", path.c_str());
+		return -1;
+	}
+	strncpy(addr->sun_path, path.c_str(), sizeof (addr->sun_path) - 1);
+
+	return 0;
+}
+
+int make_inet_address(const std::string &host, const int port,
+                      struct sockaddr_in *addr)
+{
+	memset(addr, 0, sizeof (*addr));
+	addr->sin_family = AF_INET;
+	addr->sin_port = htons(port);
+
+	if (inet_pton(AF_INET, host.c_str(), &addr->sin_addr) != 1) {
+		fprintf(stderr, "Invalid address: %s\n", host.c_str());
+		return -1;
+	}
+
+	return 0;
+}
+
+
+} // namespace
+
+
+int parse_multicast_spec(const std::string &spec, std::string *group,
+                         int *port, std::string *iface)
+{
+	const auto c1 = spec.find(':');
+	if (c1 == std::string::npos) {
+		fprintf(stderr, "Expected <group>:<port>[:<iface>]: %s\n",
+		        spec.c_str());
+		return -1;
+	}
+
+	const auto c2 = spec.find(':', c1 + 1);
+	*group = spec.substr(0, c1);
+	*port = atoi(spec.substr(c1 + 1, c2 - c1 - 1).c_str());
+	*iface = (c2 == std::string::npos) ? "127.0.0.1" : spec.substr(c2 + 1);
+
+	if (*port <= 0 || *port > 65535) {
+		fprintf(stderr, "Invalid port: %s\n", spec.c_str());
+		return -1;
+	}
+
+	return 0;
+}
+
+
+// Publisher
+Publisher::Publisher() :
+	fd_(-1),
+	is_unix_(false),
+	path_(),
+	clients_(),
+	packet_(kMaxPacketSize),
+	pending_(0),
+	sequence_(0),
+	dropped_(0)
+{
+
+}
+
+Publisher::~Publisher()
+{
+	close();
+}
+
+int Publisher::open_unix(const std::string &path)
+{
+	struct sockaddr_un addr;
+	if (make_unix_address(path, &addr) != 0)
+		return -1;
+
+	fd_ = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd_ == -1) {
+		fprintf(stderr, "socket: %s\n", strerror(errno));
+		return -1;
+	}
+
+	//
+	// Remove stale socket of previous run.
+	//
+	::unlink(path.c_str());
+
+	if (bind(fd_, (struct sockaddr *) &addr, sizeof (addr)) != 0 ||
+	    listen(fd_, kListenBacklog) != 0) {
+		fprintf(stderr, "Unable to listen on %s: %s\n", path.c_str(),
+		        strerror(errno));
+		close();
+		return -1;
+	}
+
+	is_unix_ = true;
+	path_ = path;
+	return 0;
+}
+
+int Publisher::open_multicast(const std::string &group, const int port,
+                              const std::string &iface)
+{
+	struct sockaddr_in addr;
+	struct in_addr iface_addr;
+	if (make_inet_address(group, port, &addr) != 0)
+		return -1;
+	if (inet_pton(AF_INET, iface.c_str(), &iface_addr) != 1) {
+		fprintf(stderr, "Invalid interface address: %s\n",
+		        iface.c_str());
+		return -1;
+	}
+
+	fd_ = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd_ == -1) {
+		fprintf(stderr, "socket: %s\n", strerror(errno));
+		return -1;
+	}
+
+	const unsigned char ttl = 1;
+	const unsigned char loop = 1;
+	if (setsockopt(fd_, IPPROTO_IP, IP_MULTICAST_IF, &iface_addr,
+	               sizeof (iface_addr)) != 0 ||
+	    setsockopt(fd_, IPPROTO_IP, IP_MULTICAST_TTL, &ttl,
+	               sizeof (ttl)) != 0 ||
+	    setsockopt(fd_, IPPROTO_IP, IP_MULTICAST_LOOP, &loop,
+	               sizeof (loop)) != 0 ||
+	    connect(fd_, (struct sockaddr *) &addr, sizeof (addr)) != 0) {
+		fprintf(stderr, "Unable to set up multicast to %s:%d: %s\n",
+		        group.c_str(), port, strerror(errno));
+		close();
+		return -1;
+	}
+
+	is_unix_ = false;
+	return 0;
+}
+
+void Publisher::close()
+{
+	for (auto c : clients_)
+		::close(c);
+	clients_.clear();
+
+	if (fd_ != -1) {
+		::close(fd_);
+		fd_ = -1;
+	}
+
+	if (is_unix_ && !path_.empty()) {
+		::unlink(path_.c_str());
+		path_.clear();
+	}
+}
+
+int Publisher::publish(const Record &record)
+{
+	if (fd_ == -1)
+		return -1;
+
+	memcpy(packet_.data() + sizeof (PacketHeader)
+	       + pending_ * sizeof (Record), &record, sizeof (Record));
+	++pending_;
+
+	if (pending_ == PACKET_MAX_RECORDS)
+		return send_packet();
+
+	return 0;
+}
+
+int Publisher::flush()
+{
+	if (fd_ == -1 || pending_ == 0)
+		return 0;
+
+	return send_packet();
+}
+
+void Publisher::accept_clients()
+{
+	int c;
+	while ((c = accept4(fd_, nullptr, nullptr,
+	                    SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1)
+		clients_.push_back(c);
+}
+
+int Publisher::send_packet()
+{
+	PacketHeader header;
+	header.magic = PACKET_MAGIC;
+	header.version = PACKET_VERSION;
+	header.count = pending_;
+	header.sequence = sequence_;
+	memcpy(packet_.data(), &header, sizeof (header));
+
+	const size_t size = sizeof (PacketHeader) + pending_ * sizeof (Record);
+	sequence_ += pending_;
+	pending_ = 0;
+
+	if (!is_unix_) {
+		if (send(fd_, packet_.data(), size, MSG_DONTWAIT) == -1) {
+			++dropped_;
+			return (errno == EAGAIN || errno == ENOBUFS) ? 0 : -1;
+		}
+		return 0;
+	}
+
+	//
+	// Subscribers that can not keep up lose datagrams,
+	// disconnected ones are removed.
+	//
+	accept_clients();
+	for (size_t i = 0; i < clients_.size(); ) {
+		if (send(clients_[i], packet_.data(), size,
+		         MSG_DONTWAIT | MSG_NOSIGNAL) == -1) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				++dropped_;
+			} else {
+				::close(clients_[i]);
+				clients_.erase(clients_.begin() + i);
+				continue;
+			}
+		}
+		++i;
+	}
+
+	return 0;
+}
+
+
+// Subscriber
+Subscriber::Subscriber() :
+	fd_(-1),
+	first_(true),
+	expected_(0),
+	received_(0),
+	lost_(0)
+{
+
+}
+
+Subscriber::~Subscriber()
+{
+	close();
+}
+
+int Subscriber::open_unix(const std::string &path)
+{
+	struct sockaddr_un addr;
+	if (make_unix_address(path, &addr) != 0)
+		return -1;
+
+	fd_ = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (fd_ == -1) {
+		fprintf(stderr, "socket: %s\n", strerror(errno));
+		return -1;
+	}
+
+	if (connect(fd_, (struct sockaddr *) &addr, sizeof (addr)) != 0) {
+		fprintf(stderr, "Unable to connect to %s: %s\n", path.c_str(),
+		        strerror(errno));
+		close();
+		return -1;
+	}
+
+	return 0;
+}
+
+int Subscriber::open_multicast(const std::string &group, const int port,
+                               const std::string &iface)
+{
+	struct sockaddr_in addr;
+	struct ip_mreq mreq;
+	if (make_inet_address(group, port, &addr) != 0)
+		return -1;
+	mreq.imr_multiaddr = addr.sin_addr;
+	if (inet_pton(AF_INET, iface.c_str(), &mreq.imr_interface) != 1) {
+		fprintf(stderr, "Invalid interface address: %s\n",
+		        iface.c_str());
+		return -1;
+	}
+
+	fd_ = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (fd_ == -1) {
+		fprintf(stderr, "socket: %s\n", strerror(errno));
+		return -1;
+	}
+
+	const int reuse = 1;
+	if (setsockopt(fd_, SOL_SOCKET, SO_REUSEADDR, &reuse,
+	               sizeof (reuse)) != 0 ||
+	    bind(fd_, (struct sockaddr *) &addr, sizeof (addr)) != 0 ||
+	    setsockopt(fd_, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq,
+	               sizeof (mreq)) != 0) {
+		fprintf(stderr, "Unable to join %s:%d: %s\n", group.c_str(),
+		        port, strerror(errno));
+		close();
+		return -1;
+	}
+
+	return 0;
+}
+
+int Subscriber::open(const std::string &spec)
+{
+	if (spec.compare(0, 5, "unix:") == 0)
+		return open_unix(spec.substr(5));
+
+	if (spec.compare(0, 6, "mcast:") == 0) {
+		std::string group, iface;
+		int port;
+		if (parse_multicast_spec(spec.substr(6), &group, &port,
+		                         &iface) != 0)
+			return -1;
+		return open_multicast(group, port, iface);
+	}
+
+	fprintf(stderr, "Unknown stream: %s\n", spec.c_str());
+	return -1;
+}
+
+void Subscriber::close()
+{
+	if (fd_ != -1) {
+		::close(fd_);
+		fd_ = -1;
+	}
+}
+
+int Subscriber::receive(std::vector<Record> *out, const int timeout_ms)
+{
+	if (fd_ == -1)
+		return -1;
+
+	struct pollfd pfd;
+	pfd.fd = fd_;
+	pfd.events = POLLIN;
+
+	const int ready = poll(&pfd, 1, timeout_ms);
+	if (ready == -1)
+		return (errno == EINTR) ? 0 : -1;
+	if (ready == 0)
+		return 0;
+
+	char packet[kMaxPacketSize];
+	const ssize_t size = recv(fd_, packet, sizeof (packet), 0);
+	if (size == -1)
+		return (errno == EINTR || errno == EAGAIN) ? 0 : -1;
+	if (size == 0)
+		return -1; // publisher closed connection
+
+	PacketHeader header;
+	if ((size_t) size < sizeof (header))
+		return 0;
+	memcpy(&header, packet, sizeof (header));
+
+	if (header.magic != PACKET_MAGIC || header.version != PACKET_VERSION ||
+	    header.count > PACKET_MAX_RECORDS ||
+	    (size_t) size != sizeof (header) + header.count * sizeof (Record))
+		return 0;
+
+	if (!first_ && header.sequence > expected_)
+		lost_ += header.sequence - expected_;
+	first_ = false;
+	expected_ = header.sequence + header.count;
+	received_ += header.count;
+
+	for (int i = 0; i < header.count; ++i) {
+		Record r;
+		memcpy(&r, packet + sizeof (header) + i * sizeof (Record),
+		       sizeof (r));
+		out->push_back(r);
+	}
+
+	return header.count;
+}
+
+
+} // namespace lm
@@ -0,0 +1,147 @@
+//------------------------------------------------------------------------------
+// The MIT License (MIT)
+//
+// Copyright (c) 2015 Lukáš Mandák <lukas.mandak@yandex.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//
+// publish.hpp
+//
+// Streams lm::Record structures over SOCK_SEQPACKET unix socket or UDP
+// multicast and receives them on the other side.
+//
+// Datagram layout: PacketHeader followed by `count` records. Header
+// sequence numbers records of one publisher contiguously, so subscribers
+// detect lost datagrams from gaps.
+//
+//------------------------------------------------------------------------------
+#ifndef _LIBPROCESS_PUBLISH_H_
+#define _LIBPROCESS_PUBLISH_H_
+
+#include <cstdint>
+
+#include <string>
+#include <vector>
+
+#include "record.hpp"
+
+
+namespace lm {
+
+
+#define PACKET_MAGIC            (0x4d474e4fu) // "MGNO"
+#define PACKET_VERSION          (3)
+
+//!
+//! Records per datagram, keeps UDP datagrams below common MTU.
+//!
+#define PACKET_MAX_RECORDS      (5)
+
+
+struct PacketHeader
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t count;
+	uint64_t sequence;      // sequence of the first record
+};
+
+
+class Publisher
+{
+	int fd_;
+	bool is_unix_;
+	std::string path_;
+	std::vector<int> clients_;
+
+	std::vector<char> packet_;
+	uint16_t pending_;
+	uint64_t sequence_;
+	uint64_t dropped_;
+
+public:
+	Publisher();
+	~Publisher();
+
+	/** \brief Listens for subscribers on unix socket at path. */
+	int open_unix(const std::string &path);
+
+	/** \brief Sends to multicast group through interface with given address. */
+	int open_multicast(const std::string &group, const int port,
+	                   const std::string &iface = "127.0.0.1");
+
+	void close();
+
+	/** \brief Adds record to current datagram, sends it when full. */
+	int publish(const Record &record);
+
+	/** \brief Sends partially filled datagram. */
+	int flush();
+
+	inline size_t get_client_cnt() const { return clients_.size(); }
+	inline uint64_t get_dropped() const { return dropped_; }
+
+private:
+	void accept_clients();
+	int send_packet();
+};
+
+
+class Subscriber
+{
+	int fd_;
+	bool first_;
+	uint64_t expected_;
+	uint64_t received_;
+	uint64_t lost_;
+
+public:
+	Subscriber();
+	~Subscriber();
+
+	int open_unix(const std::string &path);
+	int open_multicast(const std::string &group, const int port,
+	                   const std::string &iface = "127.0.0.1");
+
+	/** \brief Opens "unix:<path>" or "mcast:<group>:<port>[:<iface>]". */
+	int open(const std::string &spec);
+
+	void close();
+
+	/** \brief Receives one datagram and appends its records to out.
+	 *  \return Number of records, 0 on timeout, -1 on error.
+	 */
+	int receive(std::vector<Record> *out, const int timeout_ms);
+
+	inline int get_fd() const { return fd_; }
+	inline uint64_t get_received() const { return received_; }
+	inline uint64_t get_lost() const { return lost_; }
+};
+
+
+/** \brief Splits "<group>:<port>[:<iface>]". */
+int parse_multicast_spec(const std::string &spec, std::string *group,
+                         int *port, std::string *iface);
+
+
+} // namespace lm
+
+
+#endif // _LIBPROCESS_PUBLISH_H_
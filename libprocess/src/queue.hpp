@@ -0,0 +1,157 @@
+//------------------------------------------------------------------------------
+// The MIT License (MIT)
+//
+// Copyright (c) 2015 Lukáš Mandák <lukas.mandak@yandex.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//
+// queue.hpp
+//
+// Bounded lock-free multi-producer multi-consumer queue
+// (D. Vyukov's sequence-per-cell design).
+//
+//------------------------------------------------------------------------------
+#ifndef _LIBPROCESS_QUEUE_H_
+#define _LIBPROCESS_QUEUE_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include <atomic>
+
+
+namespace lm {
+
+
+template <typename T>
+class BoundedQueue
+{
+	struct Cell {
+		std::atomic<size_t> sequence;
+		T data;
+	};
+
+	Cell *buffer_;
+	const size_t mask_;
+
+	// keep positions on separate cache lines
+	char pad0_[64];
+	std::atomic<size_t> enqueue_pos_;
+	char pad1_[64];
+	std::atomic<size_t> dequeue_pos_;
+	char pad2_[64];
+
+public:
+	/** \brief Capacity is rounded up to power of two. */
+	BoundedQueue(const size_t capacity) :
+		buffer_(nullptr),
+		mask_(round_up(capacity) - 1),
+		enqueue_pos_(0),
+		dequeue_pos_(0)
+	{
+		buffer_ = new Cell[mask_ + 1];
+		for (size_t i = 0; i <= mask_; ++i)
+			buffer_[i].sequence.store(i, std::memory_order_relaxed);
+	}
+
+	~BoundedQueue()
+	{
+		delete[] buffer_;
+	}
+
+	BoundedQueue(const BoundedQueue &) = delete;
+	BoundedQueue & operator = (const BoundedQueue &) = delete;
+
+	bool push(const T &data)
+	{
+		Cell *cell;
+		size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+
+		for (;;) {
+			cell = &buffer_[pos & mask_];
+			size_t seq = cell->sequence.load(std::memory_order_acquire);
+			intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+
+			if (diff == 0) {
+				if (enqueue_pos_.compare_exchange_weak(pos, pos + 1,
+				                std::memory_order_relaxed))
+					break;
+			} else if (diff < 0) {
+				return false; // full
+			} else {
+				pos = enqueue_pos_.load(std::memory_order_relaxed);
+			}
+		}
+
+		cell->data = data;
+		cell->sequence.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool pop(T *data)
+	{
+		Cell *cell;
+		size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+
+		for (;;) {
+			cell = &buffer_[pos & mask_];
+			size_t seq = cell->sequence.load(std::memory_order_acquire);
+			intptr_t diff = (intptr_t) seq - (intptr_t) (pos + 1);
+
+			if (diff == 0) {
+				if (dequeue_pos_.compare_exchange_weak(pos, pos + 1,
+				                std::memory_order_relaxed))
+					break;
+			} else if (diff < 0) {
+				return false; // empty
+			} else {
+				pos = dequeue_pos_.load(std::memory_order_relaxed);
+			}
+		}
+
+		if (data != nullptr)
+			*data = cell->data;
+		cell->sequence.store(pos + mask_ + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool empty() const
+	{
+		return enqueue_pos_.load(std::memory_order_acquire)
+		       == dequeue_pos_.load(std::memory_order_acquire);
+	}
+
+	size_t capacity() const { return mask_ + 1; }
+
+private:
+	static size_t round_up(size_t n)
+	{
+		size_t p = 2;
+		while (p < n)
+			p <<= 1;
+		return p;
+	}
+};
+
+
+} // namespace lm
+
+
+#endif // _LIBPROCESS_QUEUE_H_
@@ -0,0 +1,122 @@
+//------------------------------------------------------------------------------
+// The MIT License (MIT)
+//
+// Copyright (c) 2015 Lukáš Mandák <lukas.mandak@yandex.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//
+// record.cpp
+//
+//
+//
+//------------------------------------------------------------------------------
+#include "record.hpp"
+
+#include <cstring>
+
+#include "geometry.hpp"
+#include "shared.hpp"
+
+
+namespace lm {
+
+
+Record make_record(const MagnetoData &data)
+{
+	Record r;
+	memset(&r, 0, sizeof (r));
+
+	r.sequence = data.sequence;
+	r.time = data.time;
+	if (data.valid)
+		r.flags |= RECORD_FLAG_VALID;
+	if (data.source_present)
+		r.flags |= RECORD_FLAG_SOURCE_PRESENT;
+	if (data.saturated != 0)
+		r.flags |= RECORD_FLAG_DEGRADED;
+	if (data.reused)
+		r.flags |= RECORD_FLAG_REUSED;
+	if (data.tracked)
+		r.flags |= RECORD_FLAG_TRACKED;
+	if (data.has_z)
+		r.flags |= RECORD_FLAG_HEIGHT;
+	r.saturated = data.saturated;
+
+	for (int i = 0; i < MD_SENSOR_COUNT; ++i) {
+		r.sensor[i][0] = data.sensor[i].x;
+		r.sensor[i][1] = data.sensor[i].y;
+		r.magnitude[i] = data.magnitude[i];
+	}
+
+	for (int i = 0; i < MD_CIRCLE_COUNT; ++i) {
+		r.circle[i][0] = data.circle[i].center().x;
+		r.circle[i][1] = data.circle[i].center().y;
+		r.circle[i][2] = data.circle[i].radius();
+	}
+
+	r.poi[0] = data.poi.x;
+	r.poi[1] = data.poi.y;
+	r.result[0] = data.result.x;
+	r.result[1] = data.result.y;
+	r.spread = data.spread;
+	r.conditioning = data.conditioning;
+	r.margin = data.margin;
+	for (int i = 0; i < 3; ++i)
+		r.covariance[i] = data.covariance[i];
+	r.z = data.z;
+	for (int i = 0; i < 3; ++i)
+		r.moment[i] = data.moment[i];
+
+	return r;
+}
+
+MagnetoData record_to_data(const Record &r)
+{
+	MagnetoData data;
+
+	data.sequence = r.sequence;
+	data.time = r.time;
+	data.valid = (r.flags & RECORD_FLAG_VALID) != 0;
+	data.source_present = (r.flags & RECORD_FLAG_SOURCE_PRESENT) != 0;
+	data.saturated = r.saturated;
+	data.reused = (r.flags & RECORD_FLAG_REUSED) != 0;
+	data.tracked = (r.flags & RECORD_FLAG_TRACKED) != 0;
+
+	for (int i = 0; i < MD_SENSOR_COUNT; ++i) {
+		data.sensor[i] = Point(r.sensor[i][0], r.sensor[i][1]);
+		data.magnitude[i] = r.magnitude[i];
+	}
+
+	for (int i = 0; i < MD_CIRCLE_COUNT; ++i) {
+		data.circle[i] = Circle(r.circle[i][0], r.circle[i][1],
+		                        r.circle[i][2]);
+	}
+
+	data.poi = Point(r.poi[0], r.poi[1]);
+	data.result = Point(r.result[0], r.result[1]);
+	data.set_quality(r.spread, r.conditioning, r.margin, r.covariance);
+	if ((r.flags & RECORD_FLAG_HEIGHT) != 0)
+		data.set_dipole(r.z, r.moment);
+
+	return data;
+}
+
+
+} // namespace lm
@@ -0,0 +1,86 @@
+//------------------------------------------------------------------------------
+// The MIT License (MIT)
+//
+// Copyright (c) 2015 Lukáš Mandák <lukas.mandak@yandex.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//
+// record.hpp
+//
+// Compact fixed-layout record of a processed frame. Used by binary output
+// files, network publisher and history store.
+//
+//------------------------------------------------------------------------------
+#ifndef _LIBPROCESS_RECORD_H_
+#define _LIBPROCESS_RECORD_H_
+
+#include <cstdint>
+
+#include "shared.hpp"
+
+
+namespace lm {
+
+
+#define RECORD_FLAG_VALID               (1u << 0)
+#define RECORD_FLAG_SOURCE_PRESENT      (1u << 1)
+#define RECORD_FLAG_DEGRADED            (1u << 2)
+#define RECORD_FLAG_REUSED              (1u << 3)
+#define RECORD_FLAG_TRACKED             (1u << 4)
+#define RECORD_FLAG_HEIGHT              (1u << 5)       // z, moment valid
+
+
+//!
+//! All members are naturally aligned, the layout has no padding.
+//! Positions are in cm, time is wall clock in ns since epoch.
+//!
+struct Record
+{
+	uint64_t sequence;
+	uint64_t time;
+	uint32_t flags;
+	uint32_t saturated;                     // bit per sensor
+
+	double sensor[MD_SENSOR_COUNT][2];
+	double magnitude[MD_SENSOR_COUNT];
+	double circle[MD_CIRCLE_COUNT][3];      // cx, cy, r
+	double poi[2];
+	double result[2];
+	double spread;
+	double conditioning;
+	double margin;
+	double covariance[3];                   // xx, xy, yy
+	double z;
+	double moment[3];
+};
+
+static_assert(sizeof (Record) == 3 * 8 + 8 * (2 * MD_SENSOR_COUNT
+              + MD_SENSOR_COUNT + 3 * MD_CIRCLE_COUNT + 4 + 6 + 4),
+              "Record must not contain padding.");
+
+
+Record make_record(const MagnetoData &data);
+MagnetoData record_to_data(const Record &record);
+
+
+} // namespace lm
+
+
+#endif // _LIBPROCESS_RECORD_H_
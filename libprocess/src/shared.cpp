@@ -13,6 +13,9 @@
 #include <unistd.h>
 
 #include "geometry.hpp"
+#include "instrument.hpp"
+#include "trace.hpp"
+#include "latency.hpp"
 
 
 namespace lm {
@@ -25,6 +28,7 @@ const char* Shared::kSegmentName = "/libprocess-shared-data";
 MagnetoData::MagnetoData()
 {
 	valid = false;
+	sequence = 0;
 
 	for (int i = 0; i < MD_SENSOR_COUNT; ++i)
 		sensor[i] = Point();
@@ -38,6 +42,9 @@ MagnetoData::MagnetoData()
 		magnitude[i] = 0.0;
 
 	source_present = false;
+	saturated = 0;
+	reused = false;
+	tracked = false;
 
 	for (int i = 0; i < MD_CIRCLE_COUNT; ++i)
 		circle[i] = Circle();
@@ -47,7 +54,22 @@ MagnetoData::MagnetoData()
 
 	result = Point();
 
+	has_z = false;
+	z = 0.0;
+	for (int i = 0; i < 3; ++i)
+		moment[i] = 0.0;
+
+	spread = 0.0;
+	conditioning = 0.0;
+	margin = 0.0;
+	for (int i = 0; i < 3; ++i)
+		covariance[i] = 0.0;
+
 	timestamp = std::chrono::steady_clock::now();
+	time = 0;
+
+	for (int i = 0; i < LP_COUNT; ++i)
+		stamp[i] = 0;
 }
 
 MagnetoData::MagnetoData(const MagnetoData &other)
@@ -60,6 +82,11 @@ void MagnetoData::set_valid(const bool v)
 	valid = v;
 }
 
+void MagnetoData::set_sequence(const uint64_t seq)
+{
+	sequence = seq;
+}
+
 void MagnetoData::set_sensors(const PointVector &s)
 {
 	for (int i = 0; i < MD_SENSOR_COUNT; ++i)
@@ -88,6 +115,21 @@ void MagnetoData::set_source_present(const bool present)
 	source_present = present;
 }
 
+void MagnetoData::set_saturated(const uint32_t mask)
+{
+	saturated = mask;
+}
+
+void MagnetoData::set_reused(const bool r)
+{
+	reused = r;
+}
+
+void MagnetoData::set_tracked(const bool t)
+{
+	tracked = t;
+}
+
 void MagnetoData::set_circles(const CircleVector &c)
 {
 	for (int i = 0; i < MD_CIRCLE_COUNT; ++i)
@@ -97,7 +139,7 @@ void MagnetoData::set_circles(const CircleVector &c)
 void MagnetoData::set_solutions(const PointVector &s)
 {
 	for (int i = 0; i < 2*MD_CIRCLE_COUNT; ++i)
-		solution[i] = s[i];
+		solution[i] = (i < (int) s.size()) ? s[i] : Point();
 }
 
 void MagnetoData::set_result(const Point &r)
@@ -105,9 +147,80 @@ void MagnetoData::set_result(const Point &r)
 	result = r;
 }
 
+void MagnetoData::set_dipole(const double height, const double m[3])
+{
+	has_z = true;
+	z = height;
+	for (int i = 0; i < 3; ++i)
+		moment[i] = m[i];
+}
+
+void MagnetoData::set_quality(const double s, const double cond,
+                              const double m, const double cov[3])
+{
+	spread = s;
+	conditioning = cond;
+	margin = m;
+	for (int i = 0; i < 3; ++i)
+		covariance[i] = cov[i];
+}
+
 void MagnetoData::set_timestamp()
 {
 	timestamp = std::chrono::steady_clock::now();
+	time = realtime_ns();
+}
+
+void MagnetoData::set_stamp(const LatencyPoint p)
+{
+	stamp[p] = monotonic_ns();
+}
+
+void MagnetoData::set_stamp(const LatencyPoint p, const uint64_t ns)
+{
+	stamp[p] = ns;
+}
+
+// IronCorrection
+IronCorrection::IronCorrection() :
+	samples(0),
+	residual(0.0)
+{
+	for (int i = 0; i < MD_AXIS_COUNT; ++i)
+		offset[i] = 0.0;
+
+	for (int i = 0; i < MD_AXIS_COUNT * MD_AXIS_COUNT; ++i)
+		matrix[i] = (i % (MD_AXIS_COUNT + 1) == 0) ? 1.0 : 0.0;
+}
+
+// PresenceState
+PresenceState::PresenceState() :
+	present(false),
+	sequence(0),
+	time(0)
+{
+
+}
+
+// SourceState
+SourceState::SourceState() :
+	id(0),
+	position(),
+	moment(),
+	age(0),
+	missed(0)
+{
+
+}
+
+// SourceList
+SourceList::SourceList() :
+	sequence(0),
+	count(0),
+	degraded(false),
+	source()
+{
+
 }
 
 // ShmData
@@ -115,15 +228,23 @@ Shared::ShmData::ShmData() :
 	lock(ATOMIC_FLAG_INIT),
 	process(0),
 	visualize(0),
-	data()
+	data(),
+	data_generation(0),
+	iron_generation(0),
+	presence(),
+	presence_generation(0),
+	sources(),
+	sources_generation(0)
 {
-
+	for (int i = 0; i < STAT_COUNT; ++i)
+		stats[i].store(0);
 }
 
 // Shared
 Shared::Shared() :
 	fd_(-1),
-	data_(nullptr)
+	data_(nullptr),
+	attached_(false)
 {
 
 }
@@ -188,9 +309,64 @@ int Shared::init()
 		data_->process.store(CONN_NONE);
 		data_->visualize.store(CONN_ACTIVE);
 		data_->data = MagnetoData();
+		for (int i = 0; i < STAT_COUNT; ++i)
+			data_->stats[i].store(0);
+		for (int i = 0; i < MD_SENSOR_COUNT; ++i)
+			data_->iron[i] = IronCorrection();
+		data_->iron_generation.store(0);
+		data_->presence = PresenceState();
+		data_->presence_generation.store(0);
+		data_->sources = SourceList();
+		data_->sources_generation.store(0);
+	}
+
+	return 0;
+}
+
+int Shared::attach()
+{
+	//
+	// Open existing segment for reading only.
+	// Attached segment is never unlinked.
+	//
+	fd_ = shm_open(kSegmentName, O_RDONLY, 0);
+	if (fd_ == -1) {
+		fprintf(stderr, "Unable to open %s: %s\n", kSegmentName,
+		        strerror(errno));
+		return -1;
+	}
+
+	struct stat mem_stat;
+	if (fstat(fd_, &mem_stat) != 0) {
+		fprintf(stderr, "fstat: %s\n", strerror(errno));
+		goto attach_error;
+	}
+
+	if (mem_stat.st_size != sizeof (ShmData)) {
+		fprintf(stderr, "Segment %s has unexpected size %ld.\n",
+		        kSegmentName, (long) mem_stat.st_size);
+		goto attach_error;
 	}
 
+	data_ = (ShmData*) mmap(nullptr, sizeof(ShmData), PROT_READ,
+	                        MAP_SHARED, fd_, 0);
+	if (data_ == MAP_FAILED) {
+		fprintf(stderr, "Unable to map %s: %s\n", kSegmentName,
+		        strerror(errno));
+		data_ = nullptr;
+		goto attach_error;
+	}
+
+	close(fd_);
+	fd_ = -1;
+	attached_ = true;
+
 	return 0;
+
+attach_error:
+	close(fd_);
+	fd_ = -1;
+	return -1;
 }
 
 int Shared::unlink()
@@ -198,7 +374,7 @@ int Shared::unlink()
 	if (data_ == nullptr && fd_ == -1)
 		return 0;
 
-	bool unlink = true;
+	bool unlink = !attached_;
 	if (data_->process.load() == CONN_ACTIVE ||
 	    data_->visualize.load() == CONN_ACTIVE) {
 		unlink = false;
@@ -230,13 +406,13 @@ int Shared::unlink()
 
 void Shared::set_process_state(const ConnectionState& state)
 {
-	if (data_ != nullptr)
+	if (data_ != nullptr && !attached_)
 		data_->process.store(state);
 }
 
 void Shared::set_visualize_state(const ConnectionState& state)
 {
-	if (data_ != nullptr)
+	if (data_ != nullptr && !attached_)
 		data_->visualize.store(state);
 }
 
@@ -256,18 +432,40 @@ bool Shared::is_visualize_connected()
 
 void Shared::set_data(const MagnetoData &new_data)
 {
-	if (data_ != nullptr) {
+	LM_TIMER(TIMER_SET_DATA);
+	LM_TRACE("Shared::set_data");
+
+	if (data_ != nullptr && !attached_) {
 		data_->lock.test_and_set();
+		data_->data_generation.fetch_add(1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
 		data_->data = new_data;
+		data_->data_generation.fetch_add(1, std::memory_order_release);
 		data_->lock.clear();
 	}
 }
 
 MagnetoData Shared::get_data()
 {
+	LM_TRACE("Shared::get_data");
+
 	MagnetoData tmp;
 
-	if (data_ != nullptr) {
+	//
+	// Lock can not be taken in read only segment, copy is retried
+	// there as in get_iron().
+	//
+	if (data_ != nullptr && attached_) {
+		uint64_t before, after;
+		do {
+			before = data_->data_generation.load(
+			        std::memory_order_acquire);
+			tmp = data_->data;
+			std::atomic_thread_fence(std::memory_order_acquire);
+			after = data_->data_generation.load(
+			        std::memory_order_relaxed);
+		} while ((before & 1) != 0 || before != after);
+	} else if (data_ != nullptr) {
 		data_->lock.test_and_set();
 		tmp = data_->data;
 		data_->lock.clear();
@@ -276,5 +474,112 @@ MagnetoData Shared::get_data()
 	return tmp;
 }
 
+void Shared::count(const StatCounter c, const uint64_t n)
+{
+	if (data_ != nullptr && !attached_)
+		data_->stats[c].fetch_add(n, std::memory_order_relaxed);
+}
+
+uint64_t Shared::get_count(const StatCounter c) const
+{
+	if (data_ != nullptr)
+		return data_->stats[c].load(std::memory_order_relaxed);
+	return 0;
+}
+
+void Shared::set_iron(const IronCorrection iron[MD_SENSOR_COUNT])
+{
+	if (data_ == nullptr || attached_)
+		return;
+
+	//
+	// Sequence lock, generation is odd while corrections are written.
+	//
+	data_->iron_generation.fetch_add(1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	for (int i = 0; i < MD_SENSOR_COUNT; ++i)
+		data_->iron[i] = iron[i];
+	data_->iron_generation.fetch_add(1, std::memory_order_release);
+}
+
+uint64_t Shared::get_iron(IronCorrection iron[MD_SENSOR_COUNT])
+{
+	if (data_ == nullptr)
+		return 0;
+
+	//
+	// Attached segment is read only, so retry until the copy was not
+	// overlapped by a writer instead of taking the lock.
+	//
+	uint64_t before, after;
+	do {
+		before = data_->iron_generation.load(std::memory_order_acquire);
+		for (int i = 0; i < MD_SENSOR_COUNT; ++i)
+			iron[i] = data_->iron[i];
+		std::atomic_thread_fence(std::memory_order_acquire);
+		after = data_->iron_generation.load(std::memory_order_relaxed);
+	} while ((before & 1) != 0 || before != after);
+
+	return before / 2;
+}
+
+void Shared::set_presence(const PresenceState &presence)
+{
+	if (data_ == nullptr || attached_)
+		return;
+
+	data_->presence_generation.fetch_add(1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	data_->presence = presence;
+	data_->presence_generation.fetch_add(1, std::memory_order_release);
+}
+
+uint64_t Shared::get_presence(PresenceState *presence)
+{
+	if (data_ == nullptr)
+		return 0;
+
+	uint64_t before, after;
+	do {
+		before = data_->presence_generation.load(
+		        std::memory_order_acquire);
+		*presence = data_->presence;
+		std::atomic_thread_fence(std::memory_order_acquire);
+		after = data_->presence_generation.load(
+		        std::memory_order_relaxed);
+	} while ((before & 1) != 0 || before != after);
+
+	return before / 2;
+}
+
+void Shared::set_sources(const SourceList &sources)
+{
+	if (data_ == nullptr || attached_)
+		return;
+
+	data_->sources_generation.fetch_add(1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	data_->sources = sources;
+	data_->sources_generation.fetch_add(1, std::memory_order_release);
+}
+
+uint64_t Shared::get_sources(SourceList *sources)
+{
+	if (data_ == nullptr)
+		return 0;
+
+	uint64_t before, after;
+	do {
+		before = data_->sources_generation.load(
+		        std::memory_order_acquire);
+		*sources = data_->sources;
+		std::atomic_thread_fence(std::memory_order_acquire);
+		after = data_->sources_generation.load(
+		        std::memory_order_relaxed);
+	} while ((before & 1) != 0 || before != after);
+
+	return before / 2;
+}
+
 
 } // namespace lm
@@ -1,11 +1,14 @@
 #ifndef _LIBPROCESS_SHARED_H_
 #define _LIBPROCESS_SHARED_H_
 
+#include <cstdint>
+
 #include <atomic>
 #include <chrono>
 #include <vector>
 
 #include "geometry.hpp"
+#include "latency.hpp"
 
 namespace lm {
 
@@ -17,11 +20,13 @@ namespace lm {
 #define MD_SENSOR_COUNT                 (3)
 #define MD_AXIS_COUNT                   (3)
 #define MD_CIRCLE_COUNT                 (3)
+#define MD_SOURCE_COUNT                 (4)
 
 
 struct MagnetoData
 {
 	bool valid;
+	uint64_t sequence;
 
 	Point sensor[MD_SENSOR_COUNT];
 	Point poi;
@@ -30,27 +35,113 @@ struct MagnetoData
 	double magnitude[MD_SENSOR_COUNT];
 
 	bool source_present;
+	uint32_t saturated;             // bit per sensor, result is degraded
+	bool reused;                    // result of earlier frame, see reuse_band
+	bool tracked;                   // result of particle tracker
 
 	Circle circle[MD_CIRCLE_COUNT];
 	Point solution[2 * MD_CIRCLE_COUNT];
 
 	Point result;
+
+	// 3D fix, see PipelineConfig::dipole_budget
+	bool has_z;
+	double z;                       // above sensor plane [cm]
+	double moment[3];               // of dipole [field units * cm^3]
+
+	// quality of result
+	double spread;                  // rms distance of cluster [cm]
+	double conditioning;            // 1 perpendicular .. 0 tangent circles
+	double margin;                  // weakest magnitude / exit treshold
+	double covariance[3];           // xx, xy, yy [cm^2], 0 if unknown
+
 	std::chrono::steady_clock::time_point timestamp;
+	uint64_t time; // wall clock [ns since epoch]
+
+	uint64_t stamp[LP_COUNT];
 
 public:
 	MagnetoData();
 	MagnetoData(const MagnetoData &other);
 
 	void set_valid(const bool v = true);
+	void set_sequence(const uint64_t seq);
 	void set_sensors(const PointVector &s);
 	void set_poi(const Point& p);
 	void set_input(const std::vector<double> &in);
 	void set_magnitudes(const std::vector<double> &m);
 	void set_source_present(const bool present = true);
+	void set_saturated(const uint32_t mask);
+	void set_reused(const bool r = true);
+	void set_tracked(const bool t = true);
 	void set_circles(const CircleVector &c);
 	void set_solutions(const PointVector &s);
 	void set_result(const Point &r);
+	void set_dipole(const double height, const double m[3]);
+	void set_quality(const double s, const double cond, const double m,
+	                 const double cov[3]);
 	void set_timestamp();
+	void set_stamp(const LatencyPoint p);
+	void set_stamp(const LatencyPoint p, const uint64_t ns);
+};
+
+
+//!
+//! Hard and soft iron correction of one sensor,
+//! corrected = matrix * (raw - offset). Default is identity.
+//!
+struct IronCorrection
+{
+	double offset[MD_AXIS_COUNT];
+	double matrix[MD_AXIS_COUNT * MD_AXIS_COUNT];   // row major
+	uint64_t samples;               // samples of the fit, 0 for identity
+	double residual;                // rms algebraic residual of the fit
+
+	IronCorrection();
+};
+
+
+//!
+//! Last transition of source presence, see PresenceDetector.
+//!
+struct PresenceState
+{
+	bool present;
+	uint64_t sequence;              // frame of the transition
+	uint64_t time;                  // wall clock [ns since epoch]
+
+	PresenceState();
+};
+
+
+//!
+//! Magnet followed by SourceTracker. Id is kept for the life of the track,
+//! a track without fit coasts at its last position until it dies.
+//!
+struct SourceState
+{
+	uint32_t id;
+	double position[3];             // x, y [cm], z above sensor plane
+	double moment[3];               // of dipole [field units * cm^3]
+	uint32_t age;                   // frames since birth
+	uint32_t missed;                // frames since last fit
+
+	SourceState();
+};
+
+
+//!
+//! Confirmed tracks of one frame, see PipelineConfig::sources_budget.
+//!
+struct SourceList
+{
+	uint64_t sequence;              // frame of the list
+	uint32_t count;
+	bool degraded;                  // budget ran out, tracks may coast,
+	                                // or field is left unexplained
+	SourceState source[MD_SOURCE_COUNT];
+
+	SourceList();
 };
 
 
@@ -60,6 +151,32 @@ enum ConnectionState {
 };
 
 
+//!
+//! Counters kept in the stats region of the shared segment.
+//! Counters ending with _NS accumulate time spent in a stage.
+//!
+enum StatCounter {
+	STAT_FRAMES_IN = 0,
+	STAT_PARSE_ERRORS,
+	STAT_SATURATED,
+	STAT_DEGRADED,
+	STAT_REUSED,
+	STAT_TRACKED,
+	STAT_SOURCE_ABSENT,
+	STAT_MISSING_SOLUTIONS,
+	STAT_TRIANGLE_FAILED,
+	STAT_PROCESS_ERRORS,
+	STAT_SOURCE_ENTER,
+	STAT_SOURCE_EXIT,
+	STAT_PUBLISHED,
+	STAT_PARSE_NS,
+	STAT_SOLVE_NS,
+	STAT_PUBLISH_NS,
+
+	STAT_COUNT
+};
+
+
 class Shared
 {
 	struct ShmData {
@@ -68,6 +185,23 @@ class Shared
 		std::atomic<int> visualize;
 
 		MagnetoData data;
+		// read only attachments sequence lock it, see iron below
+		std::atomic<uint64_t> data_generation;
+
+		// separate cache line, counters are updated on every frame
+		alignas(64) std::atomic<uint64_t> stats[STAT_COUNT];
+
+		// sequence locked by generation, odd while being written
+		IronCorrection iron[MD_SENSOR_COUNT];
+		std::atomic<uint64_t> iron_generation;
+
+		// sequence locked the same way
+		PresenceState presence;
+		std::atomic<uint64_t> presence_generation;
+
+		// sequence locked the same way
+		SourceList sources;
+		std::atomic<uint64_t> sources_generation;
 
 		ShmData();
 	};
@@ -78,6 +212,7 @@ class Shared
 //
 	int fd_;
 	ShmData* data_;
+	bool attached_;
 
 public:
 
@@ -85,6 +220,7 @@ public:
 	~Shared();
 
 	int init();
+	int attach();
 	int unlink();
 
 	void set_process_state(const ConnectionState& state);
@@ -94,6 +230,21 @@ public:
 
 	void set_data(const MagnetoData &data);
 	MagnetoData get_data();
+
+	void count(const StatCounter c, const uint64_t n = 1);
+	uint64_t get_count(const StatCounter c) const;
+
+	void set_iron(const IronCorrection iron[MD_SENSOR_COUNT]);
+	/** \brief Copies corrections out, returns their generation. */
+	uint64_t get_iron(IronCorrection iron[MD_SENSOR_COUNT]);
+
+	void set_presence(const PresenceState &presence);
+	/** \brief Copies last transition out, returns count of transitions. */
+	uint64_t get_presence(PresenceState *presence);
+
+	void set_sources(const SourceList &sources);
+	/** \brief Copies sources out, returns count of updates. */
+	uint64_t get_sources(SourceList *sources);
 };
 
 
@@ -0,0 +1,599 @@
+//------------------------------------------------------------------------------
+// The MIT License (MIT)
+//
+// Copyright (c) 2015 Lukáš Mandák <lukas.mandak@yandex.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//
+// sink.cpp
+//
+//
+//
+//------------------------------------------------------------------------------
+#include "sink.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "geometry.hpp"
+#include "record.hpp"
+#include "shared.hpp"
+
+
+namespace lm {
+
+
+namespace {
+
+
+//!
+//! Writer thread wakes up at least this often even if nobody notifies it.
+//!
+const std::chrono::milliseconds kWriterIdleWait(100);
+
+//!
+//! Enough for one frame formatted by format_json().
+//!
+const size_t kJsonLength = 768;
+
+
+int format_json(const MagnetoData &data, char *buf, const size_t size)
+{
+	char z[32] = "null";
+	if (data.has_z)
+		snprintf(z, sizeof (z), "%.4f", data.z);
+
+	const int n = snprintf(buf, size, "{\"sequence\":%llu,\"time\":%llu,"
+	        "\"result\":[%.4f,%.4f],\"magnitude\":[%.3f,%.3f,%.3f],"
+	        "\"circles\":[[%.4f,%.4f,%.4f],[%.4f,%.4f,%.4f],"
+	        "[%.4f,%.4f,%.4f]],\"spread\":%.4f,\"conditioning\":%.4f,"
+	        "\"margin\":%.3f,\"covariance\":[%.4g,%.4g,%.4g],"
+	        "\"saturated\":%u,\"reused\":%s,\"tracked\":%s,\"z\":%s}",
+	        (unsigned long long) data.sequence,
+	        (unsigned long long) data.time,
+	        data.result.x, data.result.y,
+	        data.magnitude[0], data.magnitude[1], data.magnitude[2],
+	        data.circle[0].center().x, data.circle[0].center().y,
+	        data.circle[0].radius(),
+	        data.circle[1].center().x, data.circle[1].center().y,
+	        data.circle[1].radius(),
+	        data.circle[2].center().x, data.circle[2].center().y,
+	        data.circle[2].radius(),
+	        data.spread, data.conditioning, data.margin,
+	        data.covariance[0], data.covariance[1], data.covariance[2],
+	        (unsigned) data.saturated, data.reused ? "true" : "false",
+	        data.tracked ? "true" : "false", z);
+
+	return (n < 0 || (size_t) n >= size) ? -1 : n;
+}
+
+
+} // namespace
+
+
+// Sink
+Sink::~Sink()
+{
+
+}
+
+void Sink::flush()
+{
+
+}
+
+// TextSink
+TextSink::TextSink(FILE *out) :
+	out_(out)
+{
+
+}
+
+int TextSink::write(const MagnetoData &data)
+{
+	const double angle = angle_deg(data.result, data.poi);
+	const double dist = lm::dist(data.result, data.poi);
+
+	if (fprintf(out_, "%llu\t%.2lf\t%.2lf\t\t%.2lf\t%.2lf°\t\n",
+	            (unsigned long long) data.sequence,
+	            data.result.x, data.result.y, dist, angle) < 0)
+		return -1;
+
+	return 0;
+}
+
+void TextSink::flush()
+{
+	fflush(out_);
+}
+
+// FileSink
+FileSink::FileSink() :
+	file_(nullptr)
+{
+
+}
+
+FileSink::~FileSink()
+{
+	if (file_ != nullptr)
+		fclose(file_);
+}
+
+int FileSink::open(const std::string &path, const char *mode)
+{
+	file_ = fopen(path.c_str(), mode);
+	if (file_ == nullptr) {
+		fprintf(stderr, "Unable to open %s: %s\n", path.c_str(),
+		        strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+void FileSink::flush()
+{
+	if (file_ != nullptr)
+		fflush(file_);
+}
+
+// CsvSink
+int CsvSink::open(const std::string &path)
+{
+	if (FileSink::open(path, "w") != 0)
+		return -1;
+
+	fprintf(file_, "sequence,time,x,y,dist,angle,m0,m1,m2,"
+	        "spread,conditioning,margin,cxx,cxy,cyy,saturated,reused,"
+	        "tracked,z\n");
+	return 0;
+}
+
+int CsvSink::write(const MagnetoData &data)
+{
+	char z[32] = "";
+	if (data.has_z)
+		snprintf(z, sizeof (z), "%.4f", data.z);
+
+	if (fprintf(file_, "%llu,%llu,%.4f,%.4f,%.4f,%.4f,%.3f,%.3f,%.3f,"
+	            "%.4f,%.4f,%.3f,%.4g,%.4g,%.4g,%u,%d,%d,%s\n",
+	            (unsigned long long) data.sequence,
+	            (unsigned long long) data.time,
+	            data.result.x, data.result.y,
+	            dist(data.result, data.poi),
+	            angle_deg(data.result, data.poi),
+	            data.magnitude[0], data.magnitude[1],
+	            data.magnitude[2], data.spread, data.conditioning,
+	            data.margin, data.covariance[0], data.covariance[1],
+	            data.covariance[2], (unsigned) data.saturated,
+	            data.reused ? 1 : 0, data.tracked ? 1 : 0, z) < 0)
+		return -1;
+
+	return 0;
+}
+
+// JsonSink
+int JsonSink::open(const std::string &path)
+{
+	return FileSink::open(path, "w");
+}
+
+int JsonSink::write(const MagnetoData &data)
+{
+	char buf[kJsonLength];
+	if (format_json(data, buf, sizeof (buf)) < 0)
+		return -1;
+
+	if (fprintf(file_, "%s\n", buf) < 0)
+		return -1;
+
+	return 0;
+}
+
+// BinarySink
+int BinarySink::open(const std::string &path)
+{
+	return FileSink::open(path, "wb");
+}
+
+int BinarySink::write(const MagnetoData &data)
+{
+	const Record r = make_record(data);
+	if (fwrite(&r, sizeof (r), 1, file_) != 1)
+		return -1;
+
+	return 0;
+}
+
+// SharedSink
+SharedSink::SharedSink(Shared &shared) :
+	shared_(shared)
+{
+
+}
+
+int SharedSink::write(const MagnetoData &data)
+{
+	if (shared_.is_visualize_connected())
+		shared_.set_data(data);
+
+	return 0;
+}
+
+// PublisherSink
+PublisherSink::PublisherSink() :
+	publisher_(),
+	name_("unix")
+{
+
+}
+
+int PublisherSink::open_unix(const std::string &path)
+{
+	name_ = "unix";
+	return publisher_.open_unix(path);
+}
+
+int PublisherSink::open_multicast(const std::string &spec)
+{
+	std::string group, iface;
+	int port;
+
+	if (parse_multicast_spec(spec, &group, &port, &iface) != 0)
+		return -1;
+
+	name_ = "mcast";
+	return publisher_.open_multicast(group, port, iface);
+}
+
+int PublisherSink::write(const MagnetoData &data)
+{
+	return publisher_.publish(make_record(data));
+}
+
+void PublisherSink::flush()
+{
+	publisher_.flush();
+}
+
+// HttpSink
+int HttpSink::open(const std::string &spec)
+{
+	std::string addr;
+	int port;
+
+	if (parse_http_spec(spec, &addr, &port) != 0)
+		return -1;
+
+	return server_.open(addr, port);
+}
+
+int HttpSink::write(const MagnetoData &data)
+{
+	char buf[kJsonLength];
+	if (format_json(data, buf, sizeof (buf)) < 0)
+		return -1;
+
+	server_.publish(buf);
+	return 0;
+}
+
+// StoreSink
+int StoreSink::open(const std::string &dir)
+{
+	return writer_.open(dir);
+}
+
+int StoreSink::write(const MagnetoData &data)
+{
+	return writer_.append(make_record(data));
+}
+
+void StoreSink::flush()
+{
+	writer_.sync();
+}
+
+
+Sink* make_sink(const std::string &spec, Shared &shared,
+                BackpressurePolicy *policy)
+{
+	std::string type = spec;
+	std::string path;
+
+	*policy = BP_DROP_OLDEST;
+
+	const auto at = type.find('@');
+	if (at != std::string::npos) {
+		const std::string p = type.substr(at + 1);
+		type = type.substr(0, at);
+
+		if (p == "drop-oldest") {
+			*policy = BP_DROP_OLDEST;
+		} else if (p == "drop-newest") {
+			*policy = BP_DROP_NEWEST;
+		} else if (p == "block") {
+			*policy = BP_BLOCK;
+		} else {
+			fprintf(stderr, "Unknown backpressure policy: %s\n",
+			        p.c_str());
+			return nullptr;
+		}
+	}
+
+	const auto colon = type.find(':');
+	if (colon != std::string::npos) {
+		path = type.substr(colon + 1);
+		type = type.substr(0, colon);
+	}
+
+	if (type == "text")
+		return new TextSink(stdout);
+
+	if (type == "shm")
+		return new SharedSink(shared);
+
+	if (path.empty()) {
+		fprintf(stderr, "Sink %s requires path.\n", type.c_str());
+		return nullptr;
+	}
+
+	if (type == "http") {
+		HttpSink *s = new HttpSink();
+		if (s->open(path) != 0) {
+			delete s;
+			return nullptr;
+		}
+		return s;
+	}
+
+	if (type == "unix" || type == "mcast") {
+		PublisherSink *s = new PublisherSink();
+		const int status = (type == "unix") ? s->open_unix(path)
+		                                    : s->open_multicast(path);
+		if (status != 0) {
+			delete s;
+			return nullptr;
+		}
+		return s;
+	}
+
+	Sink *sink = nullptr;
+	int status = -1;
+	if (type == "csv") {
+		CsvSink *s = new CsvSink();
+		status = s->open(path);
+		sink = s;
+	} else if (type == "json") {
+		JsonSink *s = new JsonSink();
+		status = s->open(path);
+		sink = s;
+	} else if (type == "bin") {
+		BinarySink *s = new BinarySink();
+		status = s->open(path);
+		sink = s;
+	} else if (type == "store") {
+		StoreSink *s = new StoreSink();
+		status = s->open(path);
+		sink = s;
+	} else {
+		fprintf(stderr, "Unknown sink type: %s\n", type.c_str());
+		return nullptr;
+	}
+
+	if (status != 0) {
+		delete sink;
+		return nullptr;
+	}
+
+	return sink;
+}
+
+
+// SinkWriter
+SinkWriter::Entry::Entry(Sink *sink, const BackpressurePolicy policy,
+                         const size_t capacity) :
+	sink(sink),
+	policy(policy),
+	queue(capacity),
+	written(0),
+	dropped(0),
+	failed(0),
+	thread(),
+	mutex(),
+	wakeup(),
+	sleeping(false)
+{
+
+}
+
+SinkWriter::SinkWriter() :
+	entries_(),
+	running_(false)
+{
+
+}
+
+SinkWriter::~SinkWriter()
+{
+	stop();
+
+	for (auto e : entries_) {
+		delete e->sink;
+		delete e;
+	}
+}
+
+int SinkWriter::add(Sink *sink, const BackpressurePolicy policy,
+                    const size_t capacity)
+{
+	if (sink == nullptr)
+		return -1;
+
+	if (running_.load()) {
+		fprintf(stderr, "Unable to add sink to running writer.\n");
+		return -1;
+	}
+
+	entries_.push_back(new Entry(sink, policy, capacity));
+	return 0;
+}
+
+int SinkWriter::start()
+{
+	if (running_.load())
+		return 0;
+
+	running_.store(true);
+	for (auto e : entries_)
+		e->thread = std::thread(&SinkWriter::run, this, e);
+
+	return 0;
+}
+
+void SinkWriter::stop()
+{
+	if (!running_.exchange(false))
+		return;
+
+	for (auto e : entries_) {
+		wake(e);
+		e->thread.join();
+
+		//
+		// Write whatever was left in queue.
+		//
+		drain(e);
+	}
+}
+
+void SinkWriter::publish(const MagnetoData &data)
+{
+	for (auto e : entries_) {
+		if (!e->queue.push(data)) {
+			switch (e->policy) {
+			case BP_DROP_NEWEST:
+				e->dropped.fetch_add(1, std::memory_order_relaxed);
+				continue;
+
+			case BP_DROP_OLDEST:
+				//
+				// Queue is multi-consumer, so producer may take
+				// the oldest entry itself.
+				//
+				do {
+					if (e->queue.pop(nullptr))
+						e->dropped.fetch_add(1,
+						        std::memory_order_relaxed);
+				} while (!e->queue.push(data));
+				break;
+
+			case BP_BLOCK:
+				while (!e->queue.push(data)) {
+					if (!running_.load()) {
+						e->dropped.fetch_add(1,
+						        std::memory_order_relaxed);
+						break;
+					}
+					wake(e);
+					std::this_thread::yield();
+				}
+				break;
+			}
+		}
+
+		//
+		// Pairs with the fence in run(), either writer sees new data
+		// or we see it going to sleep.
+		//
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (e->sleeping.load(std::memory_order_relaxed))
+			wake(e);
+	}
+}
+
+void SinkWriter::print_stats(FILE *out) const
+{
+	for (auto e : entries_) {
+		fprintf(out, "Sink %-5s written %llu dropped %llu failed %llu\n",
+		        e->sink->name(),
+		        (unsigned long long) e->written.load(),
+		        (unsigned long long) e->dropped.load(),
+		        (unsigned long long) e->failed.load());
+	}
+}
+
+void SinkWriter::run(Entry *e)
+{
+	while (running_.load()) {
+		if (drain(e))
+			continue;
+
+		std::unique_lock<std::mutex> lock(e->mutex);
+		e->sleeping.store(true, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		if (e->queue.empty() && running_.load())
+			e->wakeup.wait_for(lock, kWriterIdleWait);
+
+		e->sleeping.store(false, std::memory_order_relaxed);
+	}
+}
+
+bool SinkWriter::drain(Entry *e)
+{
+	MagnetoData data;
+	bool written = false;
+
+	while (e->queue.pop(&data)) {
+		if (e->sink->write(data) == 0)
+			e->written.fetch_add(1, std::memory_order_relaxed);
+		else
+			e->failed.fetch_add(1, std::memory_order_relaxed);
+		written = true;
+	}
+
+	if (written)
+		e->sink->flush();
+
+	return written;
+}
+
+void SinkWriter::wake(Entry *e)
+{
+	//
+	// Taking the mutex orders us after writer's re-check of the queue.
+	//
+	{
+		std::lock_guard<std::mutex> lock(e->mutex);
+	}
+	e->wakeup.notify_one();
+}
+
+
+} // namespace lm
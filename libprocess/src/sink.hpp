@@ -0,0 +1,256 @@
+//------------------------------------------------------------------------------
+// The MIT License (MIT)
+//
+// Copyright (c) 2015 Lukáš Mandák <lukas.mandak@yandex.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//
+// sink.hpp
+//
+// Output sinks for processed frames. The solver thread hands frames to
+// SinkWriter, which queues them per sink and lets a background thread of
+// each sink do the actual (possibly slow) writing.
+//
+//------------------------------------------------------------------------------
+#ifndef _LIBPROCESS_SINK_H_
+#define _LIBPROCESS_SINK_H_
+
+#include <cstdint>
+#include <cstdio>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "http.hpp"
+#include "publish.hpp"
+#include "queue.hpp"
+#include "shared.hpp"
+#include "store.hpp"
+
+
+namespace lm {
+
+
+//!
+//! What to do when queue of a sink is full.
+//!
+enum BackpressurePolicy {
+	BP_DROP_OLDEST = 0,
+	BP_DROP_NEWEST,
+	BP_BLOCK
+};
+
+
+class Sink
+{
+public:
+	virtual ~Sink();
+
+	virtual const char* name() const = 0;
+	virtual int write(const MagnetoData &data) = 0;
+	virtual void flush();
+};
+
+
+/** \brief Tab separated text, same format process always printed. */
+class TextSink : public Sink
+{
+	FILE *out_;
+
+public:
+	TextSink(FILE *out);
+
+	const char* name() const { return "text"; }
+	int write(const MagnetoData &data);
+	void flush();
+};
+
+
+//!
+//! Base of sinks writing into a file opened by the sink itself.
+//!
+class FileSink : public Sink
+{
+protected:
+	FILE *file_;
+
+public:
+	FileSink();
+	~FileSink();
+
+	int open(const std::string &path, const char *mode);
+	void flush();
+};
+
+
+class CsvSink : public FileSink
+{
+public:
+	int open(const std::string &path);
+
+	const char* name() const { return "csv"; }
+	int write(const MagnetoData &data);
+};
+
+
+class JsonSink : public FileSink
+{
+public:
+	int open(const std::string &path);
+
+	const char* name() const { return "json"; }
+	int write(const MagnetoData &data);
+};
+
+
+/** \brief Sequence of lm::Record structures. */
+class BinarySink : public FileSink
+{
+public:
+	int open(const std::string &path);
+
+	const char* name() const { return "bin"; }
+	int write(const MagnetoData &data);
+};
+
+
+/** \brief Publishes frames to shared memory while visualize is connected. */
+class SharedSink : public Sink
+{
+	Shared &shared_;
+
+public:
+	SharedSink(Shared &shared);
+
+	const char* name() const { return "shm"; }
+	int write(const MagnetoData &data);
+};
+
+
+//!
+//! Streams records to local subscribers. Records written in one batch
+//! of the writer thread share datagrams.
+//!
+class PublisherSink : public Sink
+{
+	Publisher publisher_;
+	const char *name_;
+
+public:
+	PublisherSink();
+
+	int open_unix(const std::string &path);
+	int open_multicast(const std::string &spec);
+
+	const char* name() const { return name_; }
+	int write(const MagnetoData &data);
+	void flush();
+};
+
+
+/** \brief Serves frames as Server-Sent Events to browsers. */
+class HttpSink : public Sink
+{
+	HttpServer server_;
+
+public:
+	int open(const std::string &spec);
+
+	const char* name() const { return "http"; }
+	int write(const MagnetoData &data);
+};
+
+
+/** \brief Appends frames to memory mapped history store. */
+class StoreSink : public Sink
+{
+	StoreWriter writer_;
+
+public:
+	int open(const std::string &dir);
+
+	const char* name() const { return "store"; }
+	int write(const MagnetoData &data);
+	void flush();
+};
+
+
+//!
+//! Creates sink from specification "<type>[:<path>][@<policy>]".
+//! Types: text, csv, json, bin, shm, unix, mcast, http, store. Policies: drop-oldest, drop-newest,
+//! block. Returns nullptr on error.
+//!
+Sink* make_sink(const std::string &spec, Shared &shared,
+                BackpressurePolicy *policy);
+
+
+class SinkWriter
+{
+	struct Entry {
+		Sink *sink;
+		BackpressurePolicy policy;
+		BoundedQueue<MagnetoData> queue;
+		std::atomic<uint64_t> written;
+		std::atomic<uint64_t> dropped;
+		std::atomic<uint64_t> failed;
+
+		std::thread thread;
+		std::mutex mutex;
+		std::condition_variable wakeup;
+		std::atomic<bool> sleeping;
+
+		Entry(Sink *sink, const BackpressurePolicy policy,
+		      const size_t capacity);
+	};
+
+	std::vector<Entry*> entries_;
+	std::atomic<bool> running_;
+
+public:
+	SinkWriter();
+	~SinkWriter();
+
+	/** \brief Takes ownership of the sink. Must be called before start(). */
+	int add(Sink *sink, const BackpressurePolicy policy,
+	        const size_t capacity);
+
+	int start();
+	void stop();
+
+	void publish(const MagnetoData &data);
+
+	size_t get_sink_cnt() const { return entries_.size(); }
+	void print_stats(FILE *out) const;
+
+private:
+	void run(Entry *e);
+	static bool drain(Entry *e);
+	static void wake(Entry *e);
+};
+
+
+} // namespace lm
+
+
+#endif // _LIBPROCESS_SINK_H_
@@ -0,0 +1,413 @@
+//------------------------------------------------------------------------------
+// The MIT License (MIT)
+//
+// Copyright (c) 2015 Lukáš Mandák <lukas.mandak@yandex.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//
+// sources.cpp
+//
+//
+//
+//------------------------------------------------------------------------------
+#include "sources.hpp"
+
+#include <cmath>
+#include <cstdint>
+
+#include <algorithm>
+#include <vector>
+
+#include "geometry.hpp"
+#include "latency.hpp"
+#include "shared.hpp"
+#include "trace.hpp"
+
+
+namespace lm {
+
+
+namespace {
+
+
+/** \brief Frames a new track is fitted before it is published. */
+const uint32_t kConfirm = 3;
+
+/** \brief Frames a track coasts without fit before it dies. */
+const uint32_t kMaxMissed = 10;
+
+//!
+//! Fit with one more source gives birth only if it lowers the cost
+//! below this fraction.
+//!
+const double kBirthGain = 0.25;
+
+//!
+//! Fraction of the field of a sensor fitted sources may leave
+//! unexplained, dipole is only a model of the magnet.
+//!
+const double kModelError = 0.1;
+
+
+double distance3(const double a[3], const double b[3])
+{
+	const double d[3] = { a[0] - b[0], a[1] - b[1], a[2] - b[2] };
+	return std::sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+}
+
+
+} // namespace
+
+
+// SourceTracker
+SourceTracker::SourceTracker(const size_t max_sources, const double height,
+                             const double range, const double gate,
+                             const double enter, const double exit) :
+	solver_(std::min<size_t>(max_sources, MD_SOURCE_COUNT)),
+	sensors_(),
+	center_(),
+	max_sources_(std::min<size_t>(max_sources, MD_SOURCE_COUNT)),
+	height_(height),
+	range_(range),
+	gate_(gate),
+	enter_(enter),
+	exit_(exit),
+	tracks_(),
+	next_id_(1),
+	deferred_(false),
+	list_(),
+	position_(),
+	moment_(),
+	residual_()
+{
+
+}
+
+int SourceTracker::initialize(const PointVector &sensors)
+{
+	if (solver_.initialize(sensors) != 0)
+		return -1;
+
+	sensors_ = sensors;
+	center_ = Point();
+	for (const auto &s : sensors)
+		center_ += s;
+	center_ = (1.0 / sensors.size()) * center_;
+	tracks_.clear();
+	tracks_.reserve(max_sources_ + 1);
+	deferred_ = false;
+	list_ = SourceList();
+	position_.assign(3 * max_sources_, 0.0);
+	moment_.assign(3 * max_sources_, 0.0);
+	birth_position_.assign(3 * max_sources_, 0.0);
+	birth_moment_.assign(3 * max_sources_, 0.0);
+	residual_.assign(3 * sensors.size(), 0.0);
+
+	return 0;
+}
+
+int SourceTracker::update(const std::vector<double> &field,
+                          const uint32_t excluded, const uint64_t sequence,
+                          const uint64_t deadline)
+{
+	LM_TRACE("SourceTracker::update");
+
+	const uint64_t start = monotonic_ns();
+	if (field.size() != 3 * sensors_.size())
+		return -1;
+
+	//
+	// Every source adds six unknowns, sensors must give more values.
+	//
+	size_t active = 0;
+	double cost = 0.0;
+	for (size_t s = 0; s < sensors_.size(); ++s) {
+		if ((excluded & (1u << s)) != 0)
+			continue;
+		++active;
+		for (int j = 0; j < 3; ++j)
+			cost += field[3 * s + j] * field[3 * s + j];
+	}
+	const size_t cap = std::min(max_sources_,
+	                            (active > 0) ? (3 * active - 1) / 6 : 0);
+
+	//
+	// Oldest tracks are fitted, the ones over cap coast.
+	//
+	for (auto &t : tracks_)
+		++t.age;
+	std::stable_sort(tracks_.begin(), tracks_.end(),
+	        [](const SourceState &a, const SourceState &b) {
+	                return a.age > b.age;
+	        });
+
+	const size_t before = tracks_.size();
+	const size_t count = std::min(before, cap);
+	for (size_t k = 0; k < count; ++k)
+		std::copy(tracks_[k].position, tracks_[k].position + 3,
+		          &position_[3 * k]);
+
+	//
+	// Birth deferred from the last frame gets the whole budget, tracks
+	// only have their moments solved where they are.
+	//
+	int ret = 0;
+	if (count > 0 && !deferred_) {
+		ret = solver_.solve(field, excluded, count, deadline,
+		                    position_.data(), moment_.data(), &cost);
+	} else if (count > 0) {
+		cost = solver_.fit_moments(field, excluded, count,
+		                           position_.data(), moment_.data());
+		ret = std::isfinite(cost) ? 0 : -1;
+	}
+	deferred_ = false;
+
+	//
+	// Field left unexplained comes from a new source. Birth is tried
+	// from where the tracks were, it fits one source more, so only
+	// while at least the time spent so far is left, otherwise it is
+	// deferred. Without birth the fit of the tracks is kept, flagged
+	// degraded when the new source could not be tried. Fit stopped by
+	// the deadline is kept too, next frame goes on from it.
+	//
+	bool degraded = (ret == 1);
+	bool born = false;
+	const size_t seed = (ret == 0)
+	        ? unexplained(field, (count > 0) ? solver_.get_residual()
+	                                         : field, excluded)
+	        : sensors_.size();
+	if (seed != sensors_.size()) {
+		const uint64_t now = monotonic_ns();
+		if (before < cap && now < deadline &&
+		    now - start <= deadline - now) {
+			born = birth(field, excluded, seed, cost, deadline);
+		} else {
+			deferred_ = (before < cap);
+			degraded = true;
+		}
+	}
+	if (ret >= 0 && !born)
+		associate(count, excluded);
+	for (size_t k = (ret >= 0) ? count : 0; k < before; ++k)
+		++tracks_[k].missed;
+
+	//
+	// Two tracks on one source are one too many, the younger dies.
+	// Tentative tracks die on their first miss.
+	//
+	for (size_t i = 0; i < tracks_.size(); ++i)
+		for (size_t j = i + 1; j < tracks_.size(); ++j)
+			if (distance3(tracks_[i].position,
+			              tracks_[j].position) < gate_)
+				tracks_[j].missed = kMaxMissed + 1;
+	tracks_.erase(std::remove_if(tracks_.begin(), tracks_.end(),
+	        [](const SourceState &t) {
+	                return t.missed > kMaxMissed ||
+	                       (t.age < kConfirm && t.missed > 0);
+	        }), tracks_.end());
+
+	publish(sequence, degraded);
+	return degraded ? 1 : 0;
+}
+
+void SourceTracker::associate(const size_t count, const uint32_t excluded)
+{
+	//
+	// Fits are matched with the tracks they started from, nearest pairs
+	// first, so sources swapped by the fit keep their ids. Track whose
+	// fit moved farther than gate or is not valid coasts.
+	//
+	bool track_used[MD_SOURCE_COUNT] = { false };
+	bool fit_used[MD_SOURCE_COUNT] = { false };
+	for (size_t n = 0; n < count; ++n) {
+		size_t ti = count;
+		size_t fi = count;
+		double best = gate_;
+		for (size_t i = 0; i < count; ++i) {
+			if (track_used[i])
+				continue;
+			for (size_t j = 0; j < count; ++j) {
+				if (fit_used[j])
+					continue;
+				const double d = distance3(tracks_[i].position,
+				                           &position_[3 * j]);
+				if (d < best) {
+					best = d;
+					ti = i;
+					fi = j;
+				}
+			}
+		}
+		if (ti == count)
+			break;
+
+		track_used[ti] = fit_used[fi] = true;
+		SourceState &t = tracks_[ti];
+		if (!is_valid(&position_[3 * fi], &moment_[3 * fi], excluded)) {
+			++t.missed;
+			continue;
+		}
+		std::copy(&position_[3 * fi], &position_[3 * fi] + 3,
+		          t.position);
+		std::copy(&moment_[3 * fi], &moment_[3 * fi] + 3, t.moment);
+		t.missed = 0;
+	}
+
+	for (size_t i = 0; i < count; ++i)
+		if (!track_used[i])
+			++tracks_[i].missed;
+}
+
+size_t SourceTracker::unexplained(const std::vector<double> &field,
+                                  const std::vector<double> &residual,
+                                  const uint32_t excluded) const
+{
+	//
+	// Residual has to exceed enter and error of the model, which grows
+	// with the field.
+	//
+	size_t seed = sensors_.size();
+	double best = 0.0;
+	for (size_t s = 0; s < sensors_.size(); ++s) {
+		if ((excluded & (1u << s)) != 0)
+			continue;
+		const double *f = &field[3 * s];
+		const double *r = &residual[3 * s];
+		const double excess = r[0] * r[0] + r[1] * r[1] + r[2] * r[2]
+		        - enter_ * enter_ - kModelError * kModelError
+		        * (f[0] * f[0] + f[1] * f[1] + f[2] * f[2]);
+		if (excess > best) {
+			best = excess;
+			seed = s;
+		}
+	}
+
+	return seed;
+}
+
+bool SourceTracker::birth(const std::vector<double> &field,
+                          const uint32_t excluded, const size_t seed,
+                          const double cost, const uint64_t deadline)
+{
+	//
+	// New source is fitted alone to the field left unexplained first,
+	// starting above the sensor that sees most of it, for at most
+	// a third of the time left. Joint fit of all sources then needs
+	// few of its costly iterations. Its new source is tentative, so
+	// a joint fit stopped by the deadline is good enough.
+	//
+	const size_t k = tracks_.size();
+	double *position = birth_position_.data();
+	double *moment = birth_moment_.data();
+	double *p = &position[3 * k];
+	p[0] = sensors_[seed].x;
+	p[1] = sensors_[seed].y;
+	p[2] = height_;
+
+	double c;
+	if (k > 0) {
+		const uint64_t now = monotonic_ns();
+		residual_ = solver_.get_residual();
+		if (now >= deadline ||
+		    solver_.solve(residual_, excluded, 1,
+		                  now + (deadline - now) / 3, p,
+		                  &moment[3 * k], &c) < 0)
+			return false;
+	}
+	for (size_t i = 0; i < k; ++i)
+		std::copy(tracks_[i].position, tracks_[i].position + 3,
+		          &position[3 * i]);
+	if (solver_.solve(field, excluded, k + 1, deadline, position, moment,
+	                  &c) < 0 ||
+	    !(c < kBirthGain * cost))
+		return false;
+
+	//
+	// Fit that moves existing tracks explains the field by other
+	// sources than they follow, and one that puts the new source
+	// onto a track duplicates it.
+	//
+	if (!is_valid(p, &moment[3 * k], excluded))
+		return false;
+	for (size_t i = 0; i < k; ++i) {
+		if (distance3(tracks_[i].position, &position[3 * i]) > gate_ ||
+		    distance3(p, &position[3 * i]) < gate_)
+			return false;
+	}
+
+	for (size_t i = 0; i < k; ++i) {
+		SourceState &t = tracks_[i];
+		std::copy(&position[3 * i], &position[3 * i] + 3, t.position);
+		std::copy(&moment[3 * i], &moment[3 * i] + 3, t.moment);
+		t.missed = 0;
+	}
+
+	SourceState t;
+	t.id = next_id_++;
+	std::copy(p, p + 3, t.position);
+	std::copy(&moment[3 * k], &moment[3 * k] + 3, t.moment);
+	tracks_.push_back(t);
+
+	return true;
+}
+
+bool SourceTracker::is_valid(const double position[3],
+                             const double moment[3],
+                             const uint32_t excluded) const
+{
+	const double dx = position[0] - center_.x;
+	const double dy = position[1] - center_.y;
+	if (dx * dx + dy * dy + position[2] * position[2] > range_ * range_)
+		return false;
+
+	//
+	// Field of dipole at distance r is at least |m| / r^3, source
+	// weaker than exit at the nearest sensor is lost in noise.
+	//
+	double r2 = HUGE_VAL;
+	for (size_t s = 0; s < sensors_.size(); ++s) {
+		if ((excluded & (1u << s)) != 0)
+			continue;
+		const double sx = sensors_[s].x - position[0];
+		const double sy = sensors_[s].y - position[1];
+		r2 = std::min(r2, sx * sx + sy * sy
+		                  + position[2] * position[2]);
+	}
+	const double m = std::sqrt(moment[0] * moment[0]
+	                           + moment[1] * moment[1]
+	                           + moment[2] * moment[2]);
+
+	return m > exit_ * r2 * std::sqrt(r2);
+}
+
+void SourceTracker::publish(const uint64_t sequence, const bool degraded)
+{
+	list_.sequence = sequence;
+	list_.degraded = degraded;
+	list_.count = 0;
+	for (const auto &t : tracks_) {
+		if (t.age < kConfirm || list_.count >= MD_SOURCE_COUNT)
+			continue;
+		list_.source[list_.count++] = t;
+	}
+}
+
+
+} // namespace lm
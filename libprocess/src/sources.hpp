@@ -0,0 +1,120 @@
+//------------------------------------------------------------------------------
+// The MIT License (MIT)
+//
+// Copyright (c) 2015 Lukáš Mandák <lukas.mandak@yandex.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//
+// sources.hpp
+//
+// Tracking of several magnets at once, each is one of the point dipoles
+// fitted by MultiDipoleSolver.
+//
+// SourceTracker keeps a track per magnet. Every frame starts the fit from the
+// tracks, fits are associated back to them and a track that has no fit
+// coasts until it dies. Field left unexplained by the tracks gives birth to
+// a new one when a fit with one more source explains it.
+//
+//------------------------------------------------------------------------------
+#ifndef _LIBPROCESS_SOURCES_H_
+#define _LIBPROCESS_SOURCES_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include <vector>
+
+#include "dipole.hpp"
+#include "geometry.hpp"
+#include "shared.hpp"
+
+
+namespace lm {
+
+
+class SourceTracker
+{
+	MultiDipoleSolver solver_;
+	PointVector sensors_;
+	Point center_;                  // of sensors
+	size_t max_sources_;
+	double height_;
+	double range_;
+	double gate_;
+	double enter_;
+	double exit_;
+
+	std::vector<SourceState> tracks_;
+	uint32_t next_id_;
+	bool deferred_;                 // birth ran out of time
+	SourceList list_;
+
+	// scratch
+	std::vector<double> position_;
+	std::vector<double> moment_;
+	std::vector<double> birth_position_;    // keeps the fit of tracks
+	std::vector<double> birth_moment_;      // when birth fails
+	std::vector<double> residual_;
+
+public:
+	//!
+	//! New sources start height above the sensor that sees most of the
+	//! unexplained field and are born when it exceeds enter. Sources
+	//! farther than range from center of sensors, or weaker than exit at
+	//! the nearest sensor, have no fit, fits farther than gate from their
+	//! track in one frame neither. [cm, field units]
+	//!
+	SourceTracker(const size_t max_sources, const double height,
+	              const double range, const double gate,
+	              const double enter, const double exit);
+
+	int initialize(const PointVector &sensors);
+
+	//!
+	//! Tracks sources of one frame within monotonic deadline [ns].
+	//! Returns 0, 1 when the deadline left some tracks coasting or
+	//! unexplained field could not get a new source, for lack of time
+	//! or sensors, the list is flagged degraded then, and -1 if field
+	//! does not match the sensors.
+	//!
+	int update(const std::vector<double> &field, const uint32_t excluded,
+	           const uint64_t sequence, const uint64_t deadline);
+
+	/** \brief Confirmed tracks of the last update. */
+	inline const SourceList& get_list() const { return list_; }
+
+private:
+	void associate(const size_t count, const uint32_t excluded);
+	size_t unexplained(const std::vector<double> &field,
+	                   const std::vector<double> &residual,
+	                   const uint32_t excluded) const;
+	bool birth(const std::vector<double> &field, const uint32_t excluded,
+	           const size_t seed, const double cost,
+	           const uint64_t deadline);
+	bool is_valid(const double position[3], const double moment[3],
+	              const uint32_t excluded) const;
+	void publish(const uint64_t sequence, const bool degraded);
+};
+
+
+} // namespace lm
+
+
+#endif // _LIBPROCESS_SOURCES_H_
@@ -0,0 +1,454 @@
+//------------------------------------------------------------------------------
+// The MIT License (MIT)
+//
+// Copyright (c) 2015 Lukáš Mandák <lukas.mandak@yandex.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//
+// store.cpp
+//
+//
+//
+//------------------------------------------------------------------------------
+#include "store.hpp"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "record.hpp"
+
+
+namespace lm {
+
+
+namespace {
+
+
+const char kSegmentSuffix[] = ".seg";
+
+
+size_t index_length(const uint64_t capacity)
+{
+	return (capacity + STORE_INDEX_STRIDE - 1) / STORE_INDEX_STRIDE;
+}
+
+size_t records_offset(const uint64_t capacity)
+{
+	const size_t off = sizeof (StoreHeader)
+	                   + index_length(capacity) * sizeof (uint64_t);
+	return (off + 63) & ~(size_t) 63;
+}
+
+std::string segment_path(const std::string &dir, const uint64_t segment_no)
+{
+	char name[32];
+	snprintf(name, sizeof (name), "%010llu%s",
+	         (unsigned long long) segment_no, kSegmentSuffix);
+	return dir + "/" + name;
+}
+
+bool valid_header(const StoreHeader *h, const size_t size)
+{
+	return h->magic == STORE_MAGIC && h->version == STORE_VERSION &&
+	       h->record_size == sizeof (Record) &&
+	       h->index_stride == STORE_INDEX_STRIDE &&
+	       store_segment_size(h->capacity) == size;
+}
+
+//!
+//! Maps whole segment file, returns nullptr on error.
+//!
+char* map_file(const std::string &path, const bool writable, size_t *size)
+{
+	const int fd = ::open(path.c_str(), writable ? O_RDWR : O_RDONLY);
+	if (fd == -1) {
+		fprintf(stderr, "Unable to open %s: %s\n", path.c_str(),
+		        strerror(errno));
+		return nullptr;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof (StoreHeader)) {
+		fprintf(stderr, "Invalid segment %s\n", path.c_str());
+		::close(fd);
+		return nullptr;
+	}
+
+	void *base = mmap(nullptr, st.st_size,
+	                  writable ? PROT_READ | PROT_WRITE : PROT_READ,
+	                  MAP_SHARED, fd, 0);
+	::close(fd);
+	if (base == MAP_FAILED) {
+		fprintf(stderr, "Unable to map %s: %s\n", path.c_str(),
+		        strerror(errno));
+		return nullptr;
+	}
+
+	if (!valid_header((const StoreHeader *) base, st.st_size)) {
+		fprintf(stderr, "Invalid segment %s\n", path.c_str());
+		munmap(base, st.st_size);
+		return nullptr;
+	}
+
+	*size = st.st_size;
+	return (char *) base;
+}
+
+bool time_less(const Record &r, const uint64_t t)
+{
+	return r.time < t;
+}
+
+bool less_time(const uint64_t t, const Record &r)
+{
+	return t < r.time;
+}
+
+
+} // namespace
+
+
+size_t store_segment_size(const uint64_t capacity)
+{
+	return records_offset(capacity) + capacity * sizeof (Record);
+}
+
+int store_list_segments(const std::string &dir,
+                        std::vector<std::string> *paths)
+{
+	DIR *d = opendir(dir.c_str());
+	if (d == nullptr) {
+		fprintf(stderr, "Unable to open %s: %s\n", dir.c_str(),
+		        strerror(errno));
+		return -1;
+	}
+
+	const size_t suffix_len = sizeof (kSegmentSuffix) - 1;
+	std::vector<std::string> names;
+	struct dirent *e;
+	while ((e = readdir(d)) != nullptr) {
+		const std::string name = e->d_name;
+		if (name.size() > suffix_len &&
+		    name.compare(name.size() - suffix_len, suffix_len,
+		                 kSegmentSuffix) == 0)
+			names.push_back(name);
+	}
+	closedir(d);
+
+	//
+	// Zero padded numbers sort by name.
+	//
+	std::sort(names.begin(), names.end());
+
+	paths->clear();
+	for (auto &n : names)
+		paths->push_back(dir + "/" + n);
+
+	return 0;
+}
+
+
+// StoreWriter
+StoreWriter::StoreWriter(const uint64_t capacity) :
+	dir_(),
+	capacity_(capacity),
+	segment_no_(0),
+	base_(nullptr),
+	size_(0),
+	header_(nullptr),
+	index_(nullptr),
+	records_(nullptr),
+	committed_(0),
+	last_time_(0),
+	rejected_(0)
+{
+
+}
+
+StoreWriter::~StoreWriter()
+{
+	close();
+}
+
+int StoreWriter::open(const std::string &dir)
+{
+	if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+		fprintf(stderr, "Unable to create %s: %s\n", dir.c_str(),
+		        strerror(errno));
+		return -1;
+	}
+	dir_ = dir;
+
+	std::vector<std::string> paths;
+	if (store_list_segments(dir_, &paths) != 0)
+		return -1;
+
+	if (paths.empty())
+		return create_segment(0);
+
+	//
+	// Continue in the last segment, segment number is its file name.
+	//
+	const std::string &last = paths.back();
+	segment_no_ = strtoull(last.c_str() + dir_.size() + 1, nullptr, 10);
+	if (map_segment(last) != 0)
+		return -1;
+
+	if (committed_ > 0)
+		last_time_ = records_[committed_ - 1].time;
+
+	if (committed_ == header_->capacity) {
+		unmap_segment();
+		return create_segment(segment_no_ + 1);
+	}
+
+	return 0;
+}
+
+void StoreWriter::close()
+{
+	sync();
+	unmap_segment();
+}
+
+int StoreWriter::append(const Record &record)
+{
+	if (base_ == nullptr)
+		return -1;
+
+	if (record.time < last_time_) {
+		++rejected_;
+		return 0;
+	}
+
+	if (committed_ == header_->capacity) {
+		unmap_segment();
+		if (create_segment(segment_no_ + 1) != 0)
+			return -1;
+	}
+
+	records_[committed_] = record;
+	if (committed_ % STORE_INDEX_STRIDE == 0)
+		index_[committed_ / STORE_INDEX_STRIDE] = record.time;
+
+	++committed_;
+	last_time_ = record.time;
+
+	//
+	// Pairs with acquire in StoreReader::query(), readers see the record
+	// and its index entry before they see it counted.
+	//
+	header_->committed.store(committed_, std::memory_order_release);
+	return 0;
+}
+
+void StoreWriter::sync()
+{
+	if (base_ != nullptr)
+		msync(base_, size_, MS_ASYNC);
+}
+
+int StoreWriter::create_segment(const uint64_t segment_no)
+{
+	const std::string path = segment_path(dir_, segment_no);
+	const std::string tmp = path + ".tmp";
+	const size_t size = store_segment_size(capacity_);
+
+	const int fd = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1) {
+		fprintf(stderr, "Unable to create %s: %s\n", tmp.c_str(),
+		        strerror(errno));
+		return -1;
+	}
+
+	//
+	// Header is written before the file gets its final name, readers
+	// never see uninitialized segment.
+	//
+	StoreHeader header;
+	header.magic = STORE_MAGIC;
+	header.version = STORE_VERSION;
+	header.record_size = sizeof (Record);
+	header.capacity = capacity_;
+	header.index_stride = STORE_INDEX_STRIDE;
+	header.committed.store(0);
+	memset(header.reserved, 0, sizeof (header.reserved));
+
+	if (ftruncate(fd, size) != 0 ||
+	    pwrite(fd, &header, sizeof (header), 0) != sizeof (header)) {
+		fprintf(stderr, "Unable to write %s: %s\n", tmp.c_str(),
+		        strerror(errno));
+		::close(fd);
+		::unlink(tmp.c_str());
+		return -1;
+	}
+	::close(fd);
+
+	if (rename(tmp.c_str(), path.c_str()) != 0) {
+		fprintf(stderr, "Unable to rename %s: %s\n", tmp.c_str(),
+		        strerror(errno));
+		::unlink(tmp.c_str());
+		return -1;
+	}
+
+	segment_no_ = segment_no;
+	return map_segment(path);
+}
+
+int StoreWriter::map_segment(const std::string &path)
+{
+	base_ = map_file(path, true, &size_);
+	if (base_ == nullptr)
+		return -1;
+
+	header_ = (StoreHeader *) base_;
+	index_ = (uint64_t *) (base_ + sizeof (StoreHeader));
+	records_ = (Record *) (base_ + records_offset(header_->capacity));
+	committed_ = header_->committed.load(std::memory_order_acquire);
+	return 0;
+}
+
+void StoreWriter::unmap_segment()
+{
+	if (base_ == nullptr)
+		return;
+
+	munmap(base_, size_);
+	base_ = nullptr;
+	size_ = 0;
+	header_ = nullptr;
+	index_ = nullptr;
+	records_ = nullptr;
+	committed_ = 0;
+}
+
+
+// StoreReader
+StoreReader::StoreReader() :
+	dir_(),
+	segments_()
+{
+
+}
+
+StoreReader::~StoreReader()
+{
+	close();
+}
+
+int StoreReader::open(const std::string &dir)
+{
+	close();
+	dir_ = dir;
+	return refresh();
+}
+
+void StoreReader::close()
+{
+	for (auto &s : segments_)
+		munmap((void *) s.base, s.size);
+	segments_.clear();
+}
+
+int StoreReader::refresh()
+{
+	std::vector<std::string> paths;
+	if (store_list_segments(dir_, &paths) != 0)
+		return -1;
+
+	for (auto &p : paths) {
+		if (!segments_.empty() && p <= segments_.back().path)
+			continue;
+
+		Segment s;
+		s.path = p;
+		s.base = map_file(p, false, &s.size);
+		if (s.base == nullptr)
+			return -1;
+
+		s.header = (const StoreHeader *) s.base;
+		s.index = (const uint64_t *) (s.base + sizeof (StoreHeader));
+		s.records = (const Record *) (s.base
+		                              + records_offset(s.header->capacity));
+		segments_.push_back(s);
+	}
+
+	return 0;
+}
+
+size_t StoreReader::query(const uint64_t t0, const uint64_t t1,
+                          std::vector<StoreSpan> *spans) const
+{
+	size_t total = 0;
+
+	for (auto &s : segments_) {
+		const uint64_t n = s.header->committed.load(
+		                        std::memory_order_acquire);
+		if (n == 0 || s.records[0].time > t1 || s.records[n - 1].time < t0)
+			continue;
+
+		//
+		// Index narrows the search down to one stride, the rest is
+		// binary search over the records themselves.
+		//
+		const uint64_t blocks = (n + STORE_INDEX_STRIDE - 1)
+		                        / STORE_INDEX_STRIDE;
+		const uint64_t *ib = s.index;
+		const uint64_t *ie = s.index + blocks;
+
+		uint64_t k = std::lower_bound(ib, ie, t0) - ib;
+		uint64_t lo = (k > 0 ? k - 1 : 0) * STORE_INDEX_STRIDE;
+		uint64_t hi = std::min(n, k * STORE_INDEX_STRIDE);
+		const Record *first = std::lower_bound(s.records + lo,
+		                                       s.records + hi, t0,
+		                                       time_less);
+
+		k = std::upper_bound(ib, ie, t1) - ib;
+		lo = (k > 0 ? k - 1 : 0) * STORE_INDEX_STRIDE;
+		hi = std::min(n, k * STORE_INDEX_STRIDE);
+		const Record *last = std::upper_bound(s.records + lo,
+		                                      s.records + hi, t1,
+		                                      less_time);
+
+		if (first < last) {
+			spans->push_back(StoreSpan { first, last });
+			total += last - first;
+		}
+	}
+
+	return total;
+}
+
+
+} // namespace lm
@@ -0,0 +1,175 @@
+//------------------------------------------------------------------------------
+// The MIT License (MIT)
+//
+// Copyright (c) 2015 Lukáš Mandák <lukas.mandak@yandex.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//
+// store.hpp
+//
+// Append-only history of lm::Record structures in memory mapped segment
+// files. Segment file layout:
+//
+//   StoreHeader | sparse index (time of every STORE_INDEX_STRIDE-th record)
+//               | records
+//
+// Segments have fixed capacity; when one fills up the writer continues in
+// next one. Records are published by storing the committed count with
+// release semantics, so readers in other processes may tail segments without
+// any locking.
+//
+//------------------------------------------------------------------------------
+#ifndef _LIBPROCESS_STORE_H_
+#define _LIBPROCESS_STORE_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "record.hpp"
+
+
+namespace lm {
+
+
+#define STORE_MAGIC             (0x4d474e53u) // "MGNS"
+#define STORE_VERSION           (3)
+#define STORE_INDEX_STRIDE      (256)
+#define STORE_SEGMENT_CAPACITY  (1 << 18)     // records, ~50 MB
+
+
+struct StoreHeader
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t record_size;
+	uint64_t capacity;
+	uint64_t index_stride;
+	std::atomic<uint64_t> committed;
+	char reserved[32];
+};
+
+static_assert(sizeof (StoreHeader) == 64, "StoreHeader must fill cache line.");
+
+
+//!
+//! Records of one segment in the time range. Points into mapped file.
+//!
+struct StoreSpan
+{
+	const Record *begin;
+	const Record *end;
+};
+
+
+class StoreWriter
+{
+	std::string dir_;
+	const uint64_t capacity_;
+	uint64_t segment_no_;
+
+	char *base_;
+	size_t size_;
+	StoreHeader *header_;
+	uint64_t *index_;
+	Record *records_;
+
+	uint64_t committed_;
+	uint64_t last_time_;
+	uint64_t rejected_;
+
+public:
+	StoreWriter(const uint64_t capacity = STORE_SEGMENT_CAPACITY);
+	~StoreWriter();
+
+	StoreWriter(const StoreWriter &) = delete;
+	StoreWriter & operator = (const StoreWriter &) = delete;
+
+	/** \brief Opens store directory, continues in its last segment. */
+	int open(const std::string &dir);
+	void close();
+
+	/** \brief Records older than the last appended one are rejected. */
+	int append(const Record &record);
+
+	/** \brief Schedules write back of dirty pages. */
+	void sync();
+
+	inline uint64_t get_rejected() const { return rejected_; }
+
+private:
+	int create_segment(const uint64_t segment_no);
+	int map_segment(const std::string &path);
+	void unmap_segment();
+};
+
+
+class StoreReader
+{
+	struct Segment {
+		std::string path;
+		const char *base;
+		size_t size;
+		const StoreHeader *header;
+		const uint64_t *index;
+		const Record *records;
+	};
+
+	std::string dir_;
+	std::vector<Segment> segments_;
+
+public:
+	StoreReader();
+	~StoreReader();
+
+	StoreReader(const StoreReader &) = delete;
+	StoreReader & operator = (const StoreReader &) = delete;
+
+	int open(const std::string &dir);
+	void close();
+
+	/** \brief Maps segments created since open() or last refresh(). */
+	int refresh();
+
+	/** \brief Finds records with t0 <= time <= t1, oldest first.
+	 *  \return Number of records.
+	 */
+	size_t query(const uint64_t t0, const uint64_t t1,
+	             std::vector<StoreSpan> *spans) const;
+
+	inline size_t get_segment_cnt() const { return segments_.size(); }
+};
+
+
+/** \brief Size of segment file of given capacity. */
+size_t store_segment_size(const uint64_t capacity);
+
+/** \brief Lists segment files of store directory, oldest first. */
+int store_list_segments(const std::string &dir,
+                        std::vector<std::string> *paths);
+
+
+} // namespace lm
+
+
+#endif // _LIBPROCESS_STORE_H_
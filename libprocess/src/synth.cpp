@@ -0,0 +1,193 @@
+//------------------------------------------------------------------------------
+// The MIT License (MIT)
+//
+// Copyright (c) 2015 Lukáš Mandák <lukas.mandak@yandex.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//
+// synth.cpp
+//
+//
+//
+//------------------------------------------------------------------------------
+#include "synth.hpp"
+
+#include <cmath>
+#include <cstdint>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "geometry.hpp"
+#include "pipeline.hpp"
+
+
+namespace lm {
+
+
+namespace {
+
+
+//!
+//! Field of magnet at pos seen by sensor, axis is unit vector of dipole
+//! or zero for radial field.
+//!
+void source_field(const SynthConfig &config, const double axis[3],
+                  const Point &pos, const Point &sensor, double out[3])
+{
+	const double d[3] = {
+		sensor.x - pos.x, sensor.y - pos.y, -config.height
+	};
+	const double r = std::max(std::sqrt(d[0] * d[0] + d[1] * d[1]
+	                                    + d[2] * d[2]), 0.5);
+	const double b = config.moment / (r * r * r);
+
+	//
+	// Radial field is the first term of dipole field alone.
+	//
+	const double dot = axis[0] * d[0] + axis[1] * d[1] + axis[2] * d[2];
+	const bool dipole = axis[0] != 0.0 || axis[1] != 0.0 || axis[2] != 0.0;
+	const double c = dipole ? 3.0 * dot / r : 1.0;
+	for (int k = 0; k < 3; ++k)
+		out[k] = b * (c * d[k] / r - axis[k]);
+}
+
+
+} // namespace
+
+
+SynthConfig::SynthConfig() :
+	sensors(PipelineConfig().sensors),
+	center(PipelineConfig().poi),
+	radius_min(6.0),
+	radius_max(20.0),
+	step(0.05),
+	height(0.0),
+	magnets(1),
+	environment({
+		200.0, 100.0, 300.0,
+		150.0, -120.0, 280.0,
+		-180.0, 90.0, 310.0
+	}),
+	axis(),
+	moment(400000.0),
+	noise(2.0),
+	warmup(100),
+	episode(500),
+	present_ratio(0.5),
+	seed(1)
+{
+
+}
+
+void synth_generate(const SynthConfig &config, const size_t frame_cnt,
+                    std::vector<SynthFrame> *out)
+{
+	std::mt19937 rng(config.seed);
+	std::uniform_real_distribution<double> uniform(0.0, 1.0);
+	std::normal_distribution<double> noise(0.0, config.noise);
+	std::exponential_distribution<double> episode(1.0 / config.episode);
+
+	const size_t sensor_cnt = config.sensors.size();
+
+	double axis[3] = { 0.0, 0.0, 0.0 };
+	if (config.axis.size() == 3) {
+		const double n = std::sqrt(config.axis[0] * config.axis[0]
+		                           + config.axis[1] * config.axis[1]
+		                           + config.axis[2] * config.axis[2]);
+		for (int k = 0; k < 3; ++k)
+			axis[k] = config.axis[k] / n;
+	}
+
+	std::vector<SynthSource> source(config.magnets,
+	                                SynthSource{ false, config.center });
+	std::vector<size_t> remaining(config.magnets, config.warmup);
+
+	for (size_t f = 0; f < frame_cnt; ++f) {
+		for (size_t m = 0; m < config.magnets; ++m) {
+			SynthSource &magnet = source[m];
+
+			if (remaining[m] == 0) {
+				magnet.present = uniform(rng)
+				                 < config.present_ratio;
+				remaining[m] = 1 + (size_t) episode(rng);
+
+				//
+				// Every episode starts at random spot
+				// of the ring.
+				//
+				const double a = 2.0 * M_PI * uniform(rng);
+				const double r = config.radius_min
+				        + uniform(rng) * (config.radius_max
+				                          - config.radius_min);
+				magnet.position = Point(
+				        config.center.x + r * std::cos(a),
+				        config.center.y + r * std::sin(a));
+			}
+			--remaining[m];
+
+			if (magnet.present) {
+				const Point &pos = magnet.position;
+				const double a = 2.0 * M_PI * uniform(rng);
+				Point next(pos.x + config.step * std::cos(a),
+				           pos.y + config.step * std::sin(a));
+				const double r = dist(next, config.center);
+				if (r >= config.radius_min &&
+				    r <= config.radius_max)
+					magnet.position = next;
+			}
+		}
+
+		SynthFrame frame;
+		frame.axes.resize(3 * sensor_cnt);
+		frame.source = source;
+		frame.height = config.height;
+
+		for (size_t s = 0; s < sensor_cnt; ++s) {
+			double field[3] = { 0.0, 0.0, 0.0 };
+			if (3 * s + 2 < config.environment.size()) {
+				const double *e = &config.environment[3 * s];
+				std::copy(e, e + 3, field);
+			}
+			for (const auto &m : source) {
+				if (!m.present)
+					continue;
+
+				double b[3];
+				source_field(config, axis, m.position,
+				             config.sensors[s], b);
+				for (int k = 0; k < 3; ++k)
+					field[k] += b[k];
+			}
+
+			for (int k = 0; k < 3; ++k) {
+				const double v = field[k] + noise(rng);
+				frame.axes[3 * s + k] = (int) std::max(-4096.0,
+				        std::min(4095.0, std::round(v)));
+			}
+		}
+
+		out->push_back(frame);
+	}
+}
+
+
+} // namespace lm
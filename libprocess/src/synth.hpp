@@ -0,0 +1,99 @@
+//------------------------------------------------------------------------------
+// The MIT License (MIT)
+//
+// Copyright (c) 2015 Lukáš Mandák <lukas.mandak@yandex.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//
+// synth.hpp
+//
+// Synthetic captures for offline evaluation. Magnets wander around the
+// sensors, each in its own episodes separated by episodes without it; each
+// sensor sees its environment field plus dipole-like 1/r^3 contribution
+// pointing away from every magnet, with gaussian noise on every axis. Given
+// an axis the magnets are point dipoles along it instead. Frames carry the
+// ground truth.
+//
+//------------------------------------------------------------------------------
+#ifndef _LIBPROCESS_SYNTH_H_
+#define _LIBPROCESS_SYNTH_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include <vector>
+
+#include "geometry.hpp"
+
+
+namespace lm {
+
+
+struct SynthSource
+{
+	bool present;
+	Point position;
+};
+
+
+struct SynthFrame
+{
+	std::vector<int> axes;          // x, y, z of every sensor
+	std::vector<SynthSource> source;        // of every magnet
+	double height;
+};
+
+
+struct SynthConfig
+{
+	PointVector sensors;
+	Point center;                   // magnet stays within ring around it
+	double radius_min;              // [cm]
+	double radius_max;
+	double step;                    // random walk step per frame [cm]
+	double height;                  // above sensor plane [cm]
+
+	size_t magnets;
+
+	std::vector<double> environment;        // x, y, z of every sensor,
+	                                        // zero for missing ones
+	std::vector<double> axis;       // x, y, z of dipole, empty for radial
+	double moment;                  // field = moment / r^3
+	double noise;                   // standard deviation per axis
+
+	size_t warmup;                  // frames without magnet at start
+	size_t episode;                 // mean length of an episode
+	double present_ratio;
+
+	uint32_t seed;
+
+	SynthConfig();
+};
+
+
+/** \brief Appends frame_cnt generated frames to out. */
+void synth_generate(const SynthConfig &config, const size_t frame_cnt,
+                    std::vector<SynthFrame> *out);
+
+
+} // namespace lm
+
+
+#endif // _LIBPROCESS_SYNTH_H_
@@ -0,0 +1,211 @@
+//------------------------------------------------------------------------------
+// The MIT License (MIT)
+//
+// Copyright (c) 2015 Lukáš Mandák <lukas.mandak@yandex.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//
+// trace.cpp
+//
+//
+//
+//------------------------------------------------------------------------------
+#include "trace.hpp"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "latency.hpp"
+
+
+namespace lm {
+
+
+std::atomic<bool> g_trace_enabled(false);
+
+
+namespace {
+
+
+//!
+//! Number of events kept per thread. Older events are overwritten.
+//!
+const size_t kTraceBufferLength = 1 << 16;
+
+
+struct TraceEvent {
+	const char *name;
+	uint64_t ts;
+	char phase;
+};
+
+struct TraceBuffer {
+	std::vector<TraceEvent> events;
+	size_t head;
+	bool wrapped;
+	long tid;
+
+	TraceBuffer() :
+		events(kTraceBufferLength),
+		head(0),
+		wrapped(false),
+		tid(syscall(SYS_gettid))
+	{
+
+	}
+};
+
+
+std::mutex g_trace_mutex;
+std::vector<TraceBuffer*> g_trace_buffers;
+std::string g_trace_path;
+std::string g_trace_process;
+
+thread_local TraceBuffer *t_trace_buffer = nullptr;
+
+
+TraceBuffer* thread_buffer()
+{
+	if (t_trace_buffer == nullptr) {
+		t_trace_buffer = new TraceBuffer();
+
+		std::lock_guard<std::mutex> lock(g_trace_mutex);
+		g_trace_buffers.push_back(t_trace_buffer);
+	}
+
+	return t_trace_buffer;
+}
+
+void write_buffer(FILE *f, const TraceBuffer &buf, const int pid, bool *first)
+{
+	const size_t cnt = buf.wrapped ? buf.events.size() : buf.head;
+	const size_t start = buf.wrapped ? buf.head : 0;
+
+	//
+	// End events whose begin was overwritten are dropped.
+	//
+	int depth = 0;
+	for (size_t i = 0; i < cnt; ++i) {
+		const TraceEvent &e = buf.events[(start + i) % buf.events.size()];
+		if (e.phase == 'E') {
+			if (depth == 0)
+				continue;
+			--depth;
+		} else {
+			++depth;
+		}
+
+		fprintf(f, "%s\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,"
+		        "\"pid\":%d,\"tid\":%ld}", (*first) ? "" : ",",
+		        e.name, e.phase, e.ts / 1e3, pid, buf.tid);
+		*first = false;
+	}
+}
+
+
+} // namespace
+
+
+int trace_init(const char *process_name)
+{
+	const char *path = getenv("MAGNETO_TRACE");
+	if (path == nullptr || *path == '\0')
+		return 0;
+
+	if (g_trace_enabled.load())
+		return 1;
+
+	g_trace_path = path;
+	g_trace_process = process_name;
+
+	//
+	// Traces of several executables may share one variable,
+	// keep them apart by appending the process name.
+	//
+	g_trace_path += '.';
+	g_trace_path += process_name;
+	g_trace_path += ".json";
+
+	if (atexit(trace_write) != 0) {
+		fprintf(stderr, "Unable to register trace writer.\n");
+		return -1;
+	}
+
+	g_trace_enabled.store(true);
+	fprintf(stderr, "Tracing to %s\n", g_trace_path.c_str());
+	return 1;
+}
+
+void trace_event(const char *name, const char phase)
+{
+	TraceBuffer *buf = thread_buffer();
+
+	TraceEvent &e = buf->events[buf->head];
+	e.name = name;
+	e.ts = monotonic_ns();
+	e.phase = phase;
+
+	if (++buf->head == buf->events.size()) {
+		buf->head = 0;
+		buf->wrapped = true;
+	}
+}
+
+void trace_write()
+{
+	if (!g_trace_enabled.exchange(false))
+		return;
+
+	FILE *f = fopen(g_trace_path.c_str(), "w");
+	if (f == nullptr) {
+		fprintf(stderr, "Unable to open %s: %s\n", g_trace_path.c_str(),
+		        strerror(errno));
+		return;
+	}
+
+	const int pid = getpid();
+	bool first = true;
+
+	fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+	fprintf(f, "\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+	        "\"args\":{\"name\":\"%s\"}}", pid, g_trace_process.c_str());
+	first = false;
+
+	std::lock_guard<std::mutex> lock(g_trace_mutex);
+	for (auto buf : g_trace_buffers)
+		write_buffer(f, *buf, pid, &first);
+
+	fprintf(f, "\n]}\n");
+	fclose(f);
+}
+
+
+} // namespace lm
@@ -0,0 +1,84 @@
+//------------------------------------------------------------------------------
+// The MIT License (MIT)
+//
+// Copyright (c) 2015 Lukáš Mandák <lukas.mandak@yandex.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//
+// trace.hpp
+//
+// Opt-in timeline tracer. When the MAGNETO_TRACE environment variable names
+// a file, begin/end events of traced scopes are kept in per-thread ring
+// buffers and written at exit as Chrome trace JSON (loadable in Perfetto).
+// Timestamps are CLOCK_MONOTONIC, so traces of process and visualize
+// can be merged.
+//
+//------------------------------------------------------------------------------
+#ifndef _LIBPROCESS_TRACE_H_
+#define _LIBPROCESS_TRACE_H_
+
+#include <atomic>
+
+
+namespace lm {
+
+
+extern std::atomic<bool> g_trace_enabled;
+
+
+/** \brief Enables tracing if MAGNETO_TRACE is set.
+ *  \return 1 if tracing was enabled, 0 if not, -1 on error.
+ */
+int trace_init(const char *process_name);
+
+/** \brief Records event. Name must be a string literal. */
+void trace_event(const char *name, const char phase);
+
+/** \brief Writes collected events. Called at exit automatically. */
+void trace_write();
+
+
+class TraceScope
+{
+	const char *name_;
+
+public:
+	TraceScope(const char *name) :
+		name_(name)
+	{
+		if (g_trace_enabled.load(std::memory_order_relaxed))
+			trace_event(name_, 'B');
+	}
+
+	~TraceScope()
+	{
+		if (g_trace_enabled.load(std::memory_order_relaxed))
+			trace_event(name_, 'E');
+	}
+};
+
+
+#define LM_TRACE(name)  lm::TraceScope lm_trace_scope_(name)
+
+
+} // namespace lm
+
+
+#endif // _LIBPROCESS_TRACE_H_
@@ -0,0 +1,522 @@
+//------------------------------------------------------------------------------
+// The MIT License (MIT)
+//
+// Copyright (c) 2015 Lukáš Mandák <lukas.mandak@yandex.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//
+// tracker.cpp
+//
+//
+//
+//------------------------------------------------------------------------------
+#include "tracker.hpp"
+
+#include <cmath>
+#include <cstdint>
+
+#include <algorithm>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "geometry.hpp"
+#include "trace.hpp"
+
+
+namespace lm {
+
+
+namespace {
+
+
+//!
+//! Relative error of 1/r^3 model on top of the noise of magnitudes,
+//! keeps weights from collapsing onto a single particle.
+//!
+const double kModelError = 0.05;
+
+//!
+//! Particles are resampled when effective count drops below this
+//! fraction, and this fraction of them is spread over range again
+//! so that a lost track recovers.
+//!
+const double kResampleRatio = 0.5;
+const double kRespawnRatio = 0.01;
+
+//!
+//! Particles nearer than this to a sensor are weighted as if they were
+//! this far. [cm^2]
+//!
+const double kMinDistance2 = 0.25;
+
+/** \brief Log weight penalty of particles beyond range. */
+const double kOutside = 20.0;
+
+
+//!
+//! Splitmix64, one multiply-xorshift round per 64 bits, cheap enough to
+//! draw per particle.
+//!
+inline uint64_t next_random(uint64_t *state)
+{
+	uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+	return z ^ (z >> 31);
+}
+
+/** \brief Uniform in [0, 1). */
+inline double uniform_random(uint64_t *state)
+{
+	return (next_random(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+//!
+//! Approximately standard normal, sum of four uniform 16 bit numbers
+//! of one draw scaled to unit variance. Tails end at 2*sqrt(3), which
+//! is of no concern for motion of particles.
+//!
+inline double gauss_random(uint64_t *state)
+{
+	const uint64_t r = next_random(state);
+	const double sum = (double) ((r & 0xffff) + ((r >> 16) & 0xffff)
+	                             + ((r >> 32) & 0xffff) + (r >> 48));
+	return (sum - 2.0 * 65535.0) * (std::sqrt(3.0) / 65536.0);
+}
+
+
+} // namespace
+
+
+ParticleTracker::ParticleTracker(const size_t particles,
+                                 const unsigned threads, const uint32_t seed) :
+	x_(particles),
+	y_(particles),
+	lw_(particles),
+	w_(particles),
+	tmp_x_(particles),
+	tmp_y_(particles),
+	sensors_(),
+	center_(),
+	range_(0.0),
+	motion_(0.0),
+	noise_(0.0),
+	gate_(0.0),
+	spread_(true),
+	magnitude_(),
+	weight_(),
+	share_(),
+	floor_(),
+	max_lw_(0.0),
+	best_(),
+	rng_(seed),
+	resample_offset_(0.0),
+	resample_step_(0.0),
+	slices_(std::max<size_t>(1, std::min<size_t>(threads, particles))),
+	pool_(),
+	mutex_(),
+	start_(),
+	done_(),
+	generation_(0),
+	pending_(0),
+	stopping_(false),
+	phase_(PHASE_SPREAD)
+{
+	for (size_t i = 0; i < slices_.size(); ++i) {
+		Slice &s = slices_[i];
+		s.begin = particles * i / slices_.size();
+		s.end = particles * (i + 1) / slices_.size();
+		s.rng = seed + 1 + i;
+	}
+
+	for (size_t i = 1; i < slices_.size(); ++i)
+		pool_.push_back(std::thread(&ParticleTracker::worker, this, i));
+}
+
+ParticleTracker::~ParticleTracker()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stopping_ = true;
+	}
+	start_.notify_all();
+
+	for (auto &t : pool_)
+		t.join();
+}
+
+int ParticleTracker::initialize(const PointVector &sensors,
+                                const Point &center, const double range,
+                                const double motion, const double noise,
+                                const double gate)
+{
+	if (sensors.size() < 2 || x_.empty() || range <= 0.0 || noise <= 0.0)
+		return -1;
+
+	sensors_ = sensors;
+	center_ = center;
+	range_ = range;
+	motion_ = motion;
+	noise_ = noise;
+	gate_ = gate;
+	magnitude_.assign(sensors.size(), 0.0);
+	weight_.assign(sensors.size(), 0.0);
+	share_.assign(sensors.size(), 0.0);
+	floor_.assign(sensors.size(), 0.0);
+	spread_ = true;
+
+	for (auto &s : slices_) {
+		s.moment.resize(sensors.size() * (s.end - s.begin));
+		s.mean.resize(s.end - s.begin);
+		s.chi2.resize(s.end - s.begin);
+	}
+
+	return 0;
+}
+
+void ParticleTracker::reset()
+{
+	spread_ = true;
+}
+
+int ParticleTracker::update(const std::vector<double> &magnitudes,
+                            const uint32_t saturated, Point *estimate,
+                            double *spread)
+{
+	LM_TRACE("ParticleTracker::update");
+
+	if (magnitudes.size() != sensors_.size())
+		return -1;
+
+	//
+	// Weight of a sensor is inverse variance of log of its magnitude.
+	// Saturated sensor only bounds the magnitude from below, it is left
+	// out of the mean moment and penalizes particles that would need
+	// a weaker field there.
+	//
+	int active = 0;
+	double total = 0.0;
+	for (size_t s = 0; s < sensors_.size(); ++s) {
+		const double b = magnitudes[s];
+		magnitude_[s] = b;
+		weight_[s] = 0.0;
+		share_[s] = 0.0;
+		floor_[s] = -2.0;
+		if (b <= 0.0)
+			continue;
+
+		if ((saturated & (1u << s)) != 0) {
+			weight_[s] = 1.0 / (kModelError * kModelError);
+			floor_[s] = 0.0;
+			continue;
+		}
+
+		const double rel = noise_ / b;
+		weight_[s] = 1.0 / (rel * rel + kModelError * kModelError);
+		share_[s] = weight_[s];
+		total += weight_[s];
+		++active;
+	}
+	if (active < 2)
+		return -1;
+
+	for (auto &c : share_)
+		c /= total;
+
+	dispatch(spread_ ? PHASE_SPREAD : PHASE_STEP);
+	spread_ = false;
+
+	size_t best = slices_[0].best;
+	for (auto &s : slices_)
+		if (lw_[s.best] > lw_[best])
+			best = s.best;
+	max_lw_ = lw_[best];
+	best_ = Point(x_[best], y_[best]);
+	if (!std::isfinite(max_lw_)) {
+		spread_ = true;
+		return -1;
+	}
+
+	dispatch(PHASE_NORMALIZE);
+
+	double sum = 0.0, sum2 = 0.0;
+	double near = 0.0, near_x = 0.0, near_y = 0.0, near_d2 = 0.0;
+	for (auto &s : slices_) {
+		sum += s.sum;
+		sum2 += s.sum2;
+		near += s.near;
+		near_x += s.near_x;
+		near_y += s.near_y;
+		near_d2 += s.near_d2;
+	}
+
+	//
+	// Best particle is always near itself, so near > 0.
+	//
+	*estimate = Point(near_x / near, near_y / near);
+	*spread = std::sqrt(near_d2 / near);
+
+	if (sum * sum < kResampleRatio * x_.size() * sum2) {
+		double offset = 0.0;
+		for (auto &s : slices_) {
+			s.offset = offset;
+			offset += s.sum;
+		}
+		resample_step_ = sum / x_.size();
+		resample_offset_ = resample_step_ * uniform_random(&rng_);
+
+		dispatch(PHASE_RESAMPLE);
+		x_.swap(tmp_x_);
+		y_.swap(tmp_y_);
+	}
+
+	return 0;
+}
+
+void ParticleTracker::worker(const size_t index)
+{
+	uint64_t seen = 0;
+
+	for (;;) {
+		std::unique_lock<std::mutex> lock(mutex_);
+		start_.wait(lock, [&]() {
+			return stopping_ || generation_ != seen;
+		});
+		if (stopping_)
+			return;
+		seen = generation_;
+		lock.unlock();
+
+		run(&slices_[index]);
+
+		lock.lock();
+		if (--pending_ == 0)
+			done_.notify_one();
+	}
+}
+
+void ParticleTracker::dispatch(const Phase phase)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		phase_ = phase;
+		pending_ = pool_.size();
+		++generation_;
+	}
+	start_.notify_all();
+
+	run(&slices_[0]);
+
+	std::unique_lock<std::mutex> lock(mutex_);
+	done_.wait(lock, [&]() { return pending_ == 0; });
+}
+
+void ParticleTracker::run(Slice *slice)
+{
+	switch (phase_) {
+	case PHASE_SPREAD:
+		spread(slice);
+		weigh(slice);
+		break;
+	case PHASE_STEP:
+		step(slice);
+		weigh(slice);
+		break;
+	case PHASE_NORMALIZE:
+		normalize(slice);
+		break;
+	case PHASE_RESAMPLE:
+		resample(slice);
+		break;
+	}
+}
+
+void ParticleTracker::spread(Slice *slice)
+{
+	for (size_t i = slice->begin; i < slice->end; ++i) {
+		const double u = uniform_random(&slice->rng);
+		const double r = range_ * std::sqrt(u);
+		const double a = 2.0 * M_PI * uniform_random(&slice->rng);
+		x_[i] = center_.x + r * std::cos(a);
+		y_[i] = center_.y + r * std::sin(a);
+		lw_[i] = 0.0;
+	}
+}
+
+void ParticleTracker::step(Slice *slice)
+{
+	uint64_t rng = slice->rng;
+
+	for (size_t i = slice->begin; i < slice->end; ++i) {
+		x_[i] += motion_ * gauss_random(&rng);
+		y_[i] += motion_ * gauss_random(&rng);
+	}
+
+	slice->rng = rng;
+}
+
+void ParticleTracker::weigh(Slice *slice)
+{
+	const size_t begin = slice->begin;
+	const size_t n = slice->end - begin;
+	const size_t sensor_cnt = sensors_.size();
+
+	double *x = x_.data() + begin;
+	double *y = y_.data() + begin;
+	double *lw = lw_.data() + begin;
+
+	//
+	// Moment explaining magnitude of every sensor, m_s = B_s * r_s^3,
+	// particle fits when they agree. Log of their ratio is approximated
+	// by 2 (m_s - m) / (m_s + m), which stays bounded and needs no log.
+	// Mean moment m weights sensors by share_, bounds raise the floor
+	// of the difference to zero.
+	//
+	double *m = slice->moment.data();
+	double *mean = slice->mean.data();
+	double *chi2 = slice->chi2.data();
+	std::fill(mean, mean + n, 0.0);
+	std::fill(chi2, chi2 + n, 0.0);
+
+	for (size_t s = 0; s < sensor_cnt; ++s) {
+		const double sx = sensors_[s].x;
+		const double sy = sensors_[s].y;
+		const double b = magnitude_[s];
+		const double c = share_[s];
+		double *ms = m + s * n;
+
+		for (size_t i = 0; i < n; ++i) {
+			const double dx = x[i] - sx;
+			const double dy = y[i] - sy;
+			const double r2 = std::max(dx * dx + dy * dy,
+			                           kMinDistance2);
+			ms[i] = b * r2 * std::sqrt(r2);
+			mean[i] += c * ms[i];
+		}
+	}
+
+	for (size_t s = 0; s < sensor_cnt; ++s) {
+		const double c = weight_[s];
+		const double low = floor_[s];
+		const double *ms = m + s * n;
+
+		for (size_t i = 0; i < n; ++i) {
+			const double d = std::max(low,
+			        2.0 * (ms[i] - mean[i]) / (ms[i] + mean[i]));
+			chi2[i] += c * d * d;
+		}
+	}
+
+	//
+	// Far particles see nearly equal magnitudes everywhere and would
+	// drift away on weak fields, range bounds them.
+	//
+	const double range2 = range_ * range_;
+	for (size_t i = 0; i < n; ++i) {
+		const double dx = x[i] - center_.x;
+		const double dy = y[i] - center_.y;
+		const double d2 = dx * dx + dy * dy;
+		const double out = (d2 > range2) ? kOutside : 0.0;
+		lw[i] -= 0.5 * chi2[i] + out;
+	}
+
+	slice->best = begin;
+	for (size_t i = 1; i < n; ++i)
+		if (lw[i] > lw[slice->best - begin])
+			slice->best = begin + i;
+}
+
+void ParticleTracker::normalize(Slice *slice)
+{
+	const double gate2 = gate_ * gate_;
+	double sum = 0.0, sum2 = 0.0;
+	double near = 0.0, near_x = 0.0, near_y = 0.0, near_d2 = 0.0;
+
+	for (size_t i = slice->begin; i < slice->end; ++i) {
+		lw_[i] -= max_lw_;
+		const double w = std::exp(lw_[i]);
+		sum += w;
+		w_[i] = sum;
+		sum2 += w * w;
+
+		const double dx = x_[i] - best_.x;
+		const double dy = y_[i] - best_.y;
+		const double d2 = dx * dx + dy * dy;
+		const double wn = (d2 <= gate2) ? w : 0.0;
+		near += wn;
+		near_x += wn * x_[i];
+		near_y += wn * y_[i];
+		near_d2 += wn * d2;
+	}
+
+	slice->sum = sum;
+	slice->sum2 = sum2;
+	slice->near = near;
+	slice->near_x = near_x;
+	slice->near_y = near_y;
+	slice->near_d2 = near_d2;
+}
+
+void ParticleTracker::resample(Slice *slice)
+{
+	//
+	// Systematic resampling, particle i is replaced by the first one whose
+	// cumulative weight reaches u_i = offset + i * step. Every slice finds
+	// the source of its first particle by binary search and walks from
+	// there, the sources may lie in any slice.
+	//
+	const size_t n = x_.size();
+	double u = resample_offset_ + slice->begin * resample_step_;
+
+	const Slice *source = &slices_[0];
+	const Slice *last = &slices_.back();
+	while (source != last && source[1].offset <= u)
+		++source;
+	size_t j = std::lower_bound(w_.begin() + source->begin,
+	                            w_.begin() + source->end,
+	                            u - source->offset) - w_.begin();
+	j = std::min(j, source->end - 1);
+
+	for (size_t i = slice->begin; i < slice->end; ++i) {
+		while (source->offset + w_[j] < u && j + 1 < n) {
+			++j;
+			if (j == source->end)
+				++source;
+		}
+		tmp_x_[i] = x_[j];
+		tmp_y_[i] = y_[j];
+		lw_[i] = 0.0;
+		u += resample_step_;
+	}
+
+	const size_t cnt = slice->end - slice->begin;
+	const size_t respawn = (size_t) (kRespawnRatio * cnt);
+	for (size_t i = slice->end - respawn; i < slice->end; ++i) {
+		const double u = uniform_random(&slice->rng);
+		const double r = range_ * std::sqrt(u);
+		const double a = 2.0 * M_PI * uniform_random(&slice->rng);
+		tmp_x_[i] = center_.x + r * std::cos(a);
+		tmp_y_[i] = center_.y + r * std::sin(a);
+	}
+}
+
+
+} // namespace lm
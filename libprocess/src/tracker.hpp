@@ -0,0 +1,166 @@
+//------------------------------------------------------------------------------
+// The MIT License (MIT)
+//
+// Copyright (c) 2015 Lukáš Mandák <lukas.mandak@yandex.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//
+// tracker.hpp
+//
+// Particle filter following the source from frame to frame. Particles are
+// candidate positions kept as structure of arrays. Every frame they take
+// a random step and are weighted by how well they explain the ratios of
+// the observed magnitudes, so the unknown moment of the source cancels out.
+// Mirrored intersections and positions inside the sensor triangle need no
+// special treatment, the weights decide between them. Contiguous slices of
+// particles are processed by a pool of worker threads with branchless inner
+// loops.
+//
+//------------------------------------------------------------------------------
+#ifndef _LIBPROCESS_TRACKER_H_
+#define _LIBPROCESS_TRACKER_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "geometry.hpp"
+
+
+namespace lm {
+
+
+class ParticleTracker
+{
+	enum Phase {
+		PHASE_SPREAD = 0,       // uniform over range, then weight
+		PHASE_STEP,             // random step, then weight
+		PHASE_NORMALIZE,
+		PHASE_RESAMPLE
+	};
+
+	struct Slice {
+		size_t begin;
+		size_t end;
+		uint64_t rng;           // state of splitmix64
+
+		// scratch of weigh()
+		std::vector<double> moment;     // [sensor][particle]
+		std::vector<double> mean;
+		std::vector<double> chi2;
+
+		size_t best;            // highest log weight of the slice
+		double offset;          // sum of weights of preceding slices
+		double sum;             // sums of normalized weights
+		double sum2;
+		double near;            // sums of weights near best particle
+		double near_x;
+		double near_y;
+		double near_d2;
+	};
+
+	// particles
+	std::vector<double> x_;
+	std::vector<double> y_;
+	std::vector<double> lw_;        // log weight
+	std::vector<double> w_;         // cumulative weight within slice
+	std::vector<double> tmp_x_;
+	std::vector<double> tmp_y_;
+
+	PointVector sensors_;
+	Point center_;
+	double range_;
+	double motion_;
+	double noise_;
+	double gate_;
+	bool spread_;
+
+	// observation of current frame, one slot per sensor
+	std::vector<double> magnitude_;
+	std::vector<double> weight_;    // inverse variance of log magnitude
+	std::vector<double> share_;     // weight in mean moment
+	std::vector<double> floor_;     // lowest log ratio, 0 for bound
+	double max_lw_;
+	Point best_;
+
+	uint64_t rng_;
+	double resample_offset_;
+	double resample_step_;
+	std::vector<Slice> slices_;
+	std::vector<std::thread> pool_;
+	std::mutex mutex_;
+	std::condition_variable start_;
+	std::condition_variable done_;
+	uint64_t generation_;
+	unsigned pending_;
+	bool stopping_;
+	Phase phase_;
+
+public:
+	ParticleTracker(const size_t particles, const unsigned threads,
+	                const uint32_t seed = 1);
+	~ParticleTracker();
+
+	ParticleTracker(const ParticleTracker &) = delete;
+	ParticleTracker & operator = (const ParticleTracker &) = delete;
+
+	//!
+	//! Particles start uniformly within range of center and move by
+	//! motion per frame [cm], noise is standard deviation of magnitudes.
+	//! Estimate is weighted mean of particles within gate of the best one.
+	//!
+	int initialize(const PointVector &sensors, const Point &center,
+	               const double range, const double motion,
+	               const double noise, const double gate);
+
+	/** \brief Forgets the track, e.g. when source enters again. */
+	void reset();
+
+	//!
+	//! Advances particles by source magnitudes of one frame, sensors
+	//! in saturated mask only bound the magnitude from below. Returns -1
+	//! if less than two sensors are unsaturated or no particle explains
+	//! them.
+	//!
+	int update(const std::vector<double> &magnitudes,
+	           const uint32_t saturated, Point *estimate, double *spread);
+
+	inline size_t get_particle_cnt() const { return x_.size(); }
+
+private:
+	void worker(const size_t index);
+	void dispatch(const Phase phase);
+	void run(Slice *slice);
+	void spread(Slice *slice);
+	void step(Slice *slice);
+	void weigh(Slice *slice);
+	void normalize(Slice *slice);
+	void resample(Slice *slice);
+};
+
+
+} // namespace lm
+
+
+#endif // _LIBPROCESS_TRACKER_H_
@@ -27,23 +27,39 @@
 //
 //
 //------------------------------------------------------------------------------
-#include <cmath>
 #include <cstdio>
+#include <cstdlib>
 
+#include <atomic>
+#include <iostream>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <signal.h>
+#include <unistd.h>
 
+#include "calibration.hpp"
+#include "ellipsoid.hpp"
 #include "geometry.hpp"
-#include "process.hpp"
+#include "instrument.hpp"
+#include "latency.hpp"
+#include "pipeline.hpp"
+#include "presence.hpp"
+#include "probes.hpp"
 #include "serial.hpp"
 #include "shared.hpp"
+#include "sink.hpp"
+#include "trace.hpp"
 
 
 namespace {
 
 
 void int_handler(int signum);
+void print_usage(const char *name);
+void save_state(const std::string &path, const lm::Pipeline &pipeline,
+                const lm::IronCalibrator &iron);
 
 
 //
@@ -56,49 +72,80 @@ void int_handler(int signum);
 const char* kSerialPort = "/dev/ttyACM0";
 
 //!
-//! Position of sensors in plane in the real world.
-//! [cm]
+//! Latency report settings.
+//! Percentiles are computed from the last kLatencyWindow frames and printed
+//! every kLatencyReportInterval seconds.
 //!
-const lm::PointVector kSensorPositions = {
-	lm::Point(-3, 0),
-	lm::Point(3, 0),
-	lm::Point(0, std::sqrt(6 * 6 - 3 * 3))
-};
-
-//
-// Points. poi
-//
-const lm::Point kOrigin(0.0, 0.0);
-const lm::Point kCircumcenter(0.0, 1.7320508076);
-
-//!
-//! Used to eliminate points inside of sensor triangle.
-//!
-const lm::Triangle kSensorTriangle(kSensorPositions);
+const size_t kLatencyWindow = 4096;
+const double kLatencyReportInterval = 10.0;
 
 //!
-//! Calibration constants.
+//! Output sinks used when none are given on command line
+//! and length of queue of each sink.
 //!
-const int kCalibrationLoops = 25;
-const double kCalibrationSpeedInitial = 0.95;
-const double kCalibrationSpeedFactor = 0.01;
+const std::vector<std::string> kDefaultSinks = { "text", "shm" };
+const size_t kSinkQueueLength = 1024;
 
 //!
-//! Treshold used for mag. field source detection.
-//! All sensors magnitudes must differ from their enviroment values
-//! by this value.
+//! Persisted calibration. State older than kCalibrationMaxAge seconds
+//! is ignored on startup, running process saves it every
+//! kCalibrationSaveInterval seconds and on exit.
 //!
-const double kDetectionTreshold = 30.0;
+const char* kCalibrationPath = "/var/tmp/magneto-calibration";
+const double kCalibrationMaxAge = 3600.0;
+const double kCalibrationSaveInterval = 60.0;
 
 
 lm::Shared g_shared_output = lm::Shared();
 
+std::atomic<bool> g_stop(false);
+
 
 } // namespace
 
 
-int main()
+int main(int argc, char *argv[])
 {
+	//
+	// Parse command line.
+	//
+	std::vector<std::string> sink_specs;
+	std::string calibration_path = kCalibrationPath;
+	bool recalibrate = false;
+	lm::PipelineConfig config;
+	int opt;
+	while ((opt = getopt(argc, argv, "o:c:Cr:p:z:m:h")) != -1) {
+		switch (opt) {
+		case 'o':
+			sink_specs.push_back(optarg);
+			break;
+		case 'c':
+			calibration_path = optarg;
+			break;
+		case 'C':
+			recalibrate = true;
+			break;
+		case 'r':
+			config.reuse_band = atof(optarg);
+			break;
+		case 'p':
+			config.tracker_particles = atol(optarg);
+			config.tracker_threads = std::thread::hardware_concurrency();
+			break;
+		case 'z':
+			config.dipole_budget = atof(optarg);
+			break;
+		case 'm':
+			config.sources_budget = atof(optarg);
+			break;
+		default:
+			print_usage(argv[0]);
+			return (opt == 'h') ? 0 : -1;
+		}
+	}
+	if (sink_specs.empty())
+		sink_specs = kDefaultSinks;
+
 	//
 	// Set custom action for ^C.
 	//
@@ -108,6 +155,17 @@ int main()
 
 	sigaction(SIGINT, &int_action, nullptr);
 
+	//
+	// Histograms are dumped on SIGUSR1 and at exit when built
+	// with instrumentation.
+	//
+	lm::instrument_install();
+
+	//
+	// Timeline tracing is enabled by MAGNETO_TRACE.
+	//
+	lm::trace_init("process");
+
 	//
 	// Connect to shared memory segment.
 	//
@@ -115,11 +173,25 @@ int main()
 		return -1;
 	}
 
+	//
+	// Create output sinks.
+	//
+	lm::SinkWriter output;
+	for (auto &spec : sink_specs) {
+		lm::BackpressurePolicy policy;
+		lm::Sink *sink = lm::make_sink(spec, g_shared_output, &policy);
+		if (sink == nullptr) {
+			fprintf(stderr, "Invalid output sink: %s\n", spec.c_str());
+			return -1;
+		}
+		output.add(sink, policy, kSinkQueueLength);
+	}
+
 	//
 	// Initialize mathematical model for given sensor layout.
 	//
-	lm::FilteredProcess proc;
-	if (proc.initialize(kSensorPositions) != 0) {
+	lm::Pipeline pipeline(config);
+	if (pipeline.initialize() != 0) {
 		fprintf(stderr, "Error while initializing Process instance.\n");
 		return -1;
 	}
@@ -141,22 +213,45 @@ int main()
 	fprintf(stderr, "Syncing... Done.    \n");
 
 	//
-	// Calibrate.
+	// Calibrate, unless recent state of the same layout is available.
+	// Environment keeps being refined on frames without source,
+	// iron corrections are refitted in background.
 	//
-	double speed = kCalibrationSpeedInitial;
-
-	fprintf(stderr, "Calibrating... ");
-	for (int i = 0; i < kCalibrationLoops; ++i) {
-		std::string line;
-		if(tiva.readline(&line) != 0)
-			return -1;
-		if (proc.calibrate(line, speed) != 0)
-			return -1;
-		speed -= kCalibrationSpeedFactor;
+	lm::IronCalibrator iron;
+	if (pipeline.attach_iron(&iron) != 0) {
+		fprintf(stderr, "Iron calibration supports at most %d "
+		        "sensors.\n", MD_SENSOR_COUNT);
+		return -1;
+	}
 
+	lm::CalibrationState state;
+	const int loaded = recalibrate ? 1 :
+	        lm::load_fresh_calibration(calibration_path,
+	                                   pipeline.get_config().sensors,
+	                                   kCalibrationMaxAge, &state);
+	if (loaded != 1 && !state.iron.empty())
+		iron.set(state.iron.data());
+
+	if (loaded == 0 && pipeline.warm_start(state.environment) == 0) {
+		fprintf(stderr, "Loaded calibration from %s\n",
+		        calibration_path.c_str());
+	} else {
+		fprintf(stderr, "Calibrating... ");
+		while (!pipeline.is_calibrated()) {
+			std::string line;
+			if(tiva.readline(&line) != 0)
+				return -1;
+			if (pipeline.calibrate(line) != 0)
+				return -1;
+		}
+		fprintf(stderr, "Done.\n");
+		save_state(calibration_path, pipeline, iron);
 	}
-	fprintf(stderr, "Done.\nEnviroment values: ");
-	lm::print_doublevector(proc.get_environment());
+	fprintf(stderr, "Enviroment values: ");
+	lm::print_doublevector(pipeline.get_environment());
+	uint64_t last_save = lm::monotonic_ns();
+	uint64_t iron_published = 0;
+	iron.start();
 
 	//
 	// Enter main loop.
@@ -165,107 +260,130 @@ int main()
 	g_shared_output.set_process_state(lm::CONN_ACTIVE);
 	int loop = 0;
 
-	while (1) {
+	output.start();
+
+	lm::LatencyReport latency(kLatencyWindow, kLatencyReportInterval);
+	latency.add_segment(lm::LP_LINE, lm::LP_PARSE, "line->parse");
+	latency.add_segment(lm::LP_PARSE, lm::LP_SOLVE, "parse->solve");
+	latency.add_segment(lm::LP_SOLVE, lm::LP_PUBLISH, "solve->publish");
+	latency.add_segment(lm::LP_LINE, lm::LP_PUBLISH, "line->publish");
+
+	while (!g_stop.load()) {
 		++loop;
-		proc.clear();
+		LM_TRACE("frame");
+		lm::instrument_poll();
+
+		if (lm::monotonic_ns() - last_save > kCalibrationSaveInterval * 1e9) {
+			save_state(calibration_path, pipeline, iron);
+			last_save = lm::monotonic_ns();
+		}
+
+		if (iron.get_generation() != iron_published) {
+			lm::IronCorrection c[MD_SENSOR_COUNT];
+			iron_published = iron.get(c);
+			g_shared_output.set_iron(c);
+		}
 
 		lm::MagnetoData data;
 
 		//
-		// Load and parse sensor data.
-		// Detect if any sensor is in saturation.
+		// Load sensor data and run it through the pipeline.
 		//
 		std::string raw_data;
 		if (tiva.readline(&raw_data) != 0)
 			goto error;
+		data.set_stamp(lm::LP_LINE);
+		g_shared_output.count(lm::STAT_FRAMES_IN);
+		LM_PROBE(frame_received, loop, raw_data.size());
+
+		const lm::FrameStatus status = pipeline.process(raw_data, loop,
+		                                                &data);
+		if (data.stamp[lm::LP_PARSE] != 0)
+			g_shared_output.count(lm::STAT_PARSE_NS,
+			                      data.stamp[lm::LP_PARSE]
+			                      - data.stamp[lm::LP_LINE]);
+
+		if (pipeline.get_event() != lm::PRESENCE_NONE) {
+			lm::PresenceState presence;
+			presence.present = pipeline.is_source_present();
+			presence.sequence = loop;
+			presence.time = lm::realtime_ns();
+			g_shared_output.set_presence(presence);
+			g_shared_output.count(presence.present
+			                      ? lm::STAT_SOURCE_ENTER
+			                      : lm::STAT_SOURCE_EXIT);
+		}
 
-		std::vector<double> proc_input;
-		int parse_status = lm::parse_raw_data(raw_data,
-		                                      proc.get_sensor_cnt(),
-		                                      &proc_input);
-		switch(parse_status) {
-		default:
+		if (config.sources_budget > 0.0 &&
+		    status != lm::FRAME_PARSE_ERROR)
+			g_shared_output.set_sources(pipeline.get_sources());
+
+		switch (status) {
+		case lm::FRAME_OK:
+			if (data.saturated != 0)
+				g_shared_output.count(lm::STAT_DEGRADED);
+			if (data.reused)
+				g_shared_output.count(lm::STAT_REUSED);
+			if (data.tracked)
+				g_shared_output.count(lm::STAT_TRACKED);
 			break;
-		case 1:
-			//fprintf(stderr, "Skipping loop: sensor saturated.\n");
+		case lm::FRAME_PARSE_ERROR:
+			g_shared_output.count(lm::STAT_PARSE_ERRORS);
 			continue;
-		case -1:
-			goto error;
-		}
-
-		//
-		// Decide whether a magnet is present or not.
-		//
-		if (!proc.is_source_present(proc_input, kDetectionTreshold))
+		case lm::FRAME_SATURATED:
+			g_shared_output.count(lm::STAT_SATURATED);
 			continue;
-
-		//
-		// Create possible solutions for current input data.
-		//
-		if (proc.process(proc_input) != 0) {
-			fprintf(stderr, "Error while processing data.\n");
+		case lm::FRAME_SOURCE_ABSENT:
+			g_shared_output.count(lm::STAT_SOURCE_ABSENT);
 			continue;
-		}
-
-		//
-		// Skip loop if some solutions are missing.
-		//
-		if (proc.get_points().size() != 6) {
-			fprintf(stderr, "Skipping loop: missing solutions.\n");
+		case lm::FRAME_MISSING_SOLUTIONS:
+			g_shared_output.count(lm::STAT_MISSING_SOLUTIONS);
 			continue;
-		}
-		data.set_solutions(proc.get_points());
-
-		//
-		// Eliminate solutions inside of sensor triangle.
-		//
-		if (proc.eliminate_triangle(kSensorTriangle) != 0) {
-			fprintf(stderr, "Problem while eliminating triangle points.\n");
+		case lm::FRAME_TRIANGLE_FAILED:
+			g_shared_output.count(lm::STAT_TRIANGLE_FAILED);
+			continue;
+		default:
+			g_shared_output.count(lm::STAT_PROCESS_ERRORS);
 			continue;
 		}
+		g_shared_output.count(lm::STAT_SOLVE_NS,
+		                      data.stamp[lm::LP_SOLVE] - data.stamp[lm::LP_PARSE]);
 
 		//
-		// Compute average from remaining solutions.
-		//
-		lm::Point result = proc.average_points();
-
-		//
-		// Print output.
+		// Hand collected data over to output sinks.
 		//
-		const lm::Point &poi = kCircumcenter;
-		double angle = lm::angle_deg(result, poi);
-		double dist = lm::dist(result, poi);
-
-		printf("%i\t", loop);
-		printf("%.2lf\t%.2lf\t\t", result.x, result.y);
-		printf("%.2lf\t", dist);
-		printf("%.2lf°\t", angle);
-		putchar('\n');
-
-		//
-		// Copy collected data to shared memory
-		//
-		data.set_sensors(kSensorPositions);
-		data.set_magnitudes(proc_input);
-		data.set_source_present(true);
-		data.set_circles(proc.get_circles());
-		data.set_poi(poi);
-		data.set_result(result);
 		data.set_timestamp();
-		data.set_valid();
-		if (g_shared_output.is_visualize_connected())
-			g_shared_output.set_data(data);
+		data.set_stamp(lm::LP_PUBLISH);
+		output.publish(data);
+		g_shared_output.count(lm::STAT_PUBLISHED);
+		LM_PROBE(published, loop, LM_PROBE_FIXED(data.result.x),
+		         LM_PROBE_FIXED(data.result.y));
+		g_shared_output.count(lm::STAT_PUBLISH_NS,
+		                      lm::monotonic_ns() - data.stamp[lm::LP_PUBLISH]);
+
+		latency.update(data.stamp);
+		if (latency.is_due())
+			latency.print(std::cerr);
 
 		//
 		// End of main loop.
 		//
 	}
 
+	output.stop();
+	output.print_stats(stderr);
+	iron.stop();
+	save_state(calibration_path, pipeline, iron);
+	g_shared_output.set_process_state(lm::CONN_NONE);
 	return 0;
 
 error:
+	output.stop();
+	output.print_stats(stderr);
+	iron.stop();
+	save_state(calibration_path, pipeline, iron);
 	g_shared_output.set_process_state(lm::CONN_NONE);
-	return -1;
+	return g_stop.load() ? 0 : -1;
 }
 
 
@@ -274,8 +392,61 @@ namespace {
 
 void int_handler(int signum)
 {
-	g_shared_output.set_process_state(lm::CONN_NONE);
-	exit(signum&0); // using signum just to get rid of the 'parameter not used' warning
+	//
+	// First ^C lets main loop finish and flush outputs,
+	// second one exits immediately.
+	//
+	if (g_stop.exchange(true)) {
+		g_shared_output.set_process_state(lm::CONN_NONE);
+		exit(signum&0); // using signum just to get rid of the 'parameter not used' warning
+	}
+}
+
+void print_usage(const char *name)
+{
+	fprintf(stderr,
+	        "usage: %s [-o sink]... [-c path] [-C] [-r band] [-p particles]\n"
+	        "          [-z budget] [-m budget]\n"
+	        "\n"
+	        "  -o <type>[:<path>][@<policy>]\n"
+	        "      Output sink, may be repeated. Default: -o text -o shm\n"
+	        "      types:    text, csv:<path>, json:<path>, bin:<path>, shm,\n"
+	        "                unix:<socket>, mcast:<group>:<port>[:<iface>],\n"
+	        "                http:[<addr>:]<port> (browse /, or /stream?rate=<Hz>),\n"
+	        "                store:<dir>\n"
+	        "      policies: drop-oldest (default), drop-newest, block\n"
+	        "  -c <path>\n"
+	        "      Calibration state file. Default: %s\n"
+	        "  -C\n"
+	        "      Ignore saved calibration and calibrate again.\n"
+	        "  -r <band>\n"
+	        "      Reuse last result while source magnitudes stay within\n"
+	        "      band of it. Default: 0, solve every frame\n"
+	        "  -p <particles>\n"
+	        "      Track source with particle filter on all cores, it gives\n"
+	        "      result when circles fail or pick a cluster away from\n"
+	        "      the track. Default: 0, no tracker\n"
+	        "  -z <budget>\n"
+	        "      Fit source as dipole in 3D within budget [us] per frame,\n"
+	        "      results gain height. Default: 0, planar results only\n"
+	        "  -m <budget>\n"
+	        "      Track several magnets at once within budget [us] per\n"
+	        "      frame, their list is kept in shared memory. Sensors\n"
+	        "      must outnumber twice the magnets. Default: 0, off\n",
+	        name, kCalibrationPath);
+}
+
+void save_state(const std::string &path, const lm::Pipeline &pipeline,
+                const lm::IronCalibrator &iron)
+{
+	lm::CalibrationState state;
+	state.environment = pipeline.get_environment();
+	state.iron.resize(MD_SENSOR_COUNT);
+	iron.get(state.iron.data());
+	state.layout_hash = lm::layout_hash(pipeline.get_config().sensors);
+	state.time = lm::realtime_ns();
+
+	lm::save_calibration(path, state);
 }
 
 
@@ -40,6 +40,8 @@
 #include <termios.h>
 #include <unistd.h>
 
+#include "trace.hpp"
+
 
 namespace lm {
 
@@ -93,8 +95,9 @@ int Serial::read()
 	char c;
 	int retval = ::read(m_fd_, &c, 1);
 	if (retval == -1) {
-		fprintf(stderr, "Error %d while reading: %s\n", errno,
-		        strerror(errno));
+		if (errno != EINTR)
+			fprintf(stderr, "Error %d while reading: %s\n", errno,
+			        strerror(errno));
 		is_open_ = false;
 		return -1;
 	}
@@ -103,6 +106,8 @@ int Serial::read()
 
 int Serial::readline(std::string *out)
 {
+	LM_TRACE("Serial::readline");
+
 	int c;
 	std::string line;
 
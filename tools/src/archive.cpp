@@ -0,0 +1,249 @@
+//------------------------------------------------------------------------------
+// The MIT License (MIT)
+//
+// Copyright (c) 2015 Lukáš Mandák <lukas.mandak@yandex.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//
+// archive.cpp
+//
+// magneto-archive pack [-r rate] <raw> <archive>
+// magneto-archive unpack [-j threads] <archive> [from [to]]
+// magneto-archive info <archive>
+//
+// Converts raw captures of serial lines to compressed archive and back.
+// Raw lines hold nine axis values, optionally preceded by time in ns; lines
+// without time are assumed to be sampled at given rate. Unpacked lines always
+// carry time. Use "-" for stdin.
+//
+//------------------------------------------------------------------------------
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <getopt.h>
+
+#include "archive.hpp"
+#include "latency.hpp"
+
+
+namespace {
+
+
+//!
+//! Rate assumed for raw lines without time [Hz].
+//!
+const double kDefaultRate = 100.0;
+
+
+void print_usage(const char *name)
+{
+	fprintf(stderr,
+	        "usage: %s pack [-r rate] <raw> <archive>\n"
+	        "       %s unpack [-j threads] <archive> [from [to]]\n"
+	        "       %s info <archive>\n"
+	        "\n"
+	        "  from, to   time in ns\n",
+	        name, name, name);
+}
+
+int pack(int argc, char *argv[])
+{
+	double rate = kDefaultRate;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "r:")) != -1) {
+		switch (opt) {
+		case 'r':
+			rate = atof(optarg);
+			break;
+
+		default:
+			return -1;
+		}
+	}
+
+	if (argc - optind != 2 || rate <= 0.0)
+		return -1;
+
+	std::ifstream file;
+	if (strcmp(argv[optind], "-") != 0) {
+		file.open(argv[optind]);
+		if (!file) {
+			fprintf(stderr, "Unable to open %s\n", argv[optind]);
+			return -1;
+		}
+	}
+	std::istream &in = file.is_open() ? file : std::cin;
+
+	lm::ArchiveWriter writer;
+	if (writer.open(argv[optind + 1]) != 0)
+		return -1;
+
+	const uint64_t period = (uint64_t) (1e9 / rate);
+	uint64_t raw_size = 0;
+	uint64_t samples = 0;
+	uint64_t skipped = 0;
+	std::string line;
+	std::vector<int> axes;
+
+	while (std::getline(in, line)) {
+		raw_size += line.size() + 1;
+
+		uint64_t time = samples * period;
+		if (lm::parse_capture_line(line, &time, &axes) < 0) {
+			++skipped;
+			continue;
+		}
+
+		int16_t a[ARCHIVE_CHANNELS];
+		for (int c = 0; c < ARCHIVE_CHANNELS; ++c)
+			a[c] = (int16_t) std::max(-32768, std::min(32767, axes[c]));
+
+		if (writer.append(time, a) != 0) {
+			++skipped;
+			continue;
+		}
+		++samples;
+	}
+
+	if (writer.close() != 0)
+		return -1;
+
+	fprintf(stderr, "%llu samples, %llu skipped, %llu -> %llu bytes "
+	        "(%.1f bytes/sample)\n",
+	        (unsigned long long) samples, (unsigned long long) skipped,
+	        (unsigned long long) raw_size,
+	        (unsigned long long) writer.get_size(),
+	        samples ? (double) writer.get_size() / samples : 0.0);
+	return 0;
+}
+
+int unpack(int argc, char *argv[])
+{
+	unsigned threads = std::thread::hardware_concurrency();
+	int opt;
+
+	while ((opt = getopt(argc, argv, "j:")) != -1) {
+		switch (opt) {
+		case 'j':
+			threads = atoi(optarg);
+			break;
+
+		default:
+			return -1;
+		}
+	}
+
+	if (optind >= argc)
+		return -1;
+
+	const uint64_t t0 = (optind + 1 < argc)
+	                    ? strtoull(argv[optind + 1], nullptr, 10) : 0;
+	const uint64_t t1 = (optind + 2 < argc)
+	                    ? strtoull(argv[optind + 2], nullptr, 10) : UINT64_MAX;
+
+	lm::ArchiveReader reader;
+	if (reader.open(argv[optind]) != 0)
+		return -1;
+
+	std::vector<size_t> blocks;
+	reader.find_blocks(t0, t1, &blocks);
+
+	std::vector<lm::ArchiveColumns> columns;
+	const uint64_t start = lm::monotonic_ns();
+	if (reader.decode_blocks(blocks, threads, &columns) != 0)
+		return -1;
+	const uint64_t decode_ns = lm::monotonic_ns() - start;
+
+	uint64_t samples = 0;
+	for (auto &col : columns) {
+		for (size_t k = 0; k < col.size(); ++k) {
+			if (col.time[k] < t0 || col.time[k] > t1)
+				continue;
+
+			printf("%llu", (unsigned long long) col.time[k]);
+			for (int c = 0; c < ARCHIVE_CHANNELS; ++c)
+				printf(" %d", col.axis[c][k]);
+			putchar('\n');
+			++samples;
+		}
+	}
+
+	fprintf(stderr, "%llu samples from %zu blocks, decoded in %.1f ms\n",
+	        (unsigned long long) samples, blocks.size(), decode_ns / 1e6);
+	return 0;
+}
+
+int info(int argc, char *argv[])
+{
+	if (argc != 2)
+		return -1;
+
+	lm::ArchiveReader reader;
+	if (reader.open(argv[1]) != 0)
+		return -1;
+
+	printf("%6s %8s %8s %20s %20s  min/max per channel\n",
+	       "block", "samples", "bytes", "first", "last");
+	for (size_t i = 0; i < reader.get_block_cnt(); ++i) {
+		const lm::ArchiveBlockInfo &b = reader.get_block(i);
+		printf("%6zu %8u %8u %20llu %20llu ", i, b.count, b.size,
+		       (unsigned long long) b.t_first,
+		       (unsigned long long) b.t_last);
+		for (int c = 0; c < ARCHIVE_CHANNELS; ++c)
+			printf(" %d/%d", b.min[c], b.max[c]);
+		putchar('\n');
+	}
+
+	return 0;
+}
+
+
+} // namespace
+
+
+int main(int argc, char *argv[])
+{
+	int status = -1;
+
+	if (argc > 1) {
+		const std::string cmd = argv[1];
+		if (cmd == "pack")
+			status = pack(argc - 1, argv + 1);
+		else if (cmd == "unpack")
+			status = unpack(argc - 1, argv + 1);
+		else if (cmd == "info")
+			status = info(argc - 1, argv + 1);
+	}
+
+	if (status != 0)
+		print_usage(argv[0]);
+
+	return status;
+}
@@ -0,0 +1,437 @@
+//------------------------------------------------------------------------------
+// The MIT License (MIT)
+//
+// Copyright (c) 2015 Lukáš Mandák <lukas.mandak@yandex.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//
+// batch.cpp
+//
+// magneto-batch [-j threads] [-o outdir] [-r rate] <captures>
+//
+// Reprocesses every capture in a directory, raw serial lines or archives
+// made by magneto-archive, through the same pipeline as process. Files are
+// spread across worker threads, results of each file go to <outdir>/<file>.csv.
+// At the end prints throughput, reasons of skipped frames and distribution
+// of results.
+//
+//------------------------------------------------------------------------------
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <getopt.h>
+#include <sys/stat.h>
+
+#include "archive.hpp"
+#include "geometry.hpp"
+#include "latency.hpp"
+#include "pipeline.hpp"
+#include "process.hpp"
+#include "shared.hpp"
+#include "sink.hpp"
+
+
+namespace {
+
+
+//!
+//! Rate assumed for raw lines without time [Hz].
+//!
+const double kDefaultRate = 100.0;
+
+//!
+//! Histogram of result distance from poi.
+//! [cm]
+//!
+const double kDistBin = 5.0;
+const int kDistBins = 10;
+
+
+struct Capture {
+	std::string path;
+	std::string name;
+	off_t size;
+};
+
+struct Stats {
+	uint64_t frames;
+	uint64_t calibration;
+	uint64_t calibration_skipped;   // refused by calibrate()
+	uint64_t status[lm::FRAME_STATUS_COUNT];
+	uint64_t dist[kDistBins + 1];
+	double sum_x;
+	double sum_y;
+
+	Stats();
+	void merge(const Stats &other);
+};
+
+Stats::Stats() :
+	frames(0),
+	calibration(0),
+	calibration_skipped(0),
+	sum_x(0.0),
+	sum_y(0.0)
+{
+	std::fill(status, status + lm::FRAME_STATUS_COUNT, 0);
+	std::fill(dist, dist + kDistBins + 1, 0);
+}
+
+void Stats::merge(const Stats &other)
+{
+	frames += other.frames;
+	calibration += other.calibration;
+	calibration_skipped += other.calibration_skipped;
+	for (int i = 0; i < lm::FRAME_STATUS_COUNT; ++i)
+		status[i] += other.status[i];
+	for (int i = 0; i <= kDistBins; ++i)
+		dist[i] += other.dist[i];
+	sum_x += other.sum_x;
+	sum_y += other.sum_y;
+}
+
+
+//!
+//! Feeds frames of one capture to its own pipeline.
+//!
+class Job
+{
+	lm::Pipeline pipeline_;
+	lm::CsvSink *out_;
+	Stats stats_;
+
+public:
+	Job(lm::CsvSink *out) : pipeline_(), out_(out), stats_() {}
+
+	int initialize() { return pipeline_.initialize(); }
+
+	void frame(const std::vector<double> &field, const uint32_t saturated,
+	           const lm::FrameStatus parse_status, const uint64_t time);
+
+	const Stats& get_stats() const { return stats_; }
+};
+
+void Job::frame(const std::vector<double> &field, const uint32_t saturated,
+                const lm::FrameStatus parse_status, const uint64_t time)
+{
+	++stats_.frames;
+
+	if (parse_status != lm::FRAME_OK) {
+		++stats_.status[parse_status];
+		return;
+	}
+
+	//
+	// Unlike process, broken frames during calibration are skipped
+	// instead of aborting.
+	//
+	if (!pipeline_.is_calibrated()) {
+		if (pipeline_.calibrate(field, saturated) == 0)
+			++stats_.calibration;
+		else
+			++stats_.calibration_skipped;
+		return;
+	}
+
+	lm::MagnetoData data;
+	const lm::FrameStatus status = pipeline_.solve(field, stats_.frames,
+	                                               &data, saturated);
+	++stats_.status[status];
+	if (status != lm::FRAME_OK)
+		return;
+
+	const double d = lm::dist(data.result, data.poi);
+	++stats_.dist[std::min(kDistBins, (int) (d / kDistBin))];
+	stats_.sum_x += data.result.x;
+	stats_.sum_y += data.result.y;
+
+	if (out_ != nullptr) {
+		data.time = time;
+		out_->write(data);
+	}
+}
+
+
+int run_text(const Capture &c, const double rate, Job *job)
+{
+	std::ifstream in(c.path);
+	if (!in) {
+		fprintf(stderr, "Unable to open %s\n", c.path.c_str());
+		return -1;
+	}
+
+	const uint64_t period = (uint64_t) (1e9 / rate);
+	const int sensor_cnt = ARCHIVE_CHANNELS / 3;
+	std::vector<int> axes;
+	std::vector<double> field;
+	std::string line;
+	uint64_t index = 0;
+
+	while (std::getline(in, line)) {
+		uint64_t time = index++ * period;
+
+		lm::FrameStatus status = lm::FRAME_PARSE_ERROR;
+		uint32_t saturated = 0;
+		if (lm::parse_capture_line(line, &time, &axes) >= 0) {
+			status = (lm::axes_to_field(axes, sensor_cnt, &field,
+			                            &saturated) >= 0)
+			         ? lm::FRAME_OK : lm::FRAME_PARSE_ERROR;
+		}
+		job->frame(field, saturated, status, time);
+	}
+
+	return 0;
+}
+
+int run_archive(const Capture &c, Job *job)
+{
+	lm::ArchiveReader reader;
+	if (reader.open(c.path) != 0)
+		return -1;
+
+	const int sensor_cnt = ARCHIVE_CHANNELS / 3;
+	lm::ArchiveColumns col;
+	std::vector<int> axes(ARCHIVE_CHANNELS);
+	std::vector<double> field;
+
+	for (size_t b = 0; b < reader.get_block_cnt(); ++b) {
+		if (reader.decode_block(b, &col) != 0) {
+			fprintf(stderr, "Corrupted block %zu of %s\n", b,
+			        c.path.c_str());
+			return -1;
+		}
+
+		for (size_t k = 0; k < col.size(); ++k) {
+			for (int a = 0; a < ARCHIVE_CHANNELS; ++a)
+				axes[a] = col.axis[a][k];
+
+			uint32_t saturated;
+			const lm::FrameStatus status =
+			        (lm::axes_to_field(axes, sensor_cnt, &field,
+			                           &saturated) >= 0)
+			        ? lm::FRAME_OK : lm::FRAME_PARSE_ERROR;
+			job->frame(field, saturated, status, col.time[k]);
+		}
+	}
+
+	return 0;
+}
+
+int list_captures(const std::string &dir, std::vector<Capture> *captures)
+{
+	DIR *d = opendir(dir.c_str());
+	if (d == nullptr) {
+		fprintf(stderr, "Unable to open %s: %s\n", dir.c_str(),
+		        strerror(errno));
+		return -1;
+	}
+
+	struct dirent *e;
+	while ((e = readdir(d)) != nullptr) {
+		Capture c;
+		c.name = e->d_name;
+		c.path = dir + "/" + c.name;
+
+		struct stat st;
+		if (c.name[0] == '.' || stat(c.path.c_str(), &st) != 0 ||
+		    !S_ISREG(st.st_mode))
+			continue;
+
+		c.size = st.st_size;
+		captures->push_back(c);
+	}
+	closedir(d);
+
+	//
+	// Largest files first, so the last ones to finish are short.
+	//
+	std::sort(captures->begin(), captures->end(),
+	          [](const Capture &a, const Capture &b) {
+	                  return a.size > b.size;
+	          });
+
+	return 0;
+}
+
+bool is_archive(const std::string &name)
+{
+	return name.size() > 4 && name.compare(name.size() - 4, 4, ".mga") == 0;
+}
+
+void print_stats(const Stats &s, const size_t files, const double seconds)
+{
+	const uint64_t solved = s.status[lm::FRAME_OK];
+	const uint64_t parsed = s.frames - s.calibration
+	                        - s.calibration_skipped
+	                        - s.status[lm::FRAME_PARSE_ERROR];
+
+	fprintf(stderr, "\n%zu files, %llu frames in %.2f s, %.0f frames/s\n",
+	        files, (unsigned long long) s.frames, seconds,
+	        seconds > 0.0 ? s.frames / seconds : 0.0);
+	fprintf(stderr, "calibration   %12llu\n",
+	        (unsigned long long) s.calibration);
+	fprintf(stderr, "calibration skipped %6llu\n",
+	        (unsigned long long) s.calibration_skipped);
+	for (int i = 0; i < lm::FRAME_STATUS_COUNT; ++i)
+		fprintf(stderr, "%-18s %7llu  %5.1f %%\n",
+		        lm::frame_status_name((lm::FrameStatus) i),
+		        (unsigned long long) s.status[i],
+		        s.frames ? 100.0 * s.status[i] / s.frames : 0.0);
+
+	fprintf(stderr, "detection rate %.1f %% of parsed frames\n",
+	        parsed ? 100.0 * (parsed - s.status[lm::FRAME_SOURCE_ABSENT])
+	                 / parsed : 0.0);
+
+	if (solved == 0)
+		return;
+
+	fprintf(stderr, "mean result %.2f, %.2f\n", s.sum_x / solved,
+	        s.sum_y / solved);
+	fprintf(stderr, "distance from poi [cm]\n");
+	for (int i = 0; i <= kDistBins; ++i) {
+		if (i < kDistBins)
+			fprintf(stderr, "  %4.0f - %-4.0f", i * kDistBin,
+			        (i + 1) * kDistBin);
+		else
+			fprintf(stderr, "  %4.0f -     ", i * kDistBin);
+		fprintf(stderr, " %10llu  %5.1f %%\n",
+		        (unsigned long long) s.dist[i], 100.0 * s.dist[i] / solved);
+	}
+}
+
+void print_usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-j threads] [-o outdir] [-r rate] "
+	        "<captures>\n", name);
+}
+
+
+} // namespace
+
+
+int main(int argc, char *argv[])
+{
+	unsigned threads = std::thread::hardware_concurrency();
+	std::string outdir;
+	double rate = kDefaultRate;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "j:o:r:h")) != -1) {
+		switch (opt) {
+		case 'j':
+			threads = atoi(optarg);
+			break;
+		case 'o':
+			outdir = optarg;
+			break;
+		case 'r':
+			rate = atof(optarg);
+			break;
+		default:
+			print_usage(argv[0]);
+			return (opt == 'h') ? 0 : -1;
+		}
+	}
+
+	if (optind + 1 != argc || rate <= 0.0) {
+		print_usage(argv[0]);
+		return -1;
+	}
+
+	std::vector<Capture> captures;
+	if (list_captures(argv[optind], &captures) != 0)
+		return -1;
+
+	if (!outdir.empty() && mkdir(outdir.c_str(), 0755) != 0 &&
+	    errno != EEXIST) {
+		fprintf(stderr, "Unable to create %s: %s\n", outdir.c_str(),
+		        strerror(errno));
+		return -1;
+	}
+
+	std::atomic<size_t> next(0);
+	std::atomic<int> failed(0);
+	std::mutex mutex;
+	Stats total;
+
+	auto worker = [&]() {
+		size_t i;
+		while ((i = next.fetch_add(1)) < captures.size()) {
+			const Capture &c = captures[i];
+
+			lm::CsvSink out;
+			if (!outdir.empty() &&
+			    out.open(outdir + "/" + c.name + ".csv") != 0) {
+				failed.fetch_add(1);
+				continue;
+			}
+
+			Job job(outdir.empty() ? nullptr : &out);
+			if (job.initialize() != 0) {
+				failed.fetch_add(1);
+				continue;
+			}
+
+			const int status = is_archive(c.name)
+			                   ? run_archive(c, &job)
+			                   : run_text(c, rate, &job);
+			if (status != 0)
+				failed.fetch_add(1);
+
+			const Stats &s = job.get_stats();
+			std::lock_guard<std::mutex> lock(mutex);
+			fprintf(stderr, "%-40s %10llu frames %10llu solved\n",
+			        c.name.c_str(), (unsigned long long) s.frames,
+			        (unsigned long long) s.status[lm::FRAME_OK]);
+			total.merge(s);
+		}
+	};
+
+	const uint64_t start = lm::monotonic_ns();
+
+	threads = std::max(1u, std::min<unsigned>(threads, captures.size()));
+	std::vector<std::thread> pool;
+	for (unsigned t = 1; t < threads; ++t)
+		pool.push_back(std::thread(worker));
+	worker();
+	for (auto &t : pool)
+		t.join();
+
+	print_stats(total, captures.size(), (lm::monotonic_ns() - start) / 1e9);
+
+	if (failed.load() != 0) {
+		fprintf(stderr, "%d files failed\n", failed.load());
+		return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,163 @@
+//------------------------------------------------------------------------------
+// The MIT License (MIT)
+//
+// Copyright (c) 2015 Lukáš Mandák <lukas.mandak@yandex.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//
+// dump.cpp
+//
+// magneto-dump [-f] <store> [from [to]]
+//
+// Prints records of history store written by the store sink as CSV.
+// Times are seconds since epoch, negative ones count back from now. With -f
+// keeps printing records appended after the range, like tail -f.
+//
+//------------------------------------------------------------------------------
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+#include <atomic>
+#include <vector>
+
+#include <getopt.h>
+#include <unistd.h>
+
+#include "latency.hpp"
+#include "record.hpp"
+#include "store.hpp"
+
+
+namespace {
+
+
+//!
+//! Polling period of follow mode [us].
+//!
+const useconds_t kFollowPeriod = 100000;
+
+
+std::atomic<bool> g_stop(false);
+
+
+void signal_handler(int signum)
+{
+	(void) signum;
+	g_stop.store(true);
+}
+
+uint64_t parse_time(const char *arg, const uint64_t now)
+{
+	const double t = atof(arg);
+	if (t < 0.0)
+		return now - (uint64_t) (-t * 1e9);
+
+	return (uint64_t) (t * 1e9);
+}
+
+void print_record(const lm::Record &r)
+{
+	char z[32] = "";
+	if ((r.flags & RECORD_FLAG_HEIGHT) != 0)
+		snprintf(z, sizeof (z), "%.4f", r.z);
+
+	printf("%llu,%llu,%u,%.4f,%.4f,%.3f,%.3f,%.3f,%.4f,%.4f,%.3f,%s\n",
+	       (unsigned long long) r.sequence, (unsigned long long) r.time,
+	       r.flags, r.result[0], r.result[1],
+	       r.magnitude[0], r.magnitude[1], r.magnitude[2],
+	       r.spread, r.conditioning, r.margin, z);
+}
+
+void print_usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-f] <store> [from [to]]\n", name);
+}
+
+
+} // namespace
+
+
+int main(int argc, char *argv[])
+{
+	bool follow = false;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "fh")) != -1) {
+		switch (opt) {
+		case 'f':
+			follow = true;
+			break;
+
+		default:
+			print_usage(argv[0]);
+			return (opt == 'h') ? 0 : -1;
+		}
+	}
+
+	if (optind >= argc) {
+		print_usage(argv[0]);
+		return -1;
+	}
+
+	const uint64_t now = lm::realtime_ns();
+	uint64_t t0 = 0;
+	uint64_t t1 = UINT64_MAX;
+	if (optind + 1 < argc)
+		t0 = parse_time(argv[optind + 1], now);
+	if (optind + 2 < argc)
+		t1 = parse_time(argv[optind + 2], now);
+
+	lm::StoreReader reader;
+	if (reader.open(argv[optind]) != 0)
+		return -1;
+
+	signal(SIGINT, signal_handler);
+	signal(SIGTERM, signal_handler);
+
+	printf("sequence,time,flags,x,y,m0,m1,m2,spread,conditioning,margin,"
+	       "z\n");
+
+	std::vector<lm::StoreSpan> spans;
+	do {
+		spans.clear();
+		reader.query(t0, t1, &spans);
+
+		for (auto &s : spans) {
+			for (const lm::Record *r = s.begin; r != s.end; ++r)
+				print_record(*r);
+
+			//
+			// Next poll continues after the last printed record.
+			//
+			t0 = (s.end - 1)->time + 1;
+		}
+		fflush(stdout);
+
+		if (follow) {
+			usleep(kFollowPeriod);
+			if (reader.refresh() != 0)
+				return -1;
+		}
+	} while (follow && !g_stop.load());
+
+	return 0;
+}
@@ -0,0 +1,716 @@
+//------------------------------------------------------------------------------
+// The MIT License (MIT)
+//
+// Copyright (c) 2015 Lukáš Mandák <lukas.mandak@yandex.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//
+// layout.cpp
+//
+// magneto-layout [options]
+//
+// Monte-Carlo evaluation of a sensor layout. For every magnet position of
+// a grid, noisy magnitudes are drawn from the field model and solved from
+// scratch: Apollonius circle of every sensor pair, intersections of every
+// two circles, candidate most consistent with all magnitudes. Circles are
+// kept in generalized form, so pairs of nearly equal magnitudes give lines
+// instead of dropped frames. Reports position error, zones where some circle
+// is nearly a line and rate of dropped frames, and writes them as CSV and
+// PGM heatmaps. With -O
+// the layout is improved by random local search under a common random
+// number stream, so layouts are compared on identical noise.
+//
+// Magnitudes of three sensors fit equally well the magnet position and its
+// inversion in circumcircle of the sensors. As process does, the magnet is
+// assumed to be outside, positions inside the circumcircle are not
+// evaluated for three sensor layouts. They count as dropped, as do
+// positions next to a sensor, so all layouts are scored on the same grid.
+//
+// Trials of one grid cell are processed as structure of arrays with
+// branchless inner loops, grid rows are spread across threads.
+//
+//------------------------------------------------------------------------------
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <getopt.h>
+
+#include "geometry.hpp"
+#include "pipeline.hpp"
+
+
+namespace {
+
+
+//!
+//! Circles of sensor pairs with magnitude ratio closer to one than this
+//! are counted as degenerate (nearly a line).
+//!
+const double kDegenerateEpsilon = 1e-3;
+
+//!
+//! Intersections farther than this from the origin are dropped,
+//! as process does.
+//! [cm]
+//!
+const double kMaxPointDistance = 1e4;
+
+//!
+//! Magnet closer than this to any sensor is not evaluated.
+//! [cm]
+//!
+const double kMinSensorDistance = 1.0;
+
+//!
+//! Optimizer constraints.
+//! [cm]
+//!
+const double kMinSensorSpacing = 2.0;
+
+
+struct FieldModel {
+	double moment;          // field = moment / r^exponent
+	double exponent;
+	double noise;           // standard deviation of magnitude
+	double saturation;      // maximal magnitude sensor can read
+};
+
+struct Grid {
+	double x0, x1;
+	double y0, y1;
+	double step;
+
+	int width() const { return (int) std::floor((x1 - x0) / step) + 1; }
+	int height() const { return (int) std::floor((y1 - y0) / step) + 1; }
+};
+
+struct Cell {
+	double error;           // mean over solved trials [cm]
+	double drop;            // trials without result
+	double degenerate;      // trials with degenerate circle
+	int solved;
+};
+
+struct Evaluation {
+	std::vector<Cell> cells;
+	double error;
+	double drop;
+	double degenerate;
+	double score;
+};
+
+
+//!
+//! Per thread scratch arrays, one slot per trial.
+//!
+struct Scratch {
+	std::vector<double> mag;        // [sensor][trial]
+	std::vector<double> lmag;
+	std::vector<double> ga;         // [pair][trial]
+	std::vector<double> gbx;
+	std::vector<double> gby;
+	std::vector<double> gc;
+	std::vector<double> best_res;
+	std::vector<double> best_x;
+	std::vector<double> best_y;
+	std::vector<uint8_t> degenerate;
+	std::vector<uint8_t> saturated;
+
+	Scratch(const size_t sensors, const size_t pairs, const size_t trials) :
+		mag(sensors * trials),
+		lmag(sensors * trials),
+		ga(pairs * trials),
+		gbx(pairs * trials),
+		gby(pairs * trials),
+		gc(pairs * trials),
+		best_res(trials),
+		best_x(trials),
+		best_y(trials),
+		degenerate(trials),
+		saturated(trials)
+	{
+
+	}
+};
+
+
+double dist2(const lm::Point &a, const lm::Point &b)
+{
+	return (a.x - b.x) * (a.x - b.x) + (a.y - b.y) * (a.y - b.y);
+}
+
+//!
+//! Circumcircle of the first three points, false if they are collinear.
+//!
+bool circumcircle(const lm::PointVector &p, lm::Point *center, double *r2)
+{
+	const double d = 2.0 * (p[0].x * (p[1].y - p[2].y)
+	                        + p[1].x * (p[2].y - p[0].y)
+	                        + p[2].x * (p[0].y - p[1].y));
+	if (std::fabs(d) < 1e-12)
+		return false;
+
+	const double a = p[0].x * p[0].x + p[0].y * p[0].y;
+	const double b = p[1].x * p[1].x + p[1].y * p[1].y;
+	const double c = p[2].x * p[2].x + p[2].y * p[2].y;
+
+	*center = lm::Point((a * (p[1].y - p[2].y) + b * (p[2].y - p[0].y)
+	                     + c * (p[0].y - p[1].y)) / d,
+	                    (a * (p[2].x - p[1].x) + b * (p[0].x - p[2].x)
+	                     + c * (p[1].x - p[0].x)) / d);
+	*r2 = dist2(p[0], *center);
+	return true;
+}
+
+
+class Evaluator
+{
+	const FieldModel model_;
+	const Grid grid_;
+	const int trials_;
+	const unsigned threads_;
+	const uint32_t seed_;
+	const double drop_penalty_;
+
+public:
+	Evaluator(const FieldModel &model, const Grid &grid, const int trials,
+	          const unsigned threads, const uint32_t seed,
+	          const double drop_penalty) :
+		model_(model),
+		grid_(grid),
+		trials_(trials),
+		threads_(threads),
+		seed_(seed),
+		drop_penalty_(drop_penalty)
+	{
+
+	}
+
+	void evaluate(const lm::PointVector &sensors, Evaluation *out) const;
+
+private:
+	void evaluate_cell(const lm::PointVector &sensors, const lm::Point &m,
+	                   std::mt19937 &rng, Scratch &s, Cell *cell) const;
+};
+
+
+void Evaluator::evaluate(const lm::PointVector &sensors,
+                         Evaluation *out) const
+{
+	const int w = grid_.width();
+	const int h = grid_.height();
+	const size_t n = sensors.size();
+
+	out->cells.assign(w * h, Cell());
+
+	std::atomic<int> next_row(0);
+	auto worker = [&]() {
+		Scratch s(n, n * (n - 1) / 2, trials_);
+		int row;
+		while ((row = next_row.fetch_add(1)) < h) {
+			for (int col = 0; col < w; ++col) {
+				//
+				// Seed depends on cell only, every layout sees
+				// the same noise there whatever it excludes.
+				//
+				std::mt19937 rng(seed_ * 7919u + row * w + col);
+				const lm::Point m(grid_.x0 + col * grid_.step,
+				                  grid_.y0 + row * grid_.step);
+				evaluate_cell(sensors, m, rng, s,
+				              &out->cells[row * w + col]);
+			}
+		}
+	};
+
+	std::vector<std::thread> pool;
+	for (unsigned t = 1; t < threads_; ++t)
+		pool.push_back(std::thread(worker));
+	worker();
+	for (auto &t : pool)
+		t.join();
+
+	//
+	// Excluded cells count as dropped, every layout is scored on the
+	// whole grid. Otherwise a layout would gain by excluding cells that
+	// are hard for it.
+	//
+	double err = 0.0, drop = 0.0, deg = 0.0, score = 0.0;
+	int counted = 0, solved_cells = 0;
+	for (auto &c : out->cells) {
+		++counted;
+		if (c.drop < 0.0) {
+			drop += 1.0;
+			score += drop_penalty_;
+			continue;
+		}
+		drop += c.drop;
+		deg += c.degenerate;
+		if (c.solved > 0) {
+			err += c.error;
+			++solved_cells;
+		}
+		score += (1.0 - c.drop) * std::min(c.error, drop_penalty_)
+		         + c.drop * drop_penalty_;
+	}
+
+	out->error = solved_cells ? err / solved_cells : 0.0;
+	out->drop = counted ? drop / counted : 1.0;
+	out->degenerate = counted ? deg / counted : 0.0;
+	out->score = counted ? score / counted : drop_penalty_;
+}
+
+void Evaluator::evaluate_cell(const lm::PointVector &sensors,
+                              const lm::Point &m, std::mt19937 &rng,
+                              Scratch &s, Cell *cell) const
+{
+	const size_t n = sensors.size();
+	const size_t T = trials_;
+	const double inv_exp = 1.0 / model_.exponent;
+
+	bool excluded = false;
+	for (auto &p : sensors)
+		excluded |= lm::dist(p, m) < kMinSensorDistance;
+
+	lm::Point cc;
+	double cr2 = 0.0;
+	const bool ambiguous = (n == 3) && circumcircle(sensors, &cc, &cr2);
+	if (ambiguous)
+		excluded |= dist2(m, cc) < cr2;
+
+	if (excluded) {
+		cell->drop = -1.0;
+		cell->solved = 0;
+		return;
+	}
+
+	//
+	// Forward model with noise.
+	//
+	std::normal_distribution<double> noise(0.0, model_.noise);
+	std::fill(s.saturated.begin(), s.saturated.end(), 0);
+	for (size_t k = 0; k < n; ++k) {
+		const double r = lm::dist(sensors[k], m);
+		const double b = model_.moment / std::pow(r, model_.exponent);
+		double *mag = &s.mag[k * T];
+		double *lmag = &s.lmag[k * T];
+
+		for (size_t t = 0; t < T; ++t)
+			mag[t] = b + noise(rng);
+
+		for (size_t t = 0; t < T; ++t) {
+			s.saturated[t] |= (mag[t] > model_.saturation);
+			mag[t] = std::max(mag[t], 1e-9);
+			lmag[t] = std::log(mag[t]) * inv_exp;
+		}
+	}
+
+	//
+	// Apollonius circle of every pair, |X - p| = rho |X - q| with
+	// rho = (B_q / B_p)^(1/exponent), laid out per trial for
+	// lm::apollonius_coefficients.
+	//
+	std::fill(s.degenerate.begin(), s.degenerate.end(), 0);
+	size_t pair = 0;
+	for (size_t i = 0; i < n; ++i) {
+		for (size_t j = i + 1; j < n; ++j, ++pair) {
+			const lm::Point &p = sensors[i];
+			const lm::Point &q = sensors[j];
+			const double *li = &s.lmag[i * T];
+			const double *lj = &s.lmag[j * T];
+			double *ga = &s.ga[pair * T];
+			double *gbx = &s.gbx[pair * T];
+			double *gby = &s.gby[pair * T];
+			double *gc = &s.gc[pair * T];
+
+			for (size_t t = 0; t < T; ++t) {
+				const double kk = std::exp(2.0 * (lj[t] - li[t]));
+				const lm::CircleCoefficients g =
+				        lm::apollonius_coefficients(p.x, p.y,
+				                                    q.x, q.y, kk);
+
+				ga[t] = g.a;
+				gbx[t] = g.bx;
+				gby[t] = g.by;
+				gc[t] = g.c;
+				s.degenerate[t] |= std::fabs(1.0 - kk)
+				                   < kDegenerateEpsilon;
+			}
+		}
+	}
+
+	//
+	// Intersections of every two circles, each is a candidate scored
+	// by consistency of its distances with all magnitudes.
+	//
+	std::fill(s.best_res.begin(), s.best_res.end(),
+	          std::numeric_limits<double>::infinity());
+
+	const size_t pairs = pair;
+	for (size_t a = 0; a < pairs; ++a) {
+		for (size_t b = a + 1; b < pairs; ++b) {
+			for (int root = -1; root <= 1; root += 2) {
+				for (size_t t = 0; t < T; ++t) {
+					const lm::CircleCoefficients g1 = {
+						s.ga[a * T + t], s.gbx[a * T + t],
+						s.gby[a * T + t], s.gc[a * T + t]
+					};
+					const lm::CircleCoefficients g2 = {
+						s.ga[b * T + t], s.gbx[b * T + t],
+						s.gby[b * T + t], s.gc[b * T + t]
+					};
+
+					double x, y;
+					const bool ok = lm::intersection_root(g1, g2,
+					        root, kMaxPointDistance, &x, &y);
+
+					double sum = 0.0, sum2 = 0.0;
+					for (size_t k = 0; k < n; ++k) {
+						const double ex = x - sensors[k].x;
+						const double ey = y - sensors[k].y;
+						const double v = 0.5 * std::log(ex * ex
+						                 + ey * ey + 1e-12)
+						                 + s.lmag[k * T + t];
+						sum += v;
+						sum2 += v * v;
+					}
+					const double ddx = x - cc.x;
+					const double ddy = y - cc.y;
+					const bool inside = ambiguous &&
+					        ddx * ddx + ddy * ddy < cr2;
+					const double res = sum2 - sum * sum / n
+					                   + (inside ? 1e6 : 0.0);
+
+					const bool better = ok && res < s.best_res[t];
+					s.best_res[t] = better ? res : s.best_res[t];
+					s.best_x[t] = better ? x : s.best_x[t];
+					s.best_y[t] = better ? y : s.best_y[t];
+				}
+			}
+		}
+	}
+
+	int solved = 0, dropped = 0, degenerate = 0;
+	double err = 0.0;
+	for (size_t t = 0; t < T; ++t) {
+		const bool drop = s.saturated[t] || std::isinf(s.best_res[t]);
+		degenerate += s.degenerate[t];
+		if (drop) {
+			++dropped;
+			continue;
+		}
+		++solved;
+		err += std::hypot(s.best_x[t] - m.x, s.best_y[t] - m.y);
+	}
+
+	cell->solved = solved;
+	cell->error = solved ? err / solved : 0.0;
+	cell->drop = (double) dropped / T;
+	cell->degenerate = (double) degenerate / T;
+}
+
+
+int parse_layout(const char *arg, lm::PointVector *sensors)
+{
+	sensors->clear();
+
+	const char *p = arg;
+	while (*p != '\0') {
+		double x, y;
+		int len;
+		if (sscanf(p, "%lf,%lf%n", &x, &y, &len) != 2) {
+			fprintf(stderr, "Invalid layout %s, expected "
+			        "x,y:x,y:...\n", arg);
+			return -1;
+		}
+		sensors->push_back(lm::Point(x, y));
+		p += len;
+		if (*p == ':')
+			++p;
+	}
+
+	if (sensors->size() < 3) {
+		fprintf(stderr, "Layout needs at least 3 sensors.\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+int parse_grid(const char *arg, Grid *grid)
+{
+	if (sscanf(arg, "%lf:%lf:%lf:%lf:%lf", &grid->x0, &grid->x1,
+	           &grid->y0, &grid->y1, &grid->step) != 5 ||
+	    grid->step <= 0.0 || grid->x0 > grid->x1 || grid->y0 > grid->y1) {
+		fprintf(stderr, "Invalid grid %s, expected x0:x1:y0:y1:step\n",
+		        arg);
+		return -1;
+	}
+
+	return 0;
+}
+
+void print_layout(FILE *out, const lm::PointVector &sensors)
+{
+	for (size_t i = 0; i < sensors.size(); ++i)
+		fprintf(out, "%s%.2f,%.2f", i ? ":" : "", sensors[i].x,
+		        sensors[i].y);
+}
+
+void print_evaluation(const lm::PointVector &sensors, const Evaluation &e)
+{
+	fprintf(stderr, "layout ");
+	print_layout(stderr, sensors);
+	fprintf(stderr, "\n  error %.3f cm  drop %.2f %%  degenerate %.2f %%"
+	        "  score %.3f\n", e.error, 100.0 * e.drop,
+	        100.0 * e.degenerate, e.score);
+}
+
+bool valid_layout(const lm::PointVector &sensors, const double extent)
+{
+	for (size_t i = 0; i < sensors.size(); ++i) {
+		if (std::fabs(sensors[i].x) > extent ||
+		    std::fabs(sensors[i].y) > extent)
+			return false;
+		for (size_t j = i + 1; j < sensors.size(); ++j)
+			if (lm::dist(sensors[i], sensors[j]) < kMinSensorSpacing)
+				return false;
+	}
+	return true;
+}
+
+int write_csv(const std::string &path, const Grid &grid,
+              const Evaluation &e)
+{
+	FILE *f = fopen(path.c_str(), "w");
+	if (f == nullptr) {
+		fprintf(stderr, "Unable to open %s\n", path.c_str());
+		return -1;
+	}
+
+	fprintf(f, "x,y,error,drop,degenerate\n");
+	const int w = grid.width();
+	for (int row = 0; row < grid.height(); ++row) {
+		for (int col = 0; col < w; ++col) {
+			const Cell &c = e.cells[row * w + col];
+			if (c.drop < 0.0)
+				continue;
+			fprintf(f, "%.2f,%.2f,%.4f,%.4f,%.4f\n",
+			        grid.x0 + col * grid.step,
+			        grid.y0 + row * grid.step,
+			        c.error, c.drop, c.degenerate);
+		}
+	}
+
+	fclose(f);
+	return 0;
+}
+
+//!
+//! 8-bit grayscale heatmap, white is vmax or more, north up.
+//!
+int write_pgm(const std::string &path, const Grid &grid, const Evaluation &e,
+              double Cell::*value, const double vmax)
+{
+	FILE *f = fopen(path.c_str(), "wb");
+	if (f == nullptr) {
+		fprintf(stderr, "Unable to open %s\n", path.c_str());
+		return -1;
+	}
+
+	const int w = grid.width();
+	const int h = grid.height();
+	fprintf(f, "P5\n%d %d\n255\n", w, h);
+
+	std::vector<uint8_t> line(w);
+	for (int row = h - 1; row >= 0; --row) {
+		for (int col = 0; col < w; ++col) {
+			const Cell &c = e.cells[row * w + col];
+			const double v = (c.drop < 0.0) ? vmax : c.*value;
+			line[col] = (uint8_t) (255.0 * std::min(v / vmax, 1.0));
+		}
+		fwrite(line.data(), 1, w, f);
+	}
+
+	fclose(f);
+	return 0;
+}
+
+void print_usage(const char *name)
+{
+	fprintf(stderr,
+	        "usage: %s [options]\n"
+	        "\n"
+	        "  -L <x,y:x,y:...>     sensor layout [cm], default is the device\n"
+	        "  -m <moment>          field = moment / r^exponent (400000)\n"
+	        "  -e <exponent>        (3)\n"
+	        "  -n <noise>           magnitude standard deviation (3)\n"
+	        "  -S <saturation>      largest readable magnitude (4090)\n"
+	        "  -g <x0:x1:y0:y1:step> magnet grid [cm] (-20:20:-15:25:1)\n"
+	        "  -t <trials>          noise samples per grid point (64)\n"
+	        "  -P <penalty>         error charged for dropped frame [cm] (10)\n"
+	        "  -O <iterations>      optimize layout\n"
+	        "  -R <extent>          optimized sensors stay within +-extent (10)\n"
+	        "  -c <csv>             write grid results\n"
+	        "  -p <prefix>          write <prefix>-error.pgm, -drop.pgm,\n"
+	        "                       -degenerate.pgm heatmaps\n"
+	        "  -j <threads>         worker threads\n"
+	        "  -s <seed>\n",
+	        name);
+}
+
+
+} // namespace
+
+
+int main(int argc, char *argv[])
+{
+	lm::PointVector sensors = lm::PipelineConfig().sensors;
+	FieldModel model = { 400000.0, 3.0, 3.0, 4090.0 };
+	Grid grid = { -20.0, 20.0, -15.0, 25.0, 1.0 };
+	int trials = 64;
+	double penalty = 10.0;
+	int iterations = 0;
+	double extent = 10.0;
+	std::string csv_path;
+	std::string pgm_prefix;
+	unsigned threads = std::thread::hardware_concurrency();
+	uint32_t seed = 1;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "L:m:e:n:S:g:t:P:O:R:c:p:j:s:h")) != -1) {
+		int status = 0;
+		switch (opt) {
+		case 'L':
+			status = parse_layout(optarg, &sensors);
+			break;
+		case 'm':
+			model.moment = atof(optarg);
+			break;
+		case 'e':
+			model.exponent = atof(optarg);
+			break;
+		case 'n':
+			model.noise = atof(optarg);
+			break;
+		case 'S':
+			model.saturation = atof(optarg);
+			break;
+		case 'g':
+			status = parse_grid(optarg, &grid);
+			break;
+		case 't':
+			trials = atoi(optarg);
+			break;
+		case 'P':
+			penalty = atof(optarg);
+			break;
+		case 'O':
+			iterations = atoi(optarg);
+			break;
+		case 'R':
+			extent = atof(optarg);
+			break;
+		case 'c':
+			csv_path = optarg;
+			break;
+		case 'p':
+			pgm_prefix = optarg;
+			break;
+		case 'j':
+			threads = atoi(optarg);
+			break;
+		case 's':
+			seed = atol(optarg);
+			break;
+		default:
+			print_usage(argv[0]);
+			return (opt == 'h') ? 0 : -1;
+		}
+		if (status != 0)
+			return -1;
+	}
+
+	if (trials <= 0 || model.exponent <= 0.0 || model.moment <= 0.0) {
+		print_usage(argv[0]);
+		return -1;
+	}
+
+	const Evaluator evaluator(model, grid, trials, std::max(1u, threads),
+	                          seed, penalty);
+
+	Evaluation best;
+	evaluator.evaluate(sensors, &best);
+	print_evaluation(sensors, best);
+
+	//
+	// Random local search, step shrinks as the search goes on.
+	//
+	std::mt19937 rng(seed);
+	std::uniform_int_distribution<size_t> pick(0, sensors.size() - 1);
+	for (int it = 0; it < iterations; ++it) {
+		const double sigma = 2.0 * (1.0 - (double) it / iterations) + 0.1;
+		std::normal_distribution<double> step(0.0, sigma);
+
+		lm::PointVector candidate = sensors;
+		lm::Point &p = candidate[pick(rng)];
+		p = lm::Point(p.x + step(rng), p.y + step(rng));
+		if (!valid_layout(candidate, extent))
+			continue;
+
+		Evaluation e;
+		evaluator.evaluate(candidate, &e);
+		if (e.score < best.score) {
+			sensors = candidate;
+			best = e;
+			fprintf(stderr, "[%d] ", it);
+			print_evaluation(sensors, best);
+		}
+	}
+
+	if (iterations > 0) {
+		print_layout(stdout, sensors);
+		putchar('\n');
+	}
+
+	if (!csv_path.empty() && write_csv(csv_path, grid, best) != 0)
+		return -1;
+
+	if (!pgm_prefix.empty() &&
+	    (write_pgm(pgm_prefix + "-error.pgm", grid, best, &Cell::error,
+	               penalty) != 0 ||
+	     write_pgm(pgm_prefix + "-drop.pgm", grid, best, &Cell::drop,
+	               1.0) != 0 ||
+	     write_pgm(pgm_prefix + "-degenerate.pgm", grid, best,
+	               &Cell::degenerate, 1.0) != 0))
+		return -1;
+
+	return 0;
+}
@@ -0,0 +1,268 @@
+//------------------------------------------------------------------------------
+// The MIT License (MIT)
+//
+// Copyright (c) 2015 Lukáš Mandák <lukas.mandak@yandex.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//
+// sources.cpp
+//
+// magneto-sources [-n sensors] [-r radius] [-k magnets] [-R from:to]
+//                 [-b budget] [-S frames] [-m moment] [-z height] [-s seed]
+//
+// Evaluates tracking of several magnets at once on synthetic frames. Magnets
+// are point dipoles wandering in and out around the sensors, the tracker gets
+// their field with environment removed and sensors over range left out, as
+// the pipeline gives it. Reports frames with wrong count of published
+// sources, degraded lists, switches of ids, position error of the tracks
+// and time of the update.
+//
+//------------------------------------------------------------------------------
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <getopt.h>
+
+#include "geometry.hpp"
+#include "latency.hpp"
+#include "pipeline.hpp"
+#include "process.hpp"
+#include "shared.hpp"
+#include "sources.hpp"
+#include "synth.hpp"
+
+
+namespace {
+
+
+//!
+//! Source published farther than this from a magnet is not its track.
+//! [cm]
+//!
+const double kMatchDistance = 3.0;
+
+
+double percentile(std::vector<double> v, const double p)
+{
+	if (v.empty())
+		return 0.0;
+
+	const size_t k = (size_t) (p * (v.size() - 1));
+	std::nth_element(v.begin(), v.begin() + k, v.end());
+	return v[k];
+}
+
+//!
+//! One sensor at center, the others evenly on ring around it.
+//!
+lm::PointVector ring_layout(const size_t count, const double radius)
+{
+	lm::PointVector sensors(1, lm::Point(0.0, 0.0));
+	for (size_t i = 1; i < count; ++i) {
+		const double a = 2.0 * M_PI * (i - 1) / (count - 1);
+		sensors.push_back(lm::Point(radius * std::cos(a),
+		                            radius * std::sin(a)));
+	}
+	return sensors;
+}
+
+void print_usage(const char *name)
+{
+	fprintf(stderr,
+	        "usage: %s [options]\n"
+	        "\n"
+	        "  -n <sensors>   on ring around the center one, default is\n"
+	        "                 the device\n"
+	        "  -r <radius>    of the ring [cm] (8)\n"
+	        "  -k <magnets>   wandering independently (1)\n"
+	        "  -R <from:to>   magnets stay within ring around center [cm]\n"
+	        "                 (2:14)\n"
+	        "  -b <budget>    time of one update [us] (100)\n"
+	        "  -S <frames>    (3000)\n"
+	        "  -m <moment>    of dipoles [field units * cm^3] (150000)\n"
+	        "  -z <height>    of magnets above sensors [cm] (3)\n"
+	        "  -s <seed>\n",
+	        name);
+}
+
+
+} // namespace
+
+
+int main(int argc, char *argv[])
+{
+	lm::PipelineConfig config;
+	lm::SynthConfig sc;
+	size_t sensor_cnt = 0;
+	double radius = 8.0;
+	double budget = 100.0;
+	size_t frame_cnt = 3000;
+	int opt;
+
+	sc.magnets = 1;
+	sc.radius_min = 2.0;
+	sc.radius_max = 14.0;
+	sc.moment = 150000.0;
+	sc.height = 3.0;
+	sc.axis = { 0.0, 0.0, 1.0 };
+
+	while ((opt = getopt(argc, argv, "n:r:k:R:b:S:m:z:s:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			sensor_cnt = atol(optarg);
+			break;
+		case 'r':
+			radius = atof(optarg);
+			break;
+		case 'k':
+			sc.magnets = atol(optarg);
+			break;
+		case 'R':
+			if (sscanf(optarg, "%lf:%lf", &sc.radius_min,
+			           &sc.radius_max) != 2 ||
+			    sc.radius_min > sc.radius_max) {
+				fprintf(stderr, "Invalid ring %s, expected "
+				        "from:to\n", optarg);
+				return -1;
+			}
+			break;
+		case 'b':
+			budget = atof(optarg);
+			break;
+		case 'S':
+			frame_cnt = atol(optarg);
+			break;
+		case 'm':
+			sc.moment = atof(optarg);
+			break;
+		case 'z':
+			sc.height = atof(optarg);
+			break;
+		case 's':
+			sc.seed = atol(optarg);
+			break;
+		default:
+			print_usage(argv[0]);
+			return (opt == 'h') ? 0 : -1;
+		}
+	}
+
+	if (sensor_cnt != 0 && (sensor_cnt < 3 || sensor_cnt > 32)) {
+		fprintf(stderr, "Sensors must be 3 to 32.\n");
+		return -1;
+	}
+	if (sensor_cnt != 0) {
+		config.sensors = ring_layout(sensor_cnt, radius);
+		sc.sensors = config.sensors;
+		sc.center = lm::Point(0.0, 0.0);
+	}
+
+	lm::SourceTracker tracker(config.sources_max, config.dipole_height,
+	                          config.tracker_range, config.cluster_gate,
+	                          config.presence_enter_sigma
+	                          * config.magnitude_noise,
+	                          config.presence_exit_sigma
+	                          * config.magnitude_noise);
+	if (tracker.initialize(config.sensors) != 0) {
+		fprintf(stderr, "Unable to initialize tracker.\n");
+		return -1;
+	}
+
+	std::vector<lm::SynthFrame> frames;
+	lm::synth_generate(sc, frame_cnt, &frames);
+
+	const size_t n = config.sensors.size();
+	std::vector<double> field;
+	std::vector<uint32_t> last_id(sc.magnets, 0);
+	std::vector<double> errors;
+	std::vector<double> times;
+	uint64_t wrong = 0, degraded = 0, switches = 0;
+
+	for (size_t f = 0; f < frames.size(); ++f) {
+		const lm::SynthFrame &frame = frames[f];
+		uint32_t saturated = 0;
+		lm::axes_to_field(frame.axes, n, &field, &saturated);
+		const size_t env = std::min(field.size(),
+		                            sc.environment.size());
+		for (size_t i = 0; i < env; ++i)
+			field[i] -= sc.environment[i];
+
+		const uint64_t start = lm::monotonic_ns();
+		tracker.update(field, saturated, f,
+		               start + (uint64_t) (1000.0 * budget));
+		times.push_back((lm::monotonic_ns() - start) / 1000.0);
+
+		const lm::SourceList &list = tracker.get_list();
+		degraded += list.degraded;
+
+		//
+		// Every magnet is matched with the nearest published source.
+		//
+		uint32_t present = 0;
+		for (size_t m = 0; m < frame.source.size(); ++m) {
+			const lm::SynthSource &s = frame.source[m];
+			if (!s.present)
+				continue;
+			++present;
+
+			double best = kMatchDistance;
+			uint32_t id = 0;
+			for (uint32_t i = 0; i < list.count; ++i) {
+				const double *p = list.source[i].position;
+				const double dx = p[0] - s.position.x;
+				const double dy = p[1] - s.position.y;
+				const double dz = p[2] - frame.height;
+				const double d = std::sqrt(dx * dx + dy * dy
+				                           + dz * dz);
+				if (d < best) {
+					best = d;
+					id = list.source[i].id;
+				}
+			}
+			if (id == 0)
+				continue;
+
+			errors.push_back(best);
+			switches += (last_id[m] != 0 && last_id[m] != id);
+			last_id[m] = id;
+		}
+		wrong += (list.count != present);
+	}
+
+	const double total = std::max<size_t>(frames.size(), 1);
+	printf("%zu sensors, %zu magnets, %zu frames, budget %.0f us\n",
+	       n, sc.magnets, frames.size(), budget);
+	printf("  wrong count %6.2f %%\n", 100.0 * wrong / total);
+	printf("  degraded    %6.2f %%\n", 100.0 * degraded / total);
+	printf("  id switches %6llu\n", (unsigned long long) switches);
+	printf("  error [cm]  p50 %.3f  p90 %.3f  p99 %.3f\n",
+	       percentile(errors, 0.5), percentile(errors, 0.9),
+	       percentile(errors, 0.99));
+	printf("  update [us] p50 %.1f  p99 %.1f  max %.1f\n",
+	       percentile(times, 0.5), percentile(times, 0.99),
+	       percentile(times, 1.0));
+
+	return 0;
+}
@@ -0,0 +1,209 @@
+//------------------------------------------------------------------------------
+// The MIT License (MIT)
+//
+// Copyright (c) 2015 Lukáš Mandák <lukas.mandak@yandex.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//
+// stat.cpp
+//
+// magneto-stat [interval [count]]
+// magneto-stat -i
+// magneto-stat -s
+//
+// Prints rates of the counters kept by process in the shared segment,
+// one line per interval, in the manner of vmstat. With -i prints current
+// hard and soft iron corrections of the sensors instead, with -s sources
+// tracked by process -m.
+//
+//------------------------------------------------------------------------------
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+
+#include <unistd.h>
+
+#include "latency.hpp"
+#include "shared.hpp"
+
+
+namespace {
+
+
+//!
+//! Header is repeated after this many lines.
+//!
+const int kHeaderInterval = 20;
+
+
+void print_header()
+{
+	printf("%8s %7s %7s %7s %7s %7s %7s %7s %5s %5s %7s %7s %7s %9s %9s "
+	       "%9s\n",
+	       "in/s", "perr/s", "sat/s", "deg/s", "abs/s", "miss/s", "tri/s",
+	       "err/s", "enter", "exit", "reu/s", "trk/s", "pub/s", "parse_us", "solve_us", "pub_us");
+}
+
+double rate(const uint64_t diff, const double seconds)
+{
+	return (seconds > 0.0) ? diff / seconds : 0.0;
+}
+
+double per_frame_us(const uint64_t ns, const uint64_t frames)
+{
+	return (frames > 0) ? ns / 1e3 / frames : 0.0;
+}
+
+void print_iron(lm::Shared &shared)
+{
+	lm::IronCorrection iron[MD_SENSOR_COUNT];
+	const uint64_t generation = shared.get_iron(iron);
+
+	printf("generation %llu\n", (unsigned long long) generation);
+	for (int i = 0; i < MD_SENSOR_COUNT; ++i) {
+		const lm::IronCorrection &c = iron[i];
+		printf("sensor %d  samples %llu  residual %.5f\n", i,
+		       (unsigned long long) c.samples, c.residual);
+		printf("  offset  %9.2f %9.2f %9.2f\n",
+		       c.offset[0], c.offset[1], c.offset[2]);
+		for (int r = 0; r < MD_AXIS_COUNT; ++r)
+			printf("  %s  %9.5f %9.5f %9.5f\n",
+			       (r == 0) ? "matrix" : "      ",
+			       c.matrix[3 * r], c.matrix[3 * r + 1],
+			       c.matrix[3 * r + 2]);
+	}
+}
+
+
+void print_sources(lm::Shared &shared)
+{
+	lm::SourceList sources;
+	const uint64_t updates = shared.get_sources(&sources);
+
+	printf("updates %llu  frame %llu%s\n", (unsigned long long) updates,
+	       (unsigned long long) sources.sequence,
+	       sources.degraded ? "  degraded" : "");
+	for (uint32_t i = 0; i < sources.count; ++i) {
+		const lm::SourceState &s = sources.source[i];
+		printf("source %u  age %u  missed %u\n", s.id, s.age, s.missed);
+		printf("  position %9.2f %9.2f %9.2f\n",
+		       s.position[0], s.position[1], s.position[2]);
+		printf("  moment   %9.0f %9.0f %9.0f\n",
+		       s.moment[0], s.moment[1], s.moment[2]);
+	}
+}
+
+
+} // namespace
+
+
+int main(int argc, char *argv[])
+{
+	double interval = 1.0;
+	long count = -1;
+	const bool iron = (argc > 1 && strcmp(argv[1], "-i") == 0);
+	const bool sources = (argc > 1 && strcmp(argv[1], "-s") == 0);
+
+	if (argc > 1 && !iron && !sources)
+		interval = atof(argv[1]);
+	if (argc > 2)
+		count = atol(argv[2]);
+
+	if (interval <= 0.0) {
+		fprintf(stderr, "usage: %s [interval [count]] | -i | -s\n",
+		        argv[0]);
+		return -1;
+	}
+
+	lm::Shared shared;
+	if (shared.attach() != 0) {
+		fprintf(stderr, "Is process running?\n");
+		return -1;
+	}
+
+	if (iron) {
+		print_iron(shared);
+		return 0;
+	}
+
+	if (sources) {
+		print_sources(shared);
+		return 0;
+	}
+
+	uint64_t prev[lm::STAT_COUNT];
+	for (int i = 0; i < lm::STAT_COUNT; ++i)
+		prev[i] = shared.get_count((lm::StatCounter) i);
+	uint64_t prev_time = lm::monotonic_ns();
+
+	for (long line = 0; count < 0 || line < count; ++line) {
+		usleep((useconds_t) (interval * 1e6));
+
+		uint64_t cur[lm::STAT_COUNT];
+		uint64_t d[lm::STAT_COUNT];
+		for (int i = 0; i < lm::STAT_COUNT; ++i) {
+			cur[i] = shared.get_count((lm::StatCounter) i);
+			d[i] = cur[i] - prev[i];
+			prev[i] = cur[i];
+		}
+		const uint64_t now = lm::monotonic_ns();
+		const double seconds = (now - prev_time) / 1e9;
+		prev_time = now;
+
+		if (line % kHeaderInterval == 0)
+			print_header();
+
+		//
+		// Stage times are averaged over frames that reached given stage.
+		//
+		const uint64_t parsed = d[lm::STAT_FRAMES_IN]
+		                        - d[lm::STAT_PARSE_ERRORS];
+		const uint64_t solved = parsed
+		                        - d[lm::STAT_SATURATED]
+		                        - d[lm::STAT_SOURCE_ABSENT]
+		                        - d[lm::STAT_MISSING_SOLUTIONS]
+		                        - d[lm::STAT_TRIANGLE_FAILED]
+		                        - d[lm::STAT_PROCESS_ERRORS];
+
+		printf("%8.1f %7.1f %7.1f %7.1f %7.1f %7.1f %7.1f %7.1f "
+		       "%5llu %5llu %7.1f %7.1f %7.1f %9.1f %9.1f %9.1f\n",
+		       rate(d[lm::STAT_FRAMES_IN], seconds),
+		       rate(d[lm::STAT_PARSE_ERRORS], seconds),
+		       rate(d[lm::STAT_SATURATED], seconds),
+		       rate(d[lm::STAT_DEGRADED], seconds),
+		       rate(d[lm::STAT_SOURCE_ABSENT], seconds),
+		       rate(d[lm::STAT_MISSING_SOLUTIONS], seconds),
+		       rate(d[lm::STAT_TRIANGLE_FAILED], seconds),
+		       rate(d[lm::STAT_PROCESS_ERRORS], seconds),
+		       (unsigned long long) d[lm::STAT_SOURCE_ENTER],
+		       (unsigned long long) d[lm::STAT_SOURCE_EXIT],
+		       rate(d[lm::STAT_REUSED], seconds),
+		       rate(d[lm::STAT_TRACKED], seconds),
+		       rate(d[lm::STAT_PUBLISHED], seconds),
+		       per_frame_us(d[lm::STAT_PARSE_NS], parsed),
+		       per_frame_us(d[lm::STAT_SOLVE_NS], solved),
+		       per_frame_us(d[lm::STAT_PUBLISH_NS],
+		                    d[lm::STAT_PUBLISHED]));
+		fflush(stdout);
+	}
+
+	return 0;
+}
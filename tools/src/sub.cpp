@@ -0,0 +1,118 @@
+//------------------------------------------------------------------------------
+// The MIT License (MIT)
+//
+// Copyright (c) 2015 Lukáš Mandák <lukas.mandak@yandex.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//
+// sub.cpp
+//
+// magneto-sub <stream> [count]
+//
+// Subscribes to records streamed by process through unix or mcast sink
+// and prints them together with number of lost records.
+//
+//------------------------------------------------------------------------------
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+
+#include <atomic>
+#include <vector>
+
+#include "publish.hpp"
+#include "record.hpp"
+
+
+namespace {
+
+
+//!
+//! How long to wait for a datagram before checking for interrupt [ms].
+//!
+const int kReceiveTimeout = 500;
+
+
+std::atomic<bool> g_stop(false);
+
+
+void signal_handler(int signum)
+{
+	(void) signum;
+	g_stop.store(true);
+}
+
+
+} // namespace
+
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s unix:<socket>|mcast:<group>:<port>"
+		        "[:<iface>] [count]\n", argv[0]);
+		return -1;
+	}
+
+	const long count = (argc > 2) ? atol(argv[2]) : -1;
+
+	signal(SIGINT, signal_handler);
+	signal(SIGTERM, signal_handler);
+
+	lm::Subscriber sub;
+	if (sub.open(argv[1]) != 0)
+		return -1;
+
+	std::vector<lm::Record> records;
+	long printed = 0;
+	uint64_t lost = 0;
+
+	while (!g_stop.load() && (count < 0 || printed < count)) {
+		records.clear();
+		if (sub.receive(&records, kReceiveTimeout) < 0) {
+			fprintf(stderr, "Stream closed.\n");
+			break;
+		}
+
+		if (sub.get_lost() != lost) {
+			printf("# lost %llu records\n",
+			       (unsigned long long) (sub.get_lost() - lost));
+			lost = sub.get_lost();
+		}
+
+		for (auto &r : records) {
+			if (!(r.flags & RECORD_FLAG_VALID))
+				continue;
+
+			printf("%llu\t%llu\t%.2lf\t%.2lf\n",
+			       (unsigned long long) r.sequence,
+			       (unsigned long long) r.time,
+			       r.result[0], r.result[1]);
+			if (count >= 0 && ++printed >= count)
+				break;
+		}
+		fflush(stdout);
+	}
+
+	fprintf(stderr, "received %llu, lost %llu\n",
+	        (unsigned long long) sub.get_received(),
+	        (unsigned long long) sub.get_lost());
+	return 0;
+}
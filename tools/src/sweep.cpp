@@ -0,0 +1,492 @@
+//------------------------------------------------------------------------------
+// The MIT License (MIT)
+//
+// Copyright (c) 2015 Lukáš Mandák <lukas.mandak@yandex.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//
+// sweep.cpp
+//
+// magneto-sweep [-j threads] [-n random] [-S frames] [-t|-e|-x|-l|-i|-f range]
+//               [capture]...
+//
+// Evaluates detection and calibration constants of the pipeline over a grid
+// of ranges "from:to:step", or over given number of random configurations
+// drawn from the same ranges. Input frames are parsed once and shared by all
+// workers. Synthetic input (-S) carries ground truth, so precision, recall and
+// position error are reported as well; recorded captures give skip rates only.
+// One CSV line per configuration goes to stdout.
+//
+//------------------------------------------------------------------------------
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <fstream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <getopt.h>
+
+#include "archive.hpp"
+#include "geometry.hpp"
+#include "latency.hpp"
+#include "pipeline.hpp"
+#include "process.hpp"
+#include "shared.hpp"
+#include "synth.hpp"
+
+
+namespace {
+
+
+struct Range {
+	double from;
+	double to;
+	double step;
+};
+
+//!
+//! Default ranges around the hand-tuned values.
+//!
+const Range kDefaultTreshold = { 10.0, 60.0, 10.0 };
+const Range kDefaultEnterSigma = { 6.0, 6.0, 0.0 };
+const Range kDefaultExitSigma = { 3.0, 3.0, 0.0 };
+const Range kDefaultLoops = { 5.0, 45.0, 10.0 };
+const Range kDefaultSpeedInitial = { 0.55, 0.95, 0.2 };
+const Range kDefaultSpeedFactor = { 0.0, 0.02, 0.01 };
+
+
+//!
+//! Parsed frame, shared read-only between workers.
+//!
+struct Frame {
+	std::vector<double> field;
+	uint32_t saturated;
+	lm::FrameStatus parse_status;
+	bool present;
+	lm::Point position;
+};
+
+struct Dataset {
+	std::vector<Frame> frames;
+	bool has_truth;
+};
+
+struct Result {
+	lm::PipelineConfig config;
+	uint64_t status[lm::FRAME_STATUS_COUNT];
+	uint64_t tp;
+	uint64_t fp;
+	uint64_t fn;
+	double error_mean;
+	double error_p95;
+};
+
+
+int parse_range(const char *arg, Range *range)
+{
+	if (sscanf(arg, "%lf:%lf:%lf", &range->from, &range->to,
+	           &range->step) == 3 && range->step >= 0.0 &&
+	    range->from <= range->to)
+		return 0;
+
+	if (sscanf(arg, "%lf", &range->from) == 1) {
+		range->to = range->from;
+		range->step = 0.0;
+		return 0;
+	}
+
+	fprintf(stderr, "Invalid range %s, expected from:to:step\n", arg);
+	return -1;
+}
+
+std::vector<double> range_values(const Range &r)
+{
+	std::vector<double> v;
+	if (r.step <= 0.0) {
+		v.push_back(r.from);
+		return v;
+	}
+
+	for (int i = 0; r.from + i * r.step <= r.to + 1e-9; ++i)
+		v.push_back(r.from + i * r.step);
+	return v;
+}
+
+void add_frame(Dataset *data, const std::vector<int> &axes)
+{
+	Frame f;
+	f.present = false;
+
+	const int status = lm::axes_to_field(axes, MD_SENSOR_COUNT, &f.field,
+	                                     &f.saturated);
+	f.parse_status = (status >= 0) ? lm::FRAME_OK : lm::FRAME_PARSE_ERROR;
+	data->frames.push_back(f);
+}
+
+int load_capture(const std::string &path, Dataset *data)
+{
+	std::vector<int> axes(ARCHIVE_CHANNELS);
+	const size_t n = path.size();
+
+	if (n > 4 && path.compare(n - 4, 4, ".mga") == 0) {
+		lm::ArchiveReader reader;
+		if (reader.open(path) != 0)
+			return -1;
+
+		lm::ArchiveColumns col;
+		for (size_t b = 0; b < reader.get_block_cnt(); ++b) {
+			if (reader.decode_block(b, &col) != 0)
+				return -1;
+			for (size_t k = 0; k < col.size(); ++k) {
+				for (int a = 0; a < ARCHIVE_CHANNELS; ++a)
+					axes[a] = col.axis[a][k];
+				add_frame(data, axes);
+			}
+		}
+		return 0;
+	}
+
+	std::ifstream in(path);
+	if (!in) {
+		fprintf(stderr, "Unable to open %s\n", path.c_str());
+		return -1;
+	}
+
+	std::string line;
+	while (std::getline(in, line)) {
+		uint64_t time;
+		if (lm::parse_capture_line(line, &time, &axes) < 0) {
+			Frame f;
+			f.saturated = 0;
+			f.parse_status = lm::FRAME_PARSE_ERROR;
+			f.present = false;
+			data->frames.push_back(f);
+			continue;
+		}
+		add_frame(data, axes);
+	}
+
+	return 0;
+}
+
+void evaluate(const Dataset &data, Result *res)
+{
+	lm::Pipeline pipeline(res->config);
+	pipeline.initialize();
+
+	std::fill(res->status, res->status + lm::FRAME_STATUS_COUNT, 0);
+	res->tp = res->fp = res->fn = 0;
+
+	std::vector<double> errors;
+	uint64_t seq = 0;
+
+	for (const Frame &f : data.frames) {
+		if (f.parse_status != lm::FRAME_OK) {
+			++res->status[f.parse_status];
+			continue;
+		}
+
+		if (!pipeline.is_calibrated()) {
+			pipeline.calibrate(f.field, f.saturated);
+			continue;
+		}
+
+		lm::MagnetoData out;
+		const lm::FrameStatus status = pipeline.solve(f.field, ++seq,
+		                                              &out, f.saturated);
+		++res->status[status];
+
+		if (!data.has_truth)
+			continue;
+
+		const bool detected = (status != lm::FRAME_SOURCE_ABSENT);
+		if (detected && f.present)
+			++res->tp;
+		else if (detected)
+			++res->fp;
+		else if (f.present)
+			++res->fn;
+
+		if (status == lm::FRAME_OK && f.present)
+			errors.push_back(lm::dist(out.result, f.position));
+	}
+
+	res->error_mean = 0.0;
+	res->error_p95 = 0.0;
+	if (!errors.empty()) {
+		double sum = 0.0;
+		for (double e : errors)
+			sum += e;
+		res->error_mean = sum / errors.size();
+
+		const size_t k = (size_t) (0.95 * (errors.size() - 1));
+		std::nth_element(errors.begin(), errors.begin() + k, errors.end());
+		res->error_p95 = errors[k];
+	}
+}
+
+double ratio(const uint64_t a, const uint64_t b)
+{
+	return (b > 0) ? (double) a / b : 0.0;
+}
+
+void print_result(const Result &r, const bool has_truth)
+{
+	const lm::PipelineConfig &c = r.config;
+	printf("%.3f,%.2f,%.2f,%d,%.3f,%.4f,", c.detection_treshold,
+	       c.presence_enter_sigma, c.presence_exit_sigma,
+	       c.calibration_loops, c.calibration_speed_initial,
+	       c.calibration_speed_factor);
+
+	if (has_truth) {
+		const double precision = ratio(r.tp, r.tp + r.fp);
+		const double recall = ratio(r.tp, r.tp + r.fn);
+		const double f1 = (precision + recall > 0.0)
+		                  ? 2 * precision * recall / (precision + recall)
+		                  : 0.0;
+		printf("%.4f,%.4f,%.4f,", precision, recall, f1);
+	} else {
+		printf(",,,");
+	}
+
+	uint64_t total = 0;
+	for (int s = 0; s < lm::FRAME_STATUS_COUNT; ++s)
+		total += r.status[s];
+	for (int s = 0; s < lm::FRAME_STATUS_COUNT; ++s)
+		printf("%.4f,", ratio(r.status[s], total));
+
+	if (has_truth)
+		printf("%.3f,%.3f\n", r.error_mean, r.error_p95);
+	else
+		printf(",\n");
+}
+
+void print_usage(const char *name)
+{
+	fprintf(stderr,
+	        "usage: %s [options] [capture]...\n"
+	        "\n"
+	        "  -j <threads>   worker threads\n"
+	        "  -n <count>     random search with count configurations\n"
+	        "  -s <seed>      seed of random search and synthetic data\n"
+	        "  -S <frames>    evaluate on synthetic data\n"
+	        "  -t <range>     detection treshold\n"
+	        "  -e <range>     presence enter treshold [sigma]\n"
+	        "  -x <range>     presence exit treshold [sigma]\n"
+	        "  -l <range>     calibration loops\n"
+	        "  -i <range>     initial calibration speed\n"
+	        "  -f <range>     calibration speed factor\n"
+	        "\n"
+	        "  range is from:to:step or a single value\n",
+	        name);
+}
+
+
+} // namespace
+
+
+int main(int argc, char *argv[])
+{
+	unsigned threads = std::thread::hardware_concurrency();
+	size_t random_cnt = 0;
+	size_t synth_cnt = 0;
+	uint32_t seed = 1;
+	Range treshold = kDefaultTreshold;
+	Range enter_sigma = kDefaultEnterSigma;
+	Range exit_sigma = kDefaultExitSigma;
+	Range loops = kDefaultLoops;
+	Range speed_initial = kDefaultSpeedInitial;
+	Range speed_factor = kDefaultSpeedFactor;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "j:n:s:S:t:e:x:l:i:f:h")) != -1) {
+		int status = 0;
+		switch (opt) {
+		case 'j':
+			threads = atoi(optarg);
+			break;
+		case 'n':
+			random_cnt = atol(optarg);
+			break;
+		case 's':
+			seed = atol(optarg);
+			break;
+		case 'S':
+			synth_cnt = atol(optarg);
+			break;
+		case 't':
+			status = parse_range(optarg, &treshold);
+			break;
+		case 'e':
+			status = parse_range(optarg, &enter_sigma);
+			break;
+		case 'x':
+			status = parse_range(optarg, &exit_sigma);
+			break;
+		case 'l':
+			status = parse_range(optarg, &loops);
+			break;
+		case 'i':
+			status = parse_range(optarg, &speed_initial);
+			break;
+		case 'f':
+			status = parse_range(optarg, &speed_factor);
+			break;
+		default:
+			print_usage(argv[0]);
+			return (opt == 'h') ? 0 : -1;
+		}
+		if (status != 0)
+			return -1;
+	}
+
+	//
+	// Load input once.
+	//
+	Dataset data;
+	data.has_truth = (synth_cnt > 0);
+
+	if (synth_cnt > 0) {
+		lm::SynthConfig sc;
+		sc.seed = seed;
+		sc.warmup = std::max<size_t>(sc.warmup, (size_t) loops.to + 1);
+
+		std::vector<lm::SynthFrame> synth;
+		synth_generate(sc, synth_cnt, &synth);
+
+		for (auto &s : synth) {
+			add_frame(&data, s.axes);
+			data.frames.back().present = s.source[0].present;
+			data.frames.back().position = s.source[0].position;
+		}
+	} else if (optind < argc) {
+		for (int i = optind; i < argc; ++i)
+			if (load_capture(argv[i], &data) != 0)
+				return -1;
+	} else {
+		print_usage(argv[0]);
+		return -1;
+	}
+
+	//
+	// Build configurations.
+	//
+	std::vector<Result> results;
+	if (random_cnt > 0) {
+		std::mt19937 rng(seed);
+		auto draw = [&rng](const Range &r) {
+			return std::uniform_real_distribution<double>(r.from,
+			                                              r.to)(rng);
+		};
+
+		for (size_t i = 0; i < random_cnt; ++i) {
+			Result r;
+			r.config.detection_treshold = draw(treshold);
+			r.config.presence_enter_sigma = draw(enter_sigma);
+			r.config.presence_exit_sigma = draw(exit_sigma);
+			r.config.calibration_loops = (int) std::round(draw(loops));
+			r.config.calibration_speed_initial = draw(speed_initial);
+			r.config.calibration_speed_factor = draw(speed_factor);
+			results.push_back(r);
+		}
+	} else {
+		for (double t : range_values(treshold))
+		for (double es : range_values(enter_sigma))
+		for (double xs : range_values(exit_sigma))
+		for (double l : range_values(loops))
+		for (double si : range_values(speed_initial))
+		for (double sf : range_values(speed_factor)) {
+			Result r;
+			r.config.detection_treshold = t;
+			r.config.presence_enter_sigma = es;
+			r.config.presence_exit_sigma = xs;
+			r.config.calibration_loops = (int) std::round(l);
+			r.config.calibration_speed_initial = si;
+			r.config.calibration_speed_factor = sf;
+			results.push_back(r);
+		}
+	}
+
+	//
+	// Calibration speed must stay in (0, 1] for all loops,
+	// see FilteredProcess::calibrate(), and exit treshold must not be
+	// above enter treshold.
+	//
+	results.erase(std::remove_if(results.begin(), results.end(),
+	        [](const Result &r) {
+	                const lm::PipelineConfig &c = r.config;
+	                const double last = c.calibration_speed_initial
+	                        - (c.calibration_loops - 1)
+	                        * c.calibration_speed_factor;
+	                return c.calibration_loops < 1 ||
+	                       c.presence_exit_sigma > c.presence_enter_sigma ||
+	                       c.calibration_speed_initial > 1.0 || last <= 0.0;
+	        }), results.end());
+
+	fprintf(stderr, "%zu frames, %zu configurations\n", data.frames.size(),
+	        results.size());
+
+	//
+	// Evaluate in parallel, workers take the next configuration.
+	//
+	std::atomic<size_t> next(0);
+	auto worker = [&]() {
+		size_t i;
+		while ((i = next.fetch_add(1)) < results.size())
+			evaluate(data, &results[i]);
+	};
+
+	const uint64_t start = lm::monotonic_ns();
+
+	threads = std::max(1u, std::min<unsigned>(threads, results.size()));
+	std::vector<std::thread> pool;
+	for (unsigned t = 1; t < threads; ++t)
+		pool.push_back(std::thread(worker));
+	worker();
+	for (auto &t : pool)
+		t.join();
+
+	const double seconds = (lm::monotonic_ns() - start) / 1e9;
+	fprintf(stderr, "evaluated in %.2f s, %.0f frames/s\n", seconds,
+	        seconds > 0.0 ? data.frames.size() * results.size() / seconds
+	                      : 0.0);
+
+	printf("treshold,enter_sigma,exit_sigma,loops,speed_initial,speed_factor,"
+	       "precision,recall,f1,");
+	for (int s = 0; s < lm::FRAME_STATUS_COUNT; ++s) {
+		std::string name = lm::frame_status_name((lm::FrameStatus) s);
+		std::replace(name.begin(), name.end(), ' ', '_');
+		printf("%s,", name.c_str());
+	}
+	printf("error_mean,error_p95\n");
+
+	for (auto &r : results)
+		print_result(r, data.has_truth);
+
+	return 0;
+}
@@ -9,6 +9,8 @@
 #include "core/Engine.hpp"
 #include "core/Handlers.hpp"
 #include "module/Log.hpp"
+#include "probes.hpp"
+#include "trace.hpp"
 
 
 namespace lm {
@@ -18,6 +20,8 @@ const std::string Visualize::GAME_NAME("Magneto locator - Visualization");
 
 const std::string Visualize::MODE_NAMES[MODE_COUNT] = {"Visualization"};
 
+const double Resources::LATENCY_REPORT_INTERVAL = 10.0;
+
 using engine::Engine;
 using engine::Priority;
 
@@ -109,12 +113,18 @@ bool Visualize::isValidMode(const Uint16 mode) const
 //
 Resources::Resources() :
 	shared_output_(),
-	magneto_data_()
+	magneto_data_(),
+	presented_(true),
+	latency_(LATENCY_WINDOW, LATENCY_REPORT_INTERVAL)
 {
 	if (shared_output_.init() != 0) {
 		Engine::exit(-1);
 	}
 	shared_output_.set_visualize_state(CONN_ACTIVE);
+
+	latency_.add_segment(LP_PUBLISH, LP_READ, "publish->read");
+	latency_.add_segment(LP_READ, LP_PRESENT, "read->present");
+	latency_.add_segment(LP_LINE, LP_PRESENT, "line->present");
 }
 
 Resources::~Resources()
@@ -129,6 +139,13 @@ int Resources::updateData()
 		MagnetoData tmp = shared_output_.get_data();
 		if (tmp.timestamp > magneto_data_.timestamp) {
 			magneto_data_ = tmp;
+			magneto_data_.set_stamp(LP_READ);
+			LM_PROBE(shm_read, magneto_data_.sequence,
+			         LM_PROBE_FIXED(magneto_data_.result.x),
+			         LM_PROBE_FIXED(magneto_data_.result.y),
+			         magneto_data_.stamp[LP_READ]
+			         - magneto_data_.stamp[LP_PUBLISH]);
+			presented_ = false;
 			return 0;
 		}
 		return 1;
@@ -142,6 +159,21 @@ const MagnetoData & Resources::getData() const
 	return magneto_data_;
 }
 
+void Resources::dataPresented()
+{
+	//
+	// Only the first presentation of a frame counts.
+	//
+	if (presented_)
+		return;
+	presented_ = true;
+
+	magneto_data_.set_stamp(LP_PRESENT);
+	latency_.update(magneto_data_.stamp);
+	if (latency_.is_due())
+		latency_.print(Engine::log << Priority::info << "Frame latency\n");
+}
+
 
 // Events : EventHandler
 Events::Events()
@@ -225,7 +257,8 @@ Logic::Logic() :
 	draw_sensors_(true),
 	draw_circles_(true),
 	draw_poi_(true),
-	draw_result_(true)
+	draw_result_(true),
+	draw_height_(true)
 {
 	//
 	// Setup update timer.
@@ -261,6 +294,7 @@ Logic::~Logic()
 void Logic::update()
 {
 	if (updateRequest_) {
+		LM_TRACE("Logic::update");
 		Resources &res = (Resources &) Engine::get().getResources();
 		res.updateData();
 		updateRequest_ = false;
@@ -312,6 +346,18 @@ void Logic::drawScene(SDL_Renderer* renderer)
 	if (draw_result_)
 		drawPoint(renderer, data.result.mirror_y(), 0xFF0000FF);
 
+	//
+	// Draw height of 3D result as circle of that radius around it.
+	//
+	if (draw_height_ && data.has_z)
+		drawCircle(renderer, Circle(data.result, data.z), 0xFF0000FF);
+
+}
+
+void Logic::scenePresented()
+{
+	Resources &res = (Resources &) Engine::get().getResources();
+	res.dataPresented();
 }
 
 void Logic::drawAxis(SDL_Renderer *renderer, double interval, Uint32 color)
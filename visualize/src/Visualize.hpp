@@ -6,6 +6,7 @@
 #include <SDL2/SDL.h>
 
 #include "core/Handlers.hpp"
+#include "latency.hpp"
 #include "shared.hpp"
 
 
@@ -53,8 +54,13 @@ protected:
 //------------------------------------------------------------------------------
 class Resources : public engine::ResourceHandler
 {
+	static const size_t LATENCY_WINDOW = 1024;
+	static const double LATENCY_REPORT_INTERVAL;
+
 	Shared shared_output_;
 	MagnetoData magneto_data_;
+	bool presented_;
+	LatencyReport latency_;
 
 public:
 	Resources();
@@ -64,6 +70,7 @@ public:
 
 	int updateData();
 	const MagnetoData & getData() const;
+	void dataPresented();
 };
 
 
@@ -104,6 +111,7 @@ class Logic :public engine::GameHandler
 	bool draw_circles_;
 	bool draw_poi_;
 	bool draw_result_;
+	bool draw_height_;
 
 public:
 	Logic();
@@ -111,6 +119,7 @@ public:
 
 	void update();
 	void drawScene(SDL_Renderer *renderer);
+	void scenePresented();
 
 	inline void updateRequest() { updateRequest_ = true; }
 
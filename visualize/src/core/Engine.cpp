@@ -6,6 +6,8 @@
 #include <SDL2/SDL_image.h>
 #include <SDL2/SDL_ttf.h>
 
+#include "trace.hpp"
+
 
 namespace engine {
 
@@ -282,8 +284,15 @@ void Engine::start()
 		//sem nahadz co vykreslit
 		if (window_->hasToRedraw()) {
 			window_->setRedrawFlag(false);
-			game_->drawScene(renderer);
-			SDL_RenderPresent(renderer);
+			{
+				LM_TRACE("drawScene");
+				game_->drawScene(renderer);
+			}
+			{
+				LM_TRACE("SDL_RenderPresent");
+				SDL_RenderPresent(renderer);
+			}
+			game_->scenePresented();
 		}
 	}
 }
@@ -53,6 +53,7 @@ public:
 
 	virtual void update() = 0;
 	virtual void drawScene(SDL_Renderer* renderer) = 0;
+	virtual void scenePresented() {}
 };
 
 
@@ -1,4 +1,5 @@
 #include "core/Engine.hpp"
+#include "trace.hpp"
 #include "Visualize.hpp"
 
 
@@ -8,6 +9,7 @@
 int main(int argc, char* argv[])
 {
 	engine::Engine::log.setLogLevel(engine::LOG_LEVEL_VERBOSE);
+	lm::trace_init("visualize");
 	engine::ModeHandler *visualize = new lm::Visualize();
 	engine::Engine& eng = engine::Engine::create(visualize);
 